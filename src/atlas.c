@@ -0,0 +1,658 @@
+#define STB_TRUETYPE_IMPLEMENTATION
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+
+#define ATLAS_CACHE_MAGIC 0x5441434Du
+#define ATLAS_CACHE_VERSION 3
+
+// Distance fields are measured on a bitmap rasterized this many times larger.
+#define ATLAS_SDF_OVERSAMPLE 4
+
+// Glyphs are kept this far apart so linear filtering never picks up a neighbour.
+#define ATLAS_PADDING 1
+
+// Table key for the font's missing-glyph box, past the last Unicode codepoint.
+#define ATLAS_MISSING 0x110000
+
+static void markDirty(AtlasPage* p, int from, int to) {
+    if (p->dirtyFrom < 0 || from < p->dirtyFrom) p->dirtyFrom = from;
+    if (to > p->dirtyTo) p->dirtyTo = to;
+}
+
+static void clearPage(AtlasPage* p) {
+    memset(p->pixels, 0, ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE);
+    p->shelfCount = 0;
+    p->bottom = 0;
+    p->dirtyFrom = -1;
+    p->dirtyTo = -1;
+    markDirty(p, 0, ATLAS_PAGE_SIZE - 1);
+}
+
+static int addPage(FontAtlas* a) {
+    if (a->pageCount >= ATLAS_MAX_PAGES) return -1;
+
+    AtlasPage* p = &a->pages[a->pageCount];
+    memset(p, 0, sizeof(*p));
+    p->pixels = malloc(ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE);
+    if (!p->pixels) return -1;
+
+    clearPage(p);
+    return a->pageCount++;
+}
+
+// Finds room for a w x h box on a page: the lowest shelf it fits in without wasting more
+// than a third of the shelf's height, or a new shelf below the others.
+static int shelfPlace(AtlasPage* p, int w, int h, int* x, int* y) {
+    w += ATLAS_PADDING;
+    h += ATLAS_PADDING;
+    if (w > ATLAS_PAGE_SIZE) return 0;
+
+    AtlasShelf* best = NULL;
+    for (int i = 0; i < p->shelfCount; i++) {
+        AtlasShelf* s = &p->shelves[i];
+        if (s->height < h || s->height * 2 > h * 3) continue;
+        if (s->x + w > ATLAS_PAGE_SIZE) continue;
+        if (!best || s->height < best->height) best = s;
+    }
+
+    if (!best) {
+        if (p->bottom + h > ATLAS_PAGE_SIZE) return 0;
+
+        if (p->shelfCount == p->shelfCapacity) {
+            int cap = p->shelfCapacity ? p->shelfCapacity * 2 : 16;
+            AtlasShelf* grown = realloc(p->shelves, cap * sizeof(AtlasShelf));
+            if (!grown) return 0;
+            p->shelves = grown;
+            p->shelfCapacity = cap;
+        }
+
+        best = &p->shelves[p->shelfCount++];
+        best->y = p->bottom;
+        best->height = h;
+        best->x = 0;
+        p->bottom += h;
+    }
+
+    *x = best->x;
+    *y = best->y;
+    best->x += w;
+    return 1;
+}
+
+static void markQuadsDirty(FontAtlas* a, int id) {
+    if (a->quadsDirtyFrom < 0 || id < a->quadsDirtyFrom) a->quadsDirtyFrom = id;
+    if (id > a->quadsDirtyTo) a->quadsDirtyTo = id;
+}
+
+// Makes room for ids up to capacity; the free list can never hold more ids than that.
+static int growQuads(FontAtlas* a, int capacity) {
+    if (capacity <= a->quadCapacity) return 1;
+
+    stbtt_bakedchar* quads = realloc(a->quads, capacity * sizeof(stbtt_bakedchar));
+    if (!quads) return 0;
+    a->quads = quads;
+
+    unsigned short* freeIds = realloc(a->freeIds, capacity * sizeof(unsigned short));
+    if (!freeIds) return 0;
+    a->freeIds = freeIds;
+
+    a->quadCapacity = capacity;
+    return 1;
+}
+
+// A reused id when one is free, else the next unused one; -1 when all are taken.
+static int allocId(FontAtlas* a) {
+    if (a->freeIdCount > 0) return a->freeIds[--a->freeIdCount];
+    if (a->quadCount >= ATLAS_MAX_GLYPH_IDS) return -1;
+    if (a->quadCount == a->quadCapacity && !growQuads(a, a->quadCapacity * 2)) return -1;
+    return a->quadCount++;
+}
+
+static unsigned int slotOf(const FontAtlas* a, unsigned int codepoint) {
+    unsigned int mask = (unsigned int)a->glyphCapacity - 1;
+    unsigned int slot = (codepoint * 2654435761u) & mask;
+    while (a->glyphs[slot].codepoint && a->glyphs[slot].codepoint != codepoint) slot = (slot + 1) & mask;
+    return slot;
+}
+
+// Rebuilds the table at capacity, keeping every glyph except those on page dropPage, whose
+// ids are freed.
+static int rehash(FontAtlas* a, int capacity, int dropPage) {
+    AtlasGlyph* old = a->glyphs;
+    int oldCapacity = a->glyphCapacity;
+
+    AtlasGlyph* glyphs = calloc(capacity, sizeof(AtlasGlyph));
+    if (!glyphs) return 0;
+
+    a->glyphs = glyphs;
+    a->glyphCapacity = capacity;
+    a->glyphCount = 0;
+
+    for (int i = 0; i < oldCapacity; i++) {
+        if (!old[i].codepoint) continue;
+        if (old[i].page == dropPage) {
+            if (!old[i].shared) a->freeIds[a->freeIdCount++] = old[i].id;
+            continue;
+        }
+        a->glyphs[slotOf(a, old[i].codepoint)] = old[i];
+        a->glyphCount++;
+    }
+
+    free(old);
+    return 1;
+}
+
+// Least recently used page other than page 0.
+static int evictPage(FontAtlas* a) {
+    int victim = -1;
+    for (int i = 1; i < a->pageCount; i++) {
+        if (victim < 0 || a->pages[i].lastUsed < a->pages[victim].lastUsed) victim = i;
+    }
+    if (victim < 0) return -1;
+
+    if (a->onEvict) a->onEvict(victim, a->evictUser);
+    if (!rehash(a, a->glyphCapacity, victim)) return -1;
+    clearPage(&a->pages[victim]);
+    return victim;
+}
+
+// Finds a page with room for a w x h glyph, adding or evicting a page when all are full.
+static int placeGlyph(FontAtlas* a, int w, int h, int* x, int* y) {
+    for (int i = 0; i < a->pageCount; i++) {
+        if (shelfPlace(&a->pages[i], w, h, x, y)) return i;
+    }
+
+    int page = addPage(a);
+    if (page < 0) page = evictPage(a);
+    if (page < 0 || !shelfPlace(&a->pages[page], w, h, x, y)) return -1;
+    return page;
+}
+
+typedef struct {
+    int dx;
+    int dy;
+} SeedOffset;
+
+static void seedCompare(SeedOffset* grid, int stride, int i, int ox, int oy) {
+    SeedOffset other = grid[i + oy * stride + ox];
+    other.dx += ox;
+    other.dy += oy;
+
+    SeedOffset* p = &grid[i];
+    if (other.dx * other.dx + other.dy * other.dy < p->dx * p->dx + p->dy * p->dy) *p = other;
+}
+
+// Squared distance from each pixel of a w x h bitmap to the nearest pixel on the other side
+// of the outline, using 8SSEDT: two sweeps that hand nearest-seed offsets between
+// neighbours. The grid has a one-pixel border of far cells so the sweeps need no bounds
+// checks.
+static int distanceToOutline(const unsigned char* cover, int w, int h, int* dist2) {
+    int stride = w + 2;
+    SeedOffset* grid = malloc((size_t)stride * (h + 2) * sizeof(SeedOffset));
+    if (!grid) return 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        // Pass 0 finds the nearest inside pixel for outside ones, pass 1 the reverse.
+        for (int y = 0; y < h + 2; y++) {
+            for (int x = 0; x < stride; x++) {
+                int seed = x > 0 && y > 0 && x <= w && y <= h && (cover[(y - 1) * w + x - 1] >= 128) == (pass == 0);
+                grid[y * stride + x].dx = seed ? 0 : 4096;
+                grid[y * stride + x].dy = seed ? 0 : 4096;
+            }
+        }
+
+        for (int y = 1; y <= h; y++) {
+            for (int x = 1; x <= w; x++) {
+                int i = y * stride + x;
+                seedCompare(grid, stride, i, -1, 0);
+                seedCompare(grid, stride, i, 0, -1);
+                seedCompare(grid, stride, i, -1, -1);
+                seedCompare(grid, stride, i, 1, -1);
+            }
+            for (int x = w; x >= 1; x--) seedCompare(grid, stride, y * stride + x, 1, 0);
+        }
+
+        for (int y = h; y >= 1; y--) {
+            for (int x = w; x >= 1; x--) {
+                int i = y * stride + x;
+                seedCompare(grid, stride, i, 1, 0);
+                seedCompare(grid, stride, i, 0, 1);
+                seedCompare(grid, stride, i, -1, 1);
+                seedCompare(grid, stride, i, 1, 1);
+            }
+            for (int x = 1; x <= w; x++) seedCompare(grid, stride, y * stride + x, -1, 0);
+        }
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                const SeedOffset* p = &grid[(y + 1) * stride + x + 1];
+                if ((cover[y * w + x] >= 128) == (pass == 1)) dist2[y * w + x] = p->dx * p->dx + p->dy * p->dy;
+            }
+        }
+    }
+
+    free(grid);
+    return 1;
+}
+
+// Writes the distance field of codepoint for the w x h texel box whose top-left corner is
+// at (x0, y0) relative to the pen, oversampling the outline and reading the distance at
+// the middle of each texel.
+static void rasterizeSdf(FontAtlas* a, unsigned int codepoint, int x0, int y0, int w, int h, unsigned char* out, int stride) {
+    int hw = w * ATLAS_SDF_OVERSAMPLE;
+    int hh = h * ATLAS_SDF_OVERSAMPLE;
+    float hs = a->scale * ATLAS_SDF_OVERSAMPLE;
+
+    unsigned char* cover = calloc((size_t)hw * hh, 1);
+    int* dist2 = malloc((size_t)hw * hh * sizeof(int));
+    if (!cover || !dist2) {
+        free(cover);
+        free(dist2);
+        return;
+    }
+
+    int hx0, hy0, hx1, hy1;
+    stbtt_GetCodepointBitmapBox(&a->font, (int)codepoint, hs, hs, &hx0, &hy0, &hx1, &hy1);
+    int ox = hx0 - x0 * ATLAS_SDF_OVERSAMPLE;
+    int oy = hy0 - y0 * ATLAS_SDF_OVERSAMPLE;
+    stbtt_MakeCodepointBitmap(&a->font, cover + oy * hw + ox, hx1 - hx0, hy1 - hy0, hw, hs, hs, (int)codepoint);
+
+    if (distanceToOutline(cover, hw, hh, dist2)) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                int i = (y * ATLAS_SDF_OVERSAMPLE + ATLAS_SDF_OVERSAMPLE / 2) * hw + x * ATLAS_SDF_OVERSAMPLE + ATLAS_SDF_OVERSAMPLE / 2;
+
+                // Pixel centres sit half a pixel from the edge between them.
+                float d = (sqrtf((float)dist2[i]) - 0.5f) / ATLAS_SDF_OVERSAMPLE;
+                if (cover[i] >= 128) d = -d;
+
+                int value = (int)(128.0f - d * 127.0f / ATLAS_SDF_SPREAD + 0.5f);
+                out[y * stride + x] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+        }
+    }
+
+    free(cover);
+    free(dist2);
+}
+
+// Rasterizes codepoint onto a page and fills in where it landed.
+static int rasterize(FontAtlas* a, unsigned int codepoint, int* page, stbtt_bakedchar* quad) {
+    int advance, lsb, x0, y0, x1, y1;
+    stbtt_GetCodepointHMetrics(&a->font, (int)codepoint, &advance, &lsb);
+    stbtt_GetCodepointBitmapBox(&a->font, (int)codepoint, a->scale, a->scale, &x0, &y0, &x1, &y1);
+
+    int w = x1 - x0;
+    int h = y1 - y0;
+    int x = 0, y = 0;
+
+    *page = 0;
+    if (w > 0 && h > 0) {
+        if (a->sdf) {
+            x0 -= ATLAS_SDF_SPREAD;
+            y0 -= ATLAS_SDF_SPREAD;
+            w += 2 * ATLAS_SDF_SPREAD;
+            h += 2 * ATLAS_SDF_SPREAD;
+        }
+
+        *page = placeGlyph(a, w, h, &x, &y);
+        if (*page < 0) return 0;
+
+        AtlasPage* p = &a->pages[*page];
+        unsigned char* dst = p->pixels + y * ATLAS_PAGE_SIZE + x;
+        if (a->sdf) rasterizeSdf(a, codepoint, x0, y0, w, h, dst, ATLAS_PAGE_SIZE);
+        else stbtt_MakeCodepointBitmap(&a->font, dst, w, h, ATLAS_PAGE_SIZE, a->scale, a->scale, (int)codepoint);
+        markDirty(p, y, y + h - 1);
+        a->rasterized++;
+    } else {
+        w = 0;
+        h = 0;
+    }
+
+    quad->x0 = (unsigned short)x;
+    quad->y0 = (unsigned short)y;
+    quad->x1 = (unsigned short)(x + w);
+    quad->y1 = (unsigned short)(y + h);
+    quad->xoff = (float)x0;
+    quad->yoff = (float)y0;
+    quad->xadvance = a->scale * advance;
+    return 1;
+}
+
+// Loads the font, which the atlas takes ownership of even on failure, and rasterizes
+// printable ASCII into ascii, laid out like stbtt_BakeFontBitmap output.
+int atlasInit(FontAtlas* a, unsigned char* fontData, float pixelHeight, int sdf, stbtt_bakedchar ascii[96]) {
+    memset(a, 0, sizeof(*a));
+
+    if (!stbtt_InitFont(&a->font, fontData, stbtt_GetFontOffsetForIndex(fontData, 0))) {
+        printf("atlasInit: not a usable font\n");
+        free(fontData);
+        return 0;
+    }
+    a->fontData = fontData;
+    a->scale = stbtt_ScaleForPixelHeight(&a->font, pixelHeight);
+    a->pixelHeight = pixelHeight;
+    a->sdf = sdf;
+
+    a->glyphs = calloc(256, sizeof(AtlasGlyph));
+    if (!a->glyphs || addPage(a) != 0) {
+        atlasFree(a);
+        return 0;
+    }
+    a->glyphCapacity = 256;
+    a->quadsDirtyFrom = -1;
+    a->quadsDirtyTo = -1;
+    if (!growQuads(a, 256)) {
+        atlasFree(a);
+        return 0;
+    }
+
+    for (int i = 0; i < 96; i++) {
+        int page;
+        if (!rasterize(a, 32 + i, &page, &ascii[i]) || page != 0) {
+            printf("atlasInit: ASCII does not fit on one page\n");
+            atlasFree(a);
+            return 0;
+        }
+        a->quads[i] = ascii[i];
+        markQuadsDirty(a, i);
+    }
+    a->quadCount = 96;
+    return 1;
+}
+
+void atlasFree(FontAtlas* a) {
+    for (int i = 0; i < a->pageCount; i++) {
+        free(a->pages[i].pixels);
+        free(a->pages[i].shelves);
+    }
+    free(a->glyphs);
+    free(a->quads);
+    free(a->freeIds);
+    free(a->fontData);
+    memset(a, 0, sizeof(*a));
+}
+
+// The glyph for a codepoint outside printable ASCII, rasterizing it on first use. The
+// pointer is only good until the next call. Returns NULL if the glyph cannot be placed.
+const AtlasGlyph* atlasGlyph(FontAtlas* a, unsigned int codepoint) {
+    if (!a->glyphs || !codepoint) return NULL;
+
+    AtlasGlyph* g = &a->glyphs[slotOf(a, codepoint)];
+    if (!g->codepoint) {
+        AtlasGlyph made;
+
+        if (codepoint != ATLAS_MISSING && !stbtt_FindGlyphIndex(&a->font, (int)codepoint)) {
+            // Characters the font lacks all share one copy of its missing-glyph box.
+            const AtlasGlyph* missing = atlasGlyph(a, ATLAS_MISSING);
+            if (!missing) return NULL;
+            made = *missing;
+            made.shared = 1;
+        } else {
+            // The id is taken first: rasterizing may evict a page, which frees ids, but not
+            // this one since it is not in the table yet.
+            int id = allocId(a);
+            if (id < 0) return NULL;
+            if (!rasterize(a, codepoint, &made.page, &made.quad)) {
+                a->freeIds[a->freeIdCount++] = (unsigned short)id;
+                return NULL;
+            }
+            made.id = (unsigned short)id;
+            made.shared = 0;
+            a->quads[id] = made.quad;
+            markQuadsDirty(a, id);
+        }
+        made.codepoint = codepoint;
+
+        if ((a->glyphCount + 1) * 2 > a->glyphCapacity) {
+            if (!rehash(a, a->glyphCapacity * 2, -1)) return NULL;
+        }
+
+        // Evicting a page to make room rebuilds the table, so the slot is looked up again.
+        g = &a->glyphs[slotOf(a, codepoint)];
+        *g = made;
+        a->glyphCount++;
+    }
+
+    a->pages[g->page].lastUsed = ++a->clock;
+    return g;
+}
+
+// Horizontal advance of a codepoint, read from the font when it has not been rasterized.
+float atlasAdvance(FontAtlas* a, unsigned int codepoint) {
+    if (!a->glyphs) return 0.0f;
+
+    const AtlasGlyph* g = &a->glyphs[slotOf(a, codepoint)];
+    if (g->codepoint) return g->quad.xadvance;
+
+    int advance, lsb;
+    stbtt_GetCodepointHMetrics(&a->font, (int)codepoint, &advance, &lsb);
+    return a->scale * advance;
+}
+
+// FNV-1a over the font file, so an edited font never matches an old cache.
+unsigned int atlasFontHash(const unsigned char* fontData, size_t size) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= fontData[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Cache file layout: this header, the ASCII quads, then for each page its used height,
+// its shelves and its used rows of pixels, then the glyph table entries.
+typedef struct {
+    unsigned int magic;
+    int version;
+    AtlasCacheKey key;
+    int pageSize;
+    int pageCount;
+    int glyphCapacity;
+    int glyphCount;
+} AtlasCacheHeader;
+
+static int readPage(FILE* f, AtlasPage* p) {
+    if (fread(&p->bottom, sizeof(int), 1, f) != 1 || fread(&p->shelfCount, sizeof(int), 1, f) != 1) return 0;
+    if (p->bottom < 0 || p->bottom > ATLAS_PAGE_SIZE || p->shelfCount < 0 || p->shelfCount > ATLAS_PAGE_SIZE) return 0;
+
+    if (p->shelfCount > 0) {
+        p->shelves = malloc(p->shelfCount * sizeof(AtlasShelf));
+        if (!p->shelves) return 0;
+        p->shelfCapacity = p->shelfCount;
+        if (fread(p->shelves, sizeof(AtlasShelf), p->shelfCount, f) != (size_t)p->shelfCount) return 0;
+    }
+
+    for (int i = 0; i < p->shelfCount; i++) {
+        const AtlasShelf* s = &p->shelves[i];
+        if (s->y < 0 || s->height <= 0 || s->y + s->height > p->bottom || s->x < 0 || s->x > ATLAS_PAGE_SIZE) return 0;
+    }
+
+    return fread(p->pixels, ATLAS_PAGE_SIZE, p->bottom, f) == (size_t)p->bottom;
+}
+
+// Loads an atlas saved by atlasSaveCache, skipping rasterization. Only on success does the
+// atlas take ownership of fontData; on failure the caller still owns it and can fall back
+// to atlasInit.
+int atlasLoadCache(FontAtlas* a, const char* path, const AtlasCacheKey* key, unsigned char* fontData, stbtt_bakedchar ascii[96]) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+
+    AtlasCacheHeader h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 &&
+        h.magic == ATLAS_CACHE_MAGIC && h.version == ATLAS_CACHE_VERSION &&
+        memcmp(&h.key, key, sizeof(h.key)) == 0 && h.pageSize == ATLAS_PAGE_SIZE &&
+        h.pageCount >= 1 && h.pageCount <= ATLAS_MAX_PAGES &&
+        h.glyphCapacity >= 256 && (h.glyphCapacity & (h.glyphCapacity - 1)) == 0 &&
+        h.glyphCount >= 0 && h.glyphCount * 2 <= h.glyphCapacity;
+
+    memset(a, 0, sizeof(*a));
+    ok = ok && stbtt_InitFont(&a->font, fontData, stbtt_GetFontOffsetForIndex(fontData, 0));
+    ok = ok && fread(ascii, sizeof(stbtt_bakedchar), 96, f) == 96;
+
+    for (int i = 0; ok && i < h.pageCount; i++) {
+        ok = addPage(a) == i && readPage(f, &a->pages[i]);
+    }
+
+    for (int i = 0; ok && i < 96; i++) {
+        ok = ascii[i].x1 <= ATLAS_PAGE_SIZE && ascii[i].y1 <= a->pages[0].bottom;
+    }
+
+    if (ok) {
+        a->glyphs = calloc(h.glyphCapacity, sizeof(AtlasGlyph));
+        a->glyphCapacity = h.glyphCapacity;
+        ok = a->glyphs != NULL && growQuads(a, 256);
+    }
+
+    // Ids are not saved separately: the quads table is rebuilt from the glyphs, which
+    // must not claim an id twice, and the ids left over become the free list.
+    unsigned char* taken = ok ? calloc(ATLAS_MAX_GLYPH_IDS, 1) : NULL;
+    ok = ok && taken != NULL;
+    a->quadCount = 96;
+    for (int i = 0; ok && i < 96; i++) a->quads[i] = ascii[i];
+
+    for (int i = 0; ok && i < h.glyphCount; i++) {
+        AtlasGlyph g;
+        ok = fread(&g, sizeof(g), 1, f) == 1 && g.codepoint && g.page >= 0 && g.page < a->pageCount &&
+            g.quad.x1 <= ATLAS_PAGE_SIZE && g.quad.y1 <= a->pages[g.page].bottom &&
+            g.id >= 96 && g.id < ATLAS_MAX_GLYPH_IDS;
+        if (ok && !g.shared) {
+            while (ok && g.id >= a->quadCapacity) ok = growQuads(a, a->quadCapacity * 2);
+            ok = ok && !taken[g.id];
+            if (ok) {
+                taken[g.id] = 1;
+                a->quads[g.id] = g.quad;
+                if (g.id >= a->quadCount) a->quadCount = g.id + 1;
+            }
+        }
+        if (ok) {
+            a->glyphs[slotOf(a, g.codepoint)] = g;
+            a->glyphCount++;
+        }
+    }
+    fclose(f);
+
+    for (int i = 0; ok && i < a->glyphCapacity; i++) {
+        if (a->glyphs[i].codepoint && a->glyphs[i].shared) ok = taken[a->glyphs[i].id];
+    }
+    for (int id = a->quadCount - 1; ok && id >= 96; id--) {
+        if (!taken[id]) {
+            memset(&a->quads[id], 0, sizeof(stbtt_bakedchar));
+            a->freeIds[a->freeIdCount++] = (unsigned short)id;
+        }
+    }
+    free(taken);
+
+    if (!ok) {
+        atlasFree(a);
+        return 0;
+    }
+
+    a->fontData = fontData;
+    a->scale = stbtt_ScaleForPixelHeight(&a->font, (float)key->pixelHeight);
+    a->pixelHeight = (float)key->pixelHeight;
+    a->sdf = key->sdf;
+    a->quadsDirtyFrom = 0;
+    a->quadsDirtyTo = a->quadCount - 1;
+    return 1;
+}
+
+int atlasSaveCache(const FontAtlas* a, const char* path, const AtlasCacheKey* key, const stbtt_bakedchar ascii[96]) {
+    if (!a->glyphs) return 0;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        printf("atlasSaveCache: could not write %s\n", path);
+        return 0;
+    }
+
+    AtlasCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = ATLAS_CACHE_MAGIC;
+    h.version = ATLAS_CACHE_VERSION;
+    h.key = *key;
+    h.pageSize = ATLAS_PAGE_SIZE;
+    h.pageCount = a->pageCount;
+    h.glyphCapacity = a->glyphCapacity;
+    h.glyphCount = a->glyphCount;
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(ascii, sizeof(stbtt_bakedchar), 96, f) == 96;
+
+    for (int i = 0; ok && i < a->pageCount; i++) {
+        const AtlasPage* p = &a->pages[i];
+        ok = fwrite(&p->bottom, sizeof(int), 1, f) == 1 && fwrite(&p->shelfCount, sizeof(int), 1, f) == 1 &&
+            fwrite(p->shelves, sizeof(AtlasShelf), p->shelfCount, f) == (size_t)p->shelfCount &&
+            fwrite(p->pixels, ATLAS_PAGE_SIZE, p->bottom, f) == (size_t)p->bottom;
+    }
+
+    for (int i = 0; ok && i < a->glyphCapacity; i++) {
+        if (a->glyphs[i].codepoint) ok = fwrite(&a->glyphs[i], sizeof(AtlasGlyph), 1, f) == 1;
+    }
+
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        printf("atlasSaveCache: could not write %s\n", path);
+        remove(path);
+    }
+    return ok;
+}
+
+// Reports the rows of a page changed since the last call, if any, and marks it clean.
+int atlasTakeDirty(FontAtlas* a, int page, int* fromRow, int* toRow) {
+    if (page < 0 || page >= a->pageCount) return 0;
+
+    AtlasPage* p = &a->pages[page];
+    if (p->dirtyFrom < 0) return 0;
+
+    *fromRow = p->dirtyFrom;
+    *toRow = p->dirtyTo;
+    p->dirtyFrom = -1;
+    p->dirtyTo = -1;
+    return 1;
+}
+
+// Reports the glyph ids whose quads changed since the last call, if any.
+int atlasTakeDirtyQuads(FontAtlas* a, int* fromId, int* toId) {
+    if (a->quadsDirtyFrom < 0) return 0;
+
+    *fromId = a->quadsDirtyFrom;
+    *toId = a->quadsDirtyTo;
+    a->quadsDirtyFrom = -1;
+    a->quadsDirtyTo = -1;
+    return 1;
+}
+
+// Decodes one character from s, returning the bytes it used. Malformed input decodes as
+// U+FFFD one byte at a time.
+int utf8Decode(const unsigned char* s, int length, unsigned int* codepoint) {
+    unsigned int c = s[0];
+    int extra;
+
+    if (c < 0x80) {
+        *codepoint = c;
+        return 1;
+    }
+
+    if (c >= 0xC2 && c < 0xE0) { extra = 1; c &= 0x1F; }
+    else if (c >= 0xE0 && c < 0xF0) { extra = 2; c &= 0x0F; }
+    else if (c >= 0xF0 && c < 0xF5) { extra = 3; c &= 0x07; }
+    else extra = -1;
+
+    *codepoint = 0xFFFD;
+    if (extra < 0 || extra >= length) return 1;
+
+    for (int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 1;
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+
+    if ((extra == 2 && (c < 0x800 || (c >= 0xD800 && c < 0xE000))) || (extra == 3 && (c < 0x10000 || c > 0x10FFFF))) return 1;
+
+    *codepoint = c;
+    return extra + 1;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stddef.h>
+#include <FreeType/stb_truetype.h>
+
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_PAGES 4
+
+// Distance-field glyphs hold distances up to this many texels either side of the outline.
+#define ATLAS_SDF_SPREAD 4
+
+// Glyph ids fit in 15 bits; printable ASCII takes ids 0 to 95.
+#define ATLAS_MAX_GLYPH_IDS 0x8000
+
+// A horizontal strip of a page that glyphs of about the same height are packed into.
+typedef struct {
+    int y;
+    int height;
+    int x;
+} AtlasShelf;
+
+// One texture's worth of glyphs. Rows from dirtyFrom to dirtyTo changed since the page was
+// last uploaded; dirtyFrom is -1 when the texture is up to date.
+typedef struct {
+    unsigned char* pixels;
+    AtlasShelf* shelves;
+    int shelfCount;
+    int shelfCapacity;
+    int bottom;
+    int dirtyFrom;
+    int dirtyTo;
+    unsigned int lastUsed;
+} AtlasPage;
+
+// shared is set for codepoints the font lacks, which reuse the missing glyph's id.
+typedef struct {
+    unsigned int codepoint;
+    int page;
+    unsigned short id;
+    unsigned short shared;
+    stbtt_bakedchar quad;
+} AtlasGlyph;
+
+// What a cached atlas was rasterized for; a cache file is only used when all of it matches.
+typedef struct {
+    unsigned int fontHash;
+    int pixelHeight;
+    int dpi;
+    int sdf;
+} AtlasCacheKey;
+
+// Glyph atlas filled on demand. Printable ASCII is rasterized up front into page 0 and
+// handed back as a flat array for the renderers' fast path; any other codepoint is
+// rasterized the first time it is asked for and found again through an open-addressing
+// table. When every page is full the least recently used one is cleared and reused; page
+// 0 is never evicted. onEvict runs before a page is cleared, so anything already drawn
+// from it can be flushed first.
+// With sdf set, texels hold signed distances to the outline instead of coverage: 128 on
+// the edge, rising inside, with ATLAS_SDF_SPREAD texels of padding around every glyph.
+// Such glyphs can be drawn at any size from one rasterization.
+// Every glyph also has a small id indexing quads, so a renderer can keep the quads on the
+// GPU and refer to glyphs by id; ids of evicted glyphs are reused.
+typedef struct {
+    stbtt_fontinfo font;
+    unsigned char* fontData;
+    float scale;
+    float pixelHeight;
+    int sdf;
+
+    AtlasPage pages[ATLAS_MAX_PAGES];
+    int pageCount;
+    unsigned int clock;
+
+    AtlasGlyph* glyphs;
+    int glyphCapacity;
+    int glyphCount;
+
+    // Quads by glyph id; those from quadsDirtyFrom to quadsDirtyTo changed since last taken.
+    stbtt_bakedchar* quads;
+    int quadCount;
+    int quadCapacity;
+    int quadsDirtyFrom;
+    int quadsDirtyTo;
+    unsigned short* freeIds;
+    int freeIdCount;
+
+    // Glyphs rasterized since the atlas was built or loaded.
+    int rasterized;
+
+    void (*onEvict)(int page, void* user);
+    void* evictUser;
+} FontAtlas;
+
+int atlasInit(FontAtlas* a, unsigned char* fontData, float pixelHeight, int sdf, stbtt_bakedchar ascii[96]);
+void atlasFree(FontAtlas* a);
+const AtlasGlyph* atlasGlyph(FontAtlas* a, unsigned int codepoint);
+float atlasAdvance(FontAtlas* a, unsigned int codepoint);
+int atlasTakeDirty(FontAtlas* a, int page, int* fromRow, int* toRow);
+int atlasTakeDirtyQuads(FontAtlas* a, int* fromId, int* toId);
+
+unsigned int atlasFontHash(const unsigned char* fontData, size_t size);
+int atlasLoadCache(FontAtlas* a, const char* path, const AtlasCacheKey* key, unsigned char* fontData, stbtt_bakedchar ascii[96]);
+int atlasSaveCache(const FontAtlas* a, const char* path, const AtlasCacheKey* key, const stbtt_bakedchar ascii[96]);
+
+int utf8Decode(const unsigned char* s, int length, unsigned int* codepoint);
+
+#endif
\ No newline at end of file
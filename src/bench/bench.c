@@ -0,0 +1,190 @@
+// mcode-bench: replays a recorded keystroke trace against a source file using the headless
+// editing core, and reports per-operation latency percentiles and allocations.
+//
+//   mcode-bench <source-file> <trace-file> [repeat]
+//
+// Record a trace by running MCode with MCODE_RECORD_TRACE=<path> set.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "../edit.h"
+#include "../input.h"
+
+// Counting wrappers around glibc's allocator, so every allocation the core makes is seen.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static unsigned long allocCount = 0;
+
+void* malloc(size_t size) { allocCount++; return __libc_malloc(size); }
+void* calloc(size_t count, size_t size) { allocCount++; return __libc_calloc(count, size); }
+void* realloc(void* ptr, size_t size) { allocCount++; return __libc_realloc(ptr, size); }
+void free(void* ptr) { __libc_free(ptr); }
+
+typedef enum {
+    OP_CHAR,
+    OP_ENTER,
+    OP_BACKSPACE,
+    OP_MOVE,
+    OP_OTHER,
+    OP_COUNT
+} OpKind;
+
+static const char* opNames[OP_COUNT] = { "char", "enter", "backspace", "move", "other" };
+
+typedef struct {
+    double* samples;
+    int count;
+    int capacity;
+    unsigned long allocs;
+} OpStats;
+
+static double nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static OpKind classify(const InputEvent* e) {
+    if (e->type == INPUT_CHAR) return OP_CHAR;
+
+    switch (e->key) {
+        case GLFW_KEY_ENTER:
+        case GLFW_KEY_KP_ENTER:  return OP_ENTER;
+        case GLFW_KEY_BACKSPACE: return OP_BACKSPACE;
+        case GLFW_KEY_LEFT:
+        case GLFW_KEY_RIGHT:
+        case GLFW_KEY_UP:
+        case GLFW_KEY_DOWN:      return OP_MOVE;
+    }
+    return OP_OTHER;
+}
+
+static void addSample(OpStats* s, double micros, unsigned long allocs) {
+    if (s->count >= s->capacity) {
+        int cap = s->capacity ? s->capacity * 2 : 1024;
+        double* grown = realloc(s->samples, cap * sizeof(double));
+        if (!grown) return;
+        s->samples = grown;
+        s->capacity = cap;
+    }
+    s->samples[s->count++] = micros;
+    s->allocs += allocs;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int count, int p) {
+    return sorted[(count - 1) * p / 100];
+}
+
+static char* readWholeFile(const char* path, size_t* outLength) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    char* text = malloc((size_t)size + 1);
+    if (!text) {
+        fclose(f);
+        return NULL;
+    }
+
+    *outLength = fread(text, 1, (size_t)size, f);
+    text[*outLength] = '\0';
+    fclose(f);
+    return text;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        printf("usage: %s <source-file> <trace-file> [repeat]\n", argv[0]);
+        return 1;
+    }
+
+    int repeat = argc > 3 ? atoi(argv[3]) : 1;
+    if (repeat < 1) repeat = 1;
+
+    size_t length = 0;
+    char* text = readWholeFile(argv[1], &length);
+    if (!text) {
+        printf("Could not read %s\n", argv[1]);
+        return 1;
+    }
+
+    InputEvent* events = NULL;
+    int eventCount = inputLoadTrace(argv[2], &events);
+    if (eventCount < 0) {
+        printf("Could not read trace %s\n", argv[2]);
+        free(text);
+        return 1;
+    }
+
+    OpStats stats[OP_COUNT];
+    memset(stats, 0, sizeof(stats));
+
+    double loadMicros = 0.0;
+    unsigned long loadAllocs = 0;
+
+    for (int r = 0; r < repeat; r++) {
+        EditState e;
+        editInit(&e);
+
+        unsigned long allocsBefore = allocCount;
+        double start = nowMicros();
+        editLoad(&e, text, length);
+        loadMicros += nowMicros() - start;
+        loadAllocs += allocCount - allocsBefore;
+
+        for (int i = 0; i < eventCount; i++) {
+            const InputEvent* ev = &events[i];
+
+            allocsBefore = allocCount;
+            start = nowMicros();
+
+            // One event per batch, as if each keystroke landed in its own frame.
+            editBeginBatch(&e);
+            if (ev->type == INPUT_KEY) editKeyDown(&e, ev->key, ev->mods);
+            else editCharInput(&e, ev->codepoint);
+            editEndBatch(&e);
+
+            double elapsed = nowMicros() - start;
+            addSample(&stats[classify(ev)], elapsed, allocCount - allocsBefore);
+        }
+
+        editFree(&e);
+    }
+
+    printf("source: %s (%zu bytes)\n", argv[1], length);
+    printf("trace:  %s (%d events, %d run%s)\n", argv[2], eventCount, repeat, repeat == 1 ? "" : "s");
+    printf("load:   %.1f us, %.1f allocs\n\n", loadMicros / repeat, (double)loadAllocs / repeat);
+
+    printf("%-10s %8s %10s %10s %10s %10s\n", "op", "count", "p50 us", "p99 us", "max us", "allocs/op");
+    for (int k = 0; k < OP_COUNT; k++) {
+        OpStats* s = &stats[k];
+        if (s->count == 0) continue;
+
+        qsort(s->samples, s->count, sizeof(double), compareDouble);
+        printf("%-10s %8d %10.2f %10.2f %10.2f %10.2f\n", opNames[k], s->count,
+               percentile(s->samples, s->count, 50), percentile(s->samples, s->count, 99),
+               s->samples[s->count - 1], (double)s->allocs / s->count);
+        free(s->samples);
+    }
+
+    free(events);
+    free(text);
+    return 0;
+}
\ No newline at end of file
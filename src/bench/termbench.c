@@ -0,0 +1,209 @@
+// mcode-termbench: feeds recorded shell output through the terminal panel's headless path
+// (VT parser, scrollback, wrapping and live-screen layout) and reports throughput, memory
+// and per-chunk latency percentiles.
+//
+//   mcode-termbench [-c chunk-bytes] [-w wrap-width] [-r repeat] <capture>...
+//
+// Record a capture by running MCode with MCODE_RECORD_PTY=<path> set; every byte the shell
+// writes is appended to it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "../term.h"
+
+// Same screen and scrollback as the panel in cmd.c.
+#define TERM_ROWS 30
+#define TERM_COLS 120
+#define SCROLLBACK_LINES 10000
+#define SCROLLBACK_BYTES (16 * 1024 * 1024)
+
+// Advance of every glyph, close to the panel's default font size.
+#define GLYPH_ADVANCE 9.0f
+
+typedef struct {
+    double* samples;
+    int count;
+    int capacity;
+} ChunkStats;
+
+static double nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long peakRssKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Returns 0 if there was no memory for the sample.
+static int addSample(ChunkStats* s, double micros) {
+    if (s->count >= s->capacity) {
+        int cap = s->capacity ? s->capacity * 2 : 1024;
+        double* grown = realloc(s->samples, cap * sizeof(double));
+        if (!grown) return 0;
+        s->samples = grown;
+        s->capacity = cap;
+    }
+    s->samples[s->count++] = micros;
+    return 1;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int count, int p) {
+    return sorted[(count - 1) * p / 100];
+}
+
+static char* readWholeFile(const char* path, size_t* outLength) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    char* text = malloc((size_t)size + 1);
+    if (!text) {
+        fclose(f);
+        return NULL;
+    }
+
+    *outLength = fread(text, 1, (size_t)size, f);
+    text[*outLength] = '\0';
+    fclose(f);
+    return text;
+}
+
+static void usage(const char* name) {
+    printf("usage: %s [-c chunk-bytes] [-w wrap-width] [-r repeat] <capture>...\n", name);
+}
+
+// Replays one capture, each chunk as if it were one read from the shell, and prints a row
+// of results. Returns 0 if the capture could not be read.
+static int runCapture(const char* path, size_t chunk, float width, int repeat) {
+    size_t length = 0;
+    char* data = readWholeFile(path, &length);
+    if (!data) {
+        printf("Could not read %s\n", path);
+        return 0;
+    }
+
+    // Without chunks there are no latencies to take percentiles of.
+    if (length == 0) {
+        printf("Skipping %s, it is empty\n", path);
+        free(data);
+        return 1;
+    }
+
+    size_t newlines = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == '\n') newlines++;
+    }
+
+    float advance[96];
+    for (int i = 0; i < 96; i++) advance[i] = GLYPH_ADVANCE;
+
+    ChunkStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    double feedMicros = 0.0;
+    double rewrapMicros = 0.0;
+    size_t termBytes = 0;
+
+    for (int r = 0; r < repeat; r++) {
+        Terminal t;
+        if (!termInit(&t, TERM_ROWS, TERM_COLS, SCROLLBACK_LINES, SCROLLBACK_BYTES)) {
+            printf("Not enough memory for the terminal\n");
+            free(stats.samples);
+            free(data);
+            return 0;
+        }
+        termSetWidth(&t, width, advance);
+
+        for (size_t pos = 0; pos < length; pos += chunk) {
+            size_t n = length - pos < chunk ? length - pos : chunk;
+
+            double start = nowMicros();
+            termWrite(&t, data + pos, n);
+            double elapsed = nowMicros() - start;
+
+            feedMicros += elapsed;
+            if (!addSample(&stats, elapsed)) {
+                printf("Not enough memory for the chunk timings\n");
+                termFree(&t);
+                free(stats.samples);
+                free(data);
+                return 0;
+            }
+        }
+
+        // A resize re-wraps the whole scrollback, a slice per frame as the panel does.
+        double start = nowMicros();
+        termSetWidth(&t, width / 2, advance);
+        while (t.rewrapPending) termRewrapStep(&t, 256);
+        rewrapMicros += nowMicros() - start;
+
+        termBytes = termMemoryBytes(&t);
+        termFree(&t);
+    }
+
+    double seconds = feedMicros / 1e6;
+    qsort(stats.samples, stats.count, sizeof(double), compareDouble);
+
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    printf("%-20s %8.1f %8.2f %10.0f %8.2f %8.2f %8.2f %9.2f %9.1f\n", name,
+           length / 1024.0, length * (double)repeat / (1024.0 * 1024.0) / seconds, newlines * (double)repeat / seconds,
+           percentile(stats.samples, stats.count, 50), percentile(stats.samples, stats.count, 99),
+           stats.samples[stats.count - 1], rewrapMicros / repeat / 1000.0, termBytes / (1024.0 * 1024.0));
+
+    free(stats.samples);
+    free(data);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    size_t chunk = 4096;
+    float width = 1000.0f;
+    int repeat = 5;
+
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "-c") == 0) chunk = (size_t)atol(argv[arg + 1]);
+        else if (strcmp(argv[arg], "-w") == 0) width = (float)atof(argv[arg + 1]);
+        else if (strcmp(argv[arg], "-r") == 0) repeat = atoi(argv[arg + 1]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (arg >= argc || chunk == 0 || width <= 0 || repeat < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("screen %dx%d, %zu-byte chunks, wrap width %.0f px, %d run%s\n\n", TERM_COLS, TERM_ROWS, chunk, width,
+           repeat, repeat == 1 ? "" : "s");
+    printf("%-20s %8s %8s %10s %8s %8s %8s %9s %9s\n", "capture", "KB", "MB/s", "lines/s",
+           "p50 us", "p99 us", "max us", "rewrap ms", "term MB");
+
+    int failed = 0;
+    for (; arg < argc; arg++) {
+        if (!runCapture(argv[arg], chunk, width, repeat)) failed = 1;
+    }
+
+    printf("\npeak RSS: %.1f MB\n", peakRssKB() / 1024.0);
+    return failed;
+}
\ No newline at end of file
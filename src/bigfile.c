@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bigfile.h"
+#include "thread.h"
+
+#define BIGFILE_SCAN_CHUNK (16 * 1024 * 1024)
+
+struct BigFile {
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    Thread thread;
+    Mutex lock;
+    void (*notify)(void);
+
+    // checkpoints[k] is the byte offset of line k * BIGFILE_CHECKPOINT_LINES. Only the
+    // worker appends; the array may be reallocated, so readers take the lock.
+    size_t* checkpoints;
+    size_t checkpointCount;
+    size_t checkpointCapacity;
+    size_t newlines;
+    int indexing;
+    int done;
+    int cancelled;
+
+    // Main thread only: the last line found, so drawing consecutive lines scans each once.
+    int cursorLine;
+    size_t cursorOffset;
+};
+
+long long bigFileSize(const char* path) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info)) return -1;
+    return ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return (long long)st.st_size;
+#endif
+}
+
+static int mapFile(BigFile* b, const char* path) {
+#ifdef _WIN32
+    b->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (b->file == INVALID_HANDLE_VALUE) return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(b->file, &size)) return 0;
+    b->size = (size_t)size.QuadPart;
+    if (b->size == 0) return 1;
+
+    b->mapping = CreateFileMappingA(b->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!b->mapping) return 0;
+
+    b->data = MapViewOfFile(b->mapping, FILE_MAP_READ, 0, 0, 0);
+    return b->data != NULL;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    b->size = (size_t)st.st_size;
+    if (b->size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void* data = mmap(NULL, b->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+
+    madvise(data, b->size, MADV_SEQUENTIAL);
+    b->data = data;
+    return 1;
+#endif
+}
+
+static void unmapFile(BigFile* b) {
+#ifdef _WIN32
+    if (b->data) UnmapViewOfFile(b->data);
+    if (b->mapping) CloseHandle(b->mapping);
+    if (b->file && b->file != INVALID_HANDLE_VALUE) CloseHandle(b->file);
+#else
+    if (b->data) munmap((void*)b->data, b->size);
+#endif
+}
+
+static int addCheckpoint(BigFile* b, size_t index, size_t offset) {
+    if (index >= b->checkpointCapacity) {
+        size_t cap = b->checkpointCapacity ? b->checkpointCapacity * 2 : 1024;
+        mutexLock(&b->lock);
+        size_t* grown = realloc(b->checkpoints, cap * sizeof(size_t));
+        if (grown) {
+            b->checkpoints = grown;
+            b->checkpointCapacity = cap;
+        }
+        mutexUnlock(&b->lock);
+        if (!grown) return 0;
+    }
+
+    // Readers only reach this slot after the line count covering it is published.
+    b->checkpoints[index] = offset;
+    return 1;
+}
+
+static void bigFileIndexMain(void* arg) {
+    BigFile* b = arg;
+
+    size_t newlines = 0;
+    size_t checkpoints = 1;
+    size_t pos = 0;
+
+    while (pos < b->size) {
+        mutexLock(&b->lock);
+        int cancelled = b->cancelled;
+        mutexUnlock(&b->lock);
+        if (cancelled) break;
+
+        size_t end = pos + BIGFILE_SCAN_CHUNK;
+        if (end > b->size) end = b->size;
+
+        const char* p = b->data + pos;
+        const char* stop = b->data + end;
+        int failed = 0;
+        while (p < stop && (p = memchr(p, '\n', stop - p)) != NULL) {
+            p++;
+            newlines++;
+            if (newlines % BIGFILE_CHECKPOINT_LINES == 0) {
+                if (!addCheckpoint(b, checkpoints, p - b->data)) {
+                    // Stop short of the line that has no checkpoint.
+                    newlines--;
+                    failed = 1;
+                    break;
+                }
+                checkpoints++;
+            }
+        }
+
+#ifndef _WIN32
+        // Scanned pages are clean and file-backed; dropping them keeps the resident set to
+        // what is on screen. Windows trims the working set of a mapped view on its own.
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t dropFrom = pos / page * page;
+        size_t dropTo = end / page * page;
+        if (dropTo > dropFrom) madvise((char*)b->data + dropFrom, dropTo - dropFrom, MADV_DONTNEED);
+#endif
+
+        mutexLock(&b->lock);
+        b->checkpointCount = checkpoints;
+        b->newlines = newlines;
+        mutexUnlock(&b->lock);
+        if (b->notify) b->notify();
+
+        if (failed) {
+            printf("bigFile: not enough memory for the line index\n");
+            break;
+        }
+        pos = end;
+    }
+
+    mutexLock(&b->lock);
+    b->done = 1;
+    mutexUnlock(&b->lock);
+    if (b->notify) b->notify();
+}
+
+BigFile* bigFileOpen(const char* path, void (*notify)(void)) {
+    BigFile* b = calloc(1, sizeof(BigFile));
+    if (!b) return NULL;
+
+    b->notify = notify;
+    b->cursorLine = -1;
+    mutexInit(&b->lock);
+
+    b->checkpoints = malloc(1024 * sizeof(size_t));
+    if (!b->checkpoints || !mapFile(b, path)) {
+        printf("bigFileOpen: could not map %s\n", path);
+        bigFileClose(b);
+        return NULL;
+    }
+    b->checkpointCapacity = 1024;
+    b->checkpoints[0] = 0;
+    b->checkpointCount = 1;
+
+    if (!threadStart(&b->thread, bigFileIndexMain, b)) {
+        bigFileClose(b);
+        return NULL;
+    }
+    b->indexing = 1;
+    return b;
+}
+
+// Lines whose end has been found so far; once indexing is done this includes the last line.
+int bigFileLineCount(BigFile* b) {
+    mutexLock(&b->lock);
+    size_t count = b->done ? b->newlines + 1 : b->newlines;
+    mutexUnlock(&b->lock);
+    return count > 0x7fffffff ? 0x7fffffff : (int)count;
+}
+
+// Returns a pointer into the mapping, without the line break; the line is not NUL-terminated.
+const char* bigFileLine(BigFile* b, int line, int* outLength) {
+    *outLength = 0;
+    if (!b->data || line < 0 || line >= bigFileLineCount(b)) return "";
+
+    int from;
+    size_t offset;
+    int checkpointLine = line / BIGFILE_CHECKPOINT_LINES * BIGFILE_CHECKPOINT_LINES;
+    if (b->cursorLine >= checkpointLine && b->cursorLine <= line) {
+        from = b->cursorLine;
+        offset = b->cursorOffset;
+    } else {
+        mutexLock(&b->lock);
+        offset = b->checkpoints[line / BIGFILE_CHECKPOINT_LINES];
+        mutexUnlock(&b->lock);
+        from = checkpointLine;
+    }
+
+    const char* end = b->data + b->size;
+    for (; from < line; from++) {
+        const char* nl = memchr(b->data + offset, '\n', b->size - offset);
+        offset = nl + 1 - b->data;
+    }
+    b->cursorLine = line;
+    b->cursorOffset = offset;
+
+    const char* text = b->data + offset;
+    const char* nl = offset < b->size ? memchr(text, '\n', end - text) : NULL;
+    size_t length = (nl ? nl : end) - text;
+    if (length > 0 && text[length - 1] == '\r') length--;
+
+    *outLength = length > 0x7fffffff ? 0x7fffffff : (int)length;
+    return text;
+}
+
+int bigFileIndexed(BigFile* b) {
+    mutexLock(&b->lock);
+    int done = b->done;
+    mutexUnlock(&b->lock);
+    return done;
+}
+
+void bigFileClose(BigFile* b) {
+    if (!b) return;
+
+    if (b->indexing) {
+        mutexLock(&b->lock);
+        b->cancelled = 1;
+        mutexUnlock(&b->lock);
+        threadJoin(&b->thread);
+    }
+
+    unmapFile(b);
+    mutexDestroy(&b->lock);
+    free(b->checkpoints);
+    free(b);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef BIGFILE_H
+#define BIGFILE_H
+
+// Read-only view of a file too large to load into a Document. The file is memory-mapped and
+// a worker thread records the offset of every BIGFILE_CHECKPOINT_LINES-th line, so the index
+// stays small and any line is found by scanning forward from the nearest checkpoint.
+#define BIGFILE_CHECKPOINT_LINES 256
+
+typedef struct BigFile BigFile;
+
+long long bigFileSize(const char* path);
+BigFile* bigFileOpen(const char* path, void (*notify)(void));
+int bigFileLineCount(BigFile* b);
+const char* bigFileLine(BigFile* b, int line, int* outLength);
+int bigFileIndexed(BigFile* b);
+void bigFileClose(BigFile* b);
+
+#endif
\ No newline at end of file
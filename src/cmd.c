@@ -1,5 +1,3 @@
-#define _WIN32_WINNT 0x0A00
-#include <windows.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -10,144 +8,98 @@
 #include "explorer.h"
 #include "editor.h"
 #include "cmd.h"
-
-#define PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE 0x00020016
-typedef HANDLE HPCON;
-typedef HRESULT (WINAPI *CreatePseudoConsole_t)(COORD, HANDLE, HANDLE, DWORD, HPCON*);
-typedef VOID (WINAPI *ClosePseudoConsole_t)(HPCON);
-
-static CreatePseudoConsole_t pCreatePseudoConsole = NULL;
-static ClosePseudoConsole_t  pClosePseudoConsole  = NULL;
+#include "shellpty.h"
+#include "term.h"
 
 #define CMD_MAX_LINES 256
 #define CMD_LINE_HEIGHT 32
 #define CMD_VIEW_HEIGHT 250.0f
-#define CMD_MAX_RAW_LINES 2048
-#define CMD_MAX_RENDER_LINES 8192
-#define CMD_LINE_LEN 1024
-
-static HPCON  hPC = NULL;
-static HANDLE hPtyIn = NULL;
-static HANDLE hPtyOut = NULL;
-static PROCESS_INFORMATION cmdProc = {0};
-static STARTUPINFOEXA si = {0};
-static int cmdAccumLen = 0;
+#define CMD_SCROLLBACK_LINES 10000
+#define CMD_SCROLLBACK_MB 16
+#define CMD_TERM_ROWS 30
+#define CMD_TERM_COLS 120
+#define CMD_READ_CHUNK (64 * 1024)
+#define CMD_POLL_BUDGET (1024 * 1024)
+#define CMD_REWRAP_LINES_PER_FRAME 256
+
 static int cmdRunning = 0;
-static int cmdRawCount = 0;
-static int cmdRenderCount = 0;
-static int cmdScreenWidth = 0;
-static int cmdExplorerW = 0;
-static int cmdLayoutDirty = 0;
 static int cmdStartTried = 0;
-static char cmdAccum[16384];
-static char *cmdRawLines[CMD_MAX_RAW_LINES];
-static char *cmdRenderLines[CMD_MAX_RENDER_LINES];
-static float cmdScroll = 0.0f;
-
-extern int mode;
 
-static float getTextWidthRange2(const stbtt_bakedchar *cdata, const char *text, int start, int count, float scale) {
-    char tmp[CMD_LINE_LEN];
-    if (count <= 0) return 0.0f;
-    if (count >= CMD_LINE_LEN) count = CMD_LINE_LEN - 1;
+// Shell output, its scrollback and the wrapped rows of both live in cmdTerm; this file
+// only feeds it and draws it.
+static Terminal cmdTerm;
+static int cmdTermReady = 0;
+static int cmdScrollbackLines = CMD_SCROLLBACK_LINES;
+static int cmdScrollbackMB = CMD_SCROLLBACK_MB;
+static float cmdScroll = 0.0f;
 
-    memcpy(tmp, text + start, count);
-    tmp[count] = 0;
+// Raw shell output is also written here when MCODE_RECORD_PTY is set, for mcode-termbench.
+static FILE *cmdCapture = NULL;
 
-    return getTextWidth((stbtt_bakedchar*)cdata, tmp, scale);
-}
+extern int mode;
 
 static float cmdMaxScroll() {
-    float h = (cmdRenderCount + 1) * CMD_LINE_HEIGHT;
+    float h = (termRowCount(&cmdTerm) + 1) * CMD_LINE_HEIGHT;
     float max = h - CMD_VIEW_HEIGHT;
     return max > 0 ? max : 0;
 }
 
-void cmdPushRawLine(const char *s) {
-    if (!s || !*s) return;
-
-    if (cmdRawCount >= CMD_MAX_RAW_LINES) {
-        free(cmdRawLines[0]);
-        memmove(cmdRawLines, cmdRawLines + 1, sizeof(char*) * (CMD_MAX_RAW_LINES - 1));
-        cmdRawCount--;
-    }
-
-    cmdRawLines[cmdRawCount++] = _strdup(s);
+// Sets the scrollback limits. Takes effect when the terminal is created, at startup.
+void cmdSetScrollback(int lines, int megabytes) {
+    if (lines > 0) cmdScrollbackLines = lines;
+    if (megabytes > 0) cmdScrollbackMB = megabytes;
 }
 
-static void deleteAnsi(char *s) {
-    char out[CMD_LINE_LEN * 8];
-    char *d = out;
-    size_t remaining = sizeof(out);
-
-    const char *p = s;
-
-    while (*p && remaining > 1) {
-        if (*p == '\x1b' && p[1] == '[') {
-            p += 2;
-            while (*p && !((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))) p++;
-            if (*p) p++;
-            continue;
-        }
-
-        *d++ = *p++;
-        remaining--;
-    }
+// Wraps up to maxLines more lines of a pending re-wrap, keeping the view where it was
+// relative to the bottom.
+static void cmdRewrapStep(int maxLines) {
+    float fromBottom = cmdMaxScroll() - cmdScroll;
 
-    *d = 0;
+    termRewrapStep(&cmdTerm, maxLines);
 
-    strncpy(s, out, CMD_LINE_LEN - 1);
-    s[CMD_LINE_LEN - 1] = 0;
+    cmdScroll = cmdMaxScroll() - fromBottom;
+    if (cmdScroll < 0) cmdScroll = 0;
 }
 
-void cmdRebuildRenderLines(stbtt_bakedchar *cdata, float maxWidth, float scale) {
-    if (!cdata || maxWidth <= 0) return;
-    for (int i = 0; i < cmdRenderCount; i++) free(cmdRenderLines[i]);
-
-    cmdRenderCount = 0;
-
-    for (int i = 0; i < cmdRawCount; i++) {
-        char work[CMD_LINE_LEN * 2];
-        strncpy(work, cmdRawLines[i], sizeof(work) - 1);
-        work[sizeof(work) - 1] = 0;
-
-        deleteAnsi(work);
-
-        const char *p = work;
-        int len = (int)strlen(work);
-        int start = 0;
+// Answers queries from the shell, such as a cursor position report.
+static void cmdReply(void *user, const char *text, int length) {
+    shellWrite(text, length);
+}
 
-        while (start < len) {
-            int rawCount = 0;
-            float w = 0.0f;
+static void cmdPushRawLine(const char *s) {
+    if (!s || !*s || !cmdTermReady) return;
 
-            while (start + rawCount < len) {
-                float next = getTextWidthRange2(cdata, p + start, 0, rawCount + 1, scale);
-                if (next > maxWidth && rawCount > 0) break;
-                rawCount++;
-                w = next;
-            }
+    termWrite(&cmdTerm, s, strlen(s));
+    termWrite(&cmdTerm, "\r\n", 2);
+}
 
-            if (rawCount <= 0) rawCount = 1;
+// Characters past ASCII are drawn from the glyph atlas, so they are wrapped at its advance.
+static float cmdWideAdvance(unsigned int codepoint, void* user) {
+    return atlasAdvance(&fontAtlas, codepoint) * *(float*)user;
+}
 
-            char *out = (char*)malloc(rawCount + 1);
-            memcpy(out, p + start, rawCount);
-            out[rawCount] = 0;
+// Starts re-wrapping the whole terminal for a new width. The newest rows are built
+// right away and older ones over the following frames.
+void cmdRebuildRenderLines(stbtt_bakedchar *cdata, float maxWidth, float scale) {
+    static float wideScale = 1.0f;
+    if (!cdata || maxWidth <= 0 || !cmdTermReady) return;
 
-            if (cmdRenderCount < CMD_MAX_RENDER_LINES)
-                cmdRenderLines[cmdRenderCount++] = out;
-            else
-                free(out);
+    float advance[96];
+    for (int i = 0; i < 96; i++) advance[i] = cdata[i].xadvance * scale;
 
-            start += rawCount;
-        }
-    }
+    wideScale = scale;
+    termSetWideAdvance(&cmdTerm, cmdWideAdvance, &wideScale);
+    termSetWidth(&cmdTerm, maxWidth, advance);
+    cmdScroll = 0.0f;
+    cmdRewrapStep((int)(CMD_VIEW_HEIGHT / CMD_LINE_HEIGHT) + 2);
 }
 
 static void ptyWrite(const char *s) {
-    if (!hPtyIn) return;
-    DWORD w;
-    WriteFile(hPtyIn, s, (DWORD)strlen(s), &w, NULL);
+    shellWrite(s, strlen(s));
+}
+
+static void wakeMainLoop() {
+    glfwPostEmptyEvent();
 }
 
 void cmdCharInput(unsigned int codepoint) {
@@ -177,65 +129,27 @@ void cmdKeyDown(int key) {
 void cmdStart(const char *homePath) {
     if (cmdStartTried) return;
     cmdStartTried = 1;
-    HMODULE k32 = GetModuleHandleA("kernel32.dll");
-    pCreatePseudoConsole = (CreatePseudoConsole_t)GetProcAddress(k32, "CreatePseudoConsole");
-    pClosePseudoConsole = (ClosePseudoConsole_t)GetProcAddress(k32, "ClosePseudoConsole");
 
-    if (!pCreatePseudoConsole) {
-        cmdPushRawLine("ConPTY not supported");
+    if (!termInit(&cmdTerm, CMD_TERM_ROWS, CMD_TERM_COLS, cmdScrollbackLines, (size_t)cmdScrollbackMB * 1024 * 1024)) {
+        printf("cmd: not enough memory for the terminal screen\n");
         return;
     }
+    cmdTerm.screen.reply = cmdReply;
+    cmdTermReady = 1;
 
-    HANDLE inR, inW, outR, outW;
-    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
-
-    CreatePipe(&inR, &inW, &sa, 0);
-    CreatePipe(&outR, &outW, &sa, 0);
-
-    COORD size = { 120, 30 };
-    pCreatePseudoConsole(size, inR, outW, 0, &hPC);
-
-    CloseHandle(inR);
-    CloseHandle(outW);
-
-    hPtyIn  = inW;
-    hPtyOut = outR;
-
-    si.StartupInfo.cb = sizeof(si);
-
-    SIZE_T attrSize = 0;
-    InitializeProcThreadAttributeList(NULL, 1, 0, &attrSize);
-    si.lpAttributeList = malloc(attrSize);
-    InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &attrSize);
-
-    UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE, hPC, sizeof(hPC), NULL, NULL);
-
-    char cmdLine[] = "powershell.exe";
-    if (!CreateProcessA(NULL, cmdLine, NULL, NULL, FALSE, EXTENDED_STARTUPINFO_PRESENT, NULL, homePath, &si.StartupInfo, &cmdProc)) {
-        cmdPushRawLine("Failed to start cmd.exe");
-        if (si.lpAttributeList) {
-        	DeleteProcThreadAttributeList(si.lpAttributeList);
-        	free(si.lpAttributeList);
-        	si.lpAttributeList = NULL;
-    	}
-
-    	if (pClosePseudoConsole && hPC) {
-    	    pClosePseudoConsole(hPC);
-    	    hPC = NULL;
-    	}
-
-    	CloseHandle(hPtyIn);
-    	CloseHandle(hPtyOut);
+    const char* capturePath = getenv("MCODE_RECORD_PTY");
+    if (capturePath) {
+        cmdCapture = fopen(capturePath, "wb");
+        if (!cmdCapture) printf("cmd: could not open %s for recording\n", capturePath);
+    }
 
-    	return;
+    const char* error = NULL;
+    if (!shellStart(homePath, CMD_TERM_COLS, CMD_TERM_ROWS, wakeMainLoop, &error)) {
+        cmdPushRawLine(error);
+        return;
     }
 
     cmdRunning = 1;
-    cmdLayoutDirty = 1;
-
-	ptyWrite("Remove-Module PSReadLine\r");
-	ptyWrite("$env:TERM='dumb'\r");
-	ptyWrite("function prompt { 'PS ' + (Get-Location) + '> ' }\r");
 }
 
 void cmdScrollWheel(float delta) {
@@ -270,157 +184,169 @@ static void drawCMDBorder(int w, int h, float color[4]) {
 
 void cmdShutdown() {
     if (cmdRunning) {
-        TerminateProcess(cmdProc.hProcess, 0);
-        CloseHandle(cmdProc.hProcess);
-        CloseHandle(cmdProc.hThread);
-        CloseHandle(hPtyIn);
-        CloseHandle(hPtyOut);
-        pClosePseudoConsole(hPC);
+        shellStop();
         cmdRunning = 0;
     }
 
-	for (int i = 0; i < CMD_MAX_RAW_LINES; i++) {
-        if (cmdRawLines[i]) {
-            free(cmdRawLines[i]);
-            cmdRawLines[i] = NULL;
-        }
+    if (cmdTermReady) {
+        termFree(&cmdTerm);
+        cmdTermReady = 0;
     }
 
-    for (int i = 0; i < CMD_MAX_RENDER_LINES; i++) {
-        if (cmdRenderLines[i]) {
-            free(cmdRenderLines[i]);
-            cmdRenderLines[i] = NULL;
-        }
+    if (cmdCapture) {
+        fclose(cmdCapture);
+        cmdCapture = NULL;
     }
+}
 
-    cmdRawCount = 0;
-    cmdRenderCount = 0;
-
-	if (si.lpAttributeList) {
-        DeleteProcThreadAttributeList(si.lpAttributeList);
-        free(si.lpAttributeList);
-        si.lpAttributeList = NULL;
+// Drains output the reader thread has queued since the last call, up to CMD_POLL_BUDGET
+// bytes so a flood of output cannot stall a frame, and feeds it straight to the terminal.
+// Returns 1 if any output arrived.
+int cmdPoll() {
+    if (!cmdRunning) return 0;
+
+    static char chunk[CMD_READ_CHUNK];
+    int received = 0;
+    size_t budget = CMD_POLL_BUDGET;
+
+    while (budget > 0) {
+        size_t want = sizeof(chunk) < budget ? sizeof(chunk) : budget;
+        size_t r = shellRead(chunk, want);
+        if (r == 0) break;
+
+        if (cmdCapture) fwrite(chunk, 1, r, cmdCapture);
+        termWrite(&cmdTerm, chunk, r);
+        budget -= r;
+        received = 1;
     }
-}
 
-void drawCMD(int screenWidth, int screenHeight, float bg[4], float border[4], int keyPressed) {
-    cmdScreenWidth = screenWidth;
-    cmdExplorerW = (int)(screenWidth * EXPLORER_RATIO);
-    if (!cmdRunning) {
-        cmdStart(NULL);
-        if (!cmdRunning) return;
+    if (received) {
+        cmdScroll = cmdMaxScroll();
+        drawMarkDirty(DIRTY_CMD);
     }
 
-    if (cmdLayoutDirty) {
-        int explorerW = (int)(screenWidth * EXPLORER_RATIO);
-        cmdRebuildRenderLines(cdata, (float)(screenWidth - explorerW - 20), 1.0f);
+    // Output left over, or that arrived while draining, is picked up on the next iteration.
+    if (shellPending()) drawMarkDirty(DIRTY_CMD);
+    return received;
+}
 
-        cmdScroll = cmdMaxScroll();
-        cmdLayoutDirty = 0;
+// Builds the palette the cells are drawn with: the 16 ANSI colors, then the panel's own
+// text color for VT_DEFAULT_COLOR.
+static const float (*cmdPalette())[4] {
+    static float palette[2][VT_DEFAULT_COLOR + 1][4];
+    static int built = 0;
+
+    if (!built) {
+        for (int m = 0; m < 2; m++) {
+            for (int i = 0; i < 16; i++) {
+                palette[m][i][0] = vtPaletteRGB[i][0] / 255.0f;
+                palette[m][i][1] = vtPaletteRGB[i][1] / 255.0f;
+                palette[m][i][2] = vtPaletteRGB[i][2] / 255.0f;
+                palette[m][i][3] = 1.0f;
+            }
+            palette[m][VT_DEFAULT_COLOR][0] = palette[m][VT_DEFAULT_COLOR][1] = palette[m][VT_DEFAULT_COLOR][2] = (float)m;
+            palette[m][VT_DEFAULT_COLOR][3] = 1.0f;
+        }
+        built = 1;
     }
 
-    DWORD avail;
-    while (PeekNamedPipe(hPtyOut, NULL, 0, NULL, &avail, NULL) && avail > 0) {
-        char buf[512];
-        DWORD r = 0;
-
-        if (!ReadFile(hPtyOut, buf, sizeof(buf), &r, NULL) || r == 0) break;
-        if (cmdAccumLen + r >= (int)sizeof(cmdAccum) - 1) cmdAccumLen = 0;
-
-        memcpy(cmdAccum + cmdAccumLen, buf, r);
-		cmdAccumLen += r;
-		cmdAccum[cmdAccumLen] = 0;
-
-        char *lineStart = cmdAccum;
-        char *nl;
-
-        int pushed = 0;
-
-        for (;;) {
-            char *cr = memchr(cmdAccum, '\r', cmdAccumLen);
-            char *lf = memchr(cmdAccum, '\n', cmdAccumLen);
-
-            char *nl = NULL;
-            int nlLen = 0;
-
-            if (cr && lf) {
-                if (cr < lf) {
-                    nl = cr;
-                    nlLen = (cr + 1 < cmdAccum + cmdAccumLen && cr[1] == '\n') ? 2 : 1;
-                } else {
-                    nl = lf;
-                    nlLen = (lf + 1 < cmdAccum + cmdAccumLen && lf[1] == '\r') ? 2 : 1;
-                }
-            } else if (cr) {
-                nl = cr;
-                nlLen = (cr + 1 < cmdAccum + cmdAccumLen && cr[1] == '\n') ? 2 : 1;
-            } else if (lf) {
-                nl = lf;
-                nlLen = (lf + 1 < cmdAccum + cmdAccumLen && lf[1] == '\r') ? 2 : 1;
+    return palette[!(mode == 0 || mode == 1)];
+}
+
+// Draws one wrapped row: cell backgrounds first, then the text in runs of one color.
+static void cmdDrawRow(const VtCell *cells, int length, float x, float y, int screenWidth, int screenHeight) {
+    const float (*palette)[4] = cmdPalette();
+    char text[CMD_TERM_COLS * 3];
+    HighlightSpan spans[CMD_TERM_COLS];
+    int spanCount = 0;
+    int textLength = 0;
+    float cellX = x;
+
+    // Cells are turned back into UTF-8 so characters outside ASCII come from the atlas.
+    for (int i = 0; i < length; i++) {
+        unsigned int ch = cells[i].ch;
+        int start = textLength;
+        float advance;
+
+        if (ch < 128) {
+            text[textLength++] = termGlyph(&cells[i]);
+            advance = cdata[text[start] - 32].xadvance;
+        } else {
+            if (ch < 0x800) {
+                text[textLength++] = (char)(0xC0 | (ch >> 6));
             } else {
-                break;
+                text[textLength++] = (char)(0xE0 | (ch >> 12));
+                text[textLength++] = (char)(0x80 | ((ch >> 6) & 0x3F));
             }
+            text[textLength++] = (char)(0x80 | (ch & 0x3F));
+            advance = atlasAdvance(&fontAtlas, ch);
+        }
 
-            int lineLen = (int)(nl - cmdAccum);
+        if (cells[i].bg != VT_DEFAULT_COLOR) {
+            drawSelectionRect(cellX, y - CMD_LINE_HEIGHT + 8.0f, cellX + advance, y + 8.0f, (float *)palette[cells[i].bg]);
+        }
+        cellX += advance;
+
+        if (spanCount > 0 && spans[spanCount - 1].palette == cells[i].fg) {
+            spans[spanCount - 1].length += textLength - start;
+        } else {
+            spans[spanCount].start = start;
+            spans[spanCount].length = textLength - start;
+            spans[spanCount].palette = cells[i].fg;
+            spanCount++;
+        }
+    }
 
-            if (lineLen > 0) {
-                char tmp[CMD_LINE_LEN];
-                if (lineLen >= CMD_LINE_LEN) lineLen = CMD_LINE_LEN - 1;
-                memcpy(tmp, cmdAccum, lineLen);
-                tmp[lineLen] = 0;
+    renderHighlightedText(fontTexture, cdata, text, spans, spanCount, palette, x, y, screenWidth, screenHeight, 1.0f);
+}
 
-                cmdPushRawLine(tmp);
-                pushed = 1;
-            }
+void drawCMD(int screenWidth, int screenHeight, float bg[4], float border[4], int keyPressed) {
+    if (!cmdRunning) {
+        cmdStart(NULL);
+        if (!cmdRunning) return;
+    }
 
-            int consumed = lineLen + nlLen;
-            memmove(cmdAccum, cmdAccum + consumed, cmdAccumLen - consumed);
-            cmdAccumLen -= consumed;
-        }
+    float wrapWidth = (float)(screenWidth - (int)(screenWidth * EXPLORER_RATIO) - 20);
+    if (wrapWidth != cmdTerm.wrapWidth) {
+        cmdRebuildRenderLines(cdata, wrapWidth, 1.0f);
+        cmdScroll = cmdMaxScroll();
+    }
 
-        if (pushed) {
-            int explorerW = (int)(screenWidth * EXPLORER_RATIO);
-            cmdRebuildRenderLines(cdata, (float)(screenWidth - explorerW - 20), 1.0f);
-            cmdScroll = cmdMaxScroll();
-            pushed = 0;
-        }
+    if (cmdTerm.rewrapPending) {
+        cmdRewrapStep(CMD_REWRAP_LINES_PER_FRAME);
+        if (cmdTerm.rewrapPending) drawMarkDirty(DIRTY_CMD);
     }
 
 	drawCMDBorder(screenWidth, screenHeight, border);
     drawCMDBase(screenWidth, screenHeight, bg);
 
-    glEnable(GL_SCISSOR_TEST);
-
     int explorerW = (int)(screenWidth * EXPLORER_RATIO);
     int scissorX = explorerW;
     int scissorY = 0;
     int scissorW = screenWidth - explorerW;
     int scissorH = (int)CMD_VIEW_HEIGHT;
 
-    if (scissorW <= 0 || scissorH <= 0) {
-        glDisable(GL_SCISSOR_TEST);
-        return;
-    }
+    if (scissorW <= 0 || scissorH <= 0) return;
 
-    glScissor(scissorX, scissorY, scissorW, scissorH);
+    drawSetScissor(scissorX, scissorY, scissorW, scissorH);
 
-    float contentTop = screenHeight - CMD_VIEW_HEIGHT;
-    float bufferBottom = contentTop + (cmdRenderCount + 1) * CMD_LINE_HEIGHT;
-    float y = bufferBottom - cmdScroll;
     float x = explorerW;
 
+    // History rows come first, then the rows of the live screen.
+    int totalLines = termRowCount(&cmdTerm);
     int firstLine = (int)(cmdScroll / CMD_LINE_HEIGHT);
     int visibleLines = (int)(CMD_VIEW_HEIGHT / CMD_LINE_HEIGHT) + 2;
     int lastLine = firstLine + visibleLines;
 
-    if (lastLine > cmdRenderCount) lastLine = cmdRenderCount;
+    if (lastLine > totalLines) lastLine = totalLines;
 
     float drawY = screenHeight - CMD_VIEW_HEIGHT - fmodf(cmdScroll, CMD_LINE_HEIGHT);
 
     for (int i = firstLine; i < lastLine; i++) {
-        if (mode == 0 || mode == 1) renderText(fontTexture, cdata, cmdRenderLines[i], x, drawY, screenWidth, screenHeight, 1.0f, 0,0,0,1);
-		else renderText(fontTexture, cdata, cmdRenderLines[i], x, drawY, screenWidth, screenHeight, 1.0f, 1,1,1,1);
+        int length;
+        const VtCell *cells = termRow(&cmdTerm, i, &length);
+        cmdDrawRow(cells, length, x, drawY, screenWidth, screenHeight);
         drawY += CMD_LINE_HEIGHT;
     }
-    glDisable(GL_SCISSOR_TEST);
+    drawClearScissor();
 }
\ No newline at end of file
@@ -6,8 +6,10 @@
 void drawCMD(int screenWidth, int screenHeight, float color[4], float borderlineColor[4], int keyPressed);
 void cmdRebuildRenderLines(stbtt_bakedchar *cdata, float maxWidth, float scale);
 void cmdStart(const char* homePath);
+void cmdSetScrollback(int lines, int megabytes);
 void cmdCharInput(unsigned int codepoint);
 void cmdKeyDown(int key);
+int cmdPoll();
 void cmdScrollWheel(float delta);
 void cmdShutdown();
 
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <dirent/dirent.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_SEPARATOR "\\"
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#define PATH_SEPARATOR "/"
+#endif
+
+#include "dirmodel.h"
+
+void dirModelInit(DirModel* m) {
+    memset(m, 0, sizeof(*m));
+#ifndef _WIN32
+    m->watchFd = -1;
+#endif
+}
+
+static void stopWatching(DirModel* m) {
+#ifdef _WIN32
+    if (m->watch) FindCloseChangeNotification(m->watch);
+    m->watch = NULL;
+#else
+    if (m->watchFd >= 0) close(m->watchFd);
+    m->watchFd = -1;
+#endif
+}
+
+static void startWatching(DirModel* m) {
+#ifdef _WIN32
+    HANDLE h = FindFirstChangeNotificationA(m->path, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE);
+    m->watch = h == INVALID_HANDLE_VALUE ? NULL : h;
+#else
+    m->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m->watchFd < 0) return;
+
+    if (inotify_add_watch(m->watchFd, m->path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        close(m->watchFd);
+        m->watchFd = -1;
+    }
+#endif
+}
+
+void dirModelFree(DirModel* m) {
+    stopWatching(m);
+    free(m->path);
+    free(m->entries);
+    free(m->names);
+    dirModelInit(m);
+}
+
+static int compareEntries(const void* a, const void* b) {
+    const DirEntry* ea = a;
+    const DirEntry* eb = b;
+    if (ea->isDir != eb->isDir) return eb->isDir - ea->isDir;
+
+    const unsigned char* x = (const unsigned char*)ea->name;
+    const unsigned char* y = (const unsigned char*)eb->name;
+    while (*x && tolower(*x) == tolower(*y)) {
+        x++;
+        y++;
+    }
+    return tolower(*x) - tolower(*y);
+}
+
+static int appendEntry(DirModel* m, const char* name, int isDir, long long size) {
+    size_t nameLength = strlen(name) + 1;
+    if (m->namesLength + nameLength > m->namesCapacity) {
+        size_t cap = m->namesCapacity ? m->namesCapacity * 2 : 4096;
+        while (cap < m->namesLength + nameLength) cap *= 2;
+        char* grown = realloc(m->names, cap);
+        if (!grown) return 0;
+        m->names = grown;
+        m->namesCapacity = cap;
+    }
+
+    if (m->count >= m->capacity) {
+        int cap = m->capacity ? m->capacity * 2 : 64;
+        DirEntry* grown = realloc(m->entries, cap * sizeof(DirEntry));
+        if (!grown) return 0;
+        m->entries = grown;
+        m->capacity = cap;
+    }
+
+    // The pool may still move, so the offset is stored for now and resolved after the scan.
+    memcpy(m->names + m->namesLength, name, nameLength);
+    DirEntry* e = &m->entries[m->count++];
+    e->name = (const char*)(size_t)m->namesLength;
+    e->isDir = isDir;
+    e->size = size;
+    m->namesLength += nameLength;
+    return 1;
+}
+
+static int readListing(DirModel* m) {
+    m->count = 0;
+    m->namesLength = 0;
+    m->stale = 0;
+
+    DIR* d = opendir(m->path);
+    if (!d) return 0;
+
+    size_t pathLength = strlen(m->path);
+    char* fullPath = NULL;
+    size_t fullPathCapacity = 0;
+
+    struct dirent* dir;
+    while ((dir = readdir(d)) != NULL) {
+        const char* name = dir->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        size_t need = pathLength + strlen(name) + 2;
+        if (need > fullPathCapacity) {
+            char* grown = realloc(fullPath, need);
+            if (!grown) break;
+            fullPath = grown;
+            fullPathCapacity = need;
+        }
+        sprintf(fullPath, "%s" PATH_SEPARATOR "%s", m->path, name);
+
+        int isDir = 0;
+        long long size = 0;
+        struct stat st;
+        if (stat(fullPath, &st) == 0) {
+            isDir = S_ISDIR(st.st_mode);
+            size = isDir ? 0 : (long long)st.st_size;
+        }
+
+        if (!appendEntry(m, name, isDir, size)) {
+            printf("dirModel: not enough memory to list %s\n", m->path);
+            break;
+        }
+    }
+
+    free(fullPath);
+    closedir(d);
+
+    for (int i = 0; i < m->count; i++) m->entries[i].name = m->names + (size_t)m->entries[i].name;
+    qsort(m->entries, m->count, sizeof(DirEntry), compareEntries);
+    return 1;
+}
+
+// Lists path and starts watching it. Returns 0 if the directory cannot be read.
+int dirModelOpen(DirModel* m, const char* path) {
+    stopWatching(m);
+    free(m->path);
+    m->path = _strdup(path);
+    if (!m->path) return 0;
+
+    startWatching(m);
+    return readListing(m);
+}
+
+void dirModelRefresh(DirModel* m) {
+    m->stale = 1;
+}
+
+// Re-reads the listing if it changed on disk or a refresh was requested. Never blocks.
+// Returns 1 if the entries were reloaded.
+int dirModelPoll(DirModel* m) {
+    if (!m->path) return 0;
+
+#ifdef _WIN32
+    if (m->watch && WaitForSingleObject(m->watch, 0) == WAIT_OBJECT_0) {
+        FindNextChangeNotification(m->watch);
+        m->stale = 1;
+    }
+#else
+    if (m->watchFd >= 0) {
+        char events[4096];
+        while (read(m->watchFd, events, sizeof(events)) > 0) m->stale = 1;
+    }
+#endif
+
+    if (!m->stale) return 0;
+    readListing(m);
+    return 1;
+}
\ No newline at end of file
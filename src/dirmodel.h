@@ -0,0 +1,37 @@
+#ifndef DIRMODEL_H
+#define DIRMODEL_H
+
+#include <stddef.h>
+
+typedef struct {
+    const char* name;
+    long long size;
+    int isDir;
+} DirEntry;
+
+// Cached, sorted listing of one directory. Entries live in one array and their names in one
+// string pool. The listing is re-read only when the watcher (inotify on Linux, change
+// notifications on Windows) reports a change or dirModelRefresh is called.
+typedef struct {
+    char* path;
+    DirEntry* entries;
+    int count;
+    int capacity;
+    char* names;
+    size_t namesLength;
+    size_t namesCapacity;
+    int stale;
+#ifdef _WIN32
+    void* watch;
+#else
+    int watchFd;
+#endif
+} DirModel;
+
+void dirModelInit(DirModel* m);
+void dirModelFree(DirModel* m);
+int dirModelOpen(DirModel* m, const char* path);
+void dirModelRefresh(DirModel* m);
+int dirModelPoll(DirModel* m);
+
+#endif
\ No newline at end of file
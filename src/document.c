@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+
+#define PIECE_ORIGINAL 0
+#define PIECE_ADD 1
+
+typedef struct PieceNode {
+    struct PieceNode* left;
+    struct PieceNode* right;
+    unsigned int priority;
+    int buffer;
+    size_t start;
+    size_t length;
+    size_t lineFeeds;
+    size_t subLength;
+    size_t subLineFeeds;
+} PieceNode;
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    size_t* lineStarts; // offset just past every '\n' in data
+    size_t lineStartCount;
+    size_t lineStartCapacity;
+} PieceBuffer;
+
+struct Document {
+    PieceBuffer buffers[2];
+    PieceNode* root;
+    unsigned int seed;
+    unsigned int version;
+    char* scratch;
+    size_t scratchCapacity;
+    int crlf;
+};
+
+static unsigned int nextPriority(Document* doc) {
+    doc->seed ^= doc->seed << 13;
+    doc->seed ^= doc->seed >> 17;
+    doc->seed ^= doc->seed << 5;
+    return doc->seed;
+}
+
+static size_t subLength(const PieceNode* n) { return n ? n->subLength : 0; }
+static size_t subLineFeeds(const PieceNode* n) { return n ? n->subLineFeeds : 0; }
+
+static void updateNode(PieceNode* n) {
+    n->subLength = subLength(n->left) + n->length + subLength(n->right);
+    n->subLineFeeds = subLineFeeds(n->left) + n->lineFeeds + subLineFeeds(n->right);
+}
+
+// First index in lineStarts whose value is greater than offset.
+static size_t upperBound(const PieceBuffer* b, size_t offset) {
+    size_t lo = 0, hi = b->lineStartCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->lineStarts[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t countLineFeeds(const PieceBuffer* b, size_t start, size_t length) {
+    return upperBound(b, start + length) - upperBound(b, start);
+}
+
+static int pushLineStart(PieceBuffer* b, size_t offset) {
+    if (b->lineStartCount >= b->lineStartCapacity) {
+        size_t cap = b->lineStartCapacity ? b->lineStartCapacity * 2 : 256;
+        size_t* grown = realloc(b->lineStarts, cap * sizeof(size_t));
+        if (!grown) return 0;
+        b->lineStarts = grown;
+        b->lineStartCapacity = cap;
+    }
+    b->lineStarts[b->lineStartCount++] = offset;
+    return 1;
+}
+
+static PieceNode* newNode(int buffer, size_t start, size_t length, size_t lineFeeds, unsigned int priority) {
+    PieceNode* n = malloc(sizeof(PieceNode));
+    if (!n) return NULL;
+
+    n->left = NULL;
+    n->right = NULL;
+    n->priority = priority;
+    n->buffer = buffer;
+    n->start = start;
+    n->length = length;
+    n->lineFeeds = lineFeeds;
+    updateNode(n);
+    return n;
+}
+
+static void freeTree(PieceNode* n) {
+    if (!n) return;
+    freeTree(n->left);
+    freeTree(n->right);
+    free(n);
+}
+
+static PieceNode* mergeTrees(PieceNode* a, PieceNode* b) {
+    if (!a) return b;
+    if (!b) return a;
+
+    if (a->priority >= b->priority) {
+        a->right = mergeTrees(a->right, b);
+        updateNode(a);
+        return a;
+    }
+
+    b->left = mergeTrees(a, b->left);
+    updateNode(b);
+    return b;
+}
+
+// Splits n into [0, pos) and [pos, end), cutting a piece in two if needed.
+static void splitTree(Document* doc, PieceNode* n, size_t pos, PieceNode** outLeft, PieceNode** outRight) {
+    if (!n) {
+        *outLeft = NULL;
+        *outRight = NULL;
+        return;
+    }
+
+    size_t leftLen = subLength(n->left);
+
+    if (pos <= leftLen) {
+        splitTree(doc, n->left, pos, outLeft, &n->left);
+        updateNode(n);
+        *outRight = n;
+    } else if (pos >= leftLen + n->length) {
+        splitTree(doc, n->right, pos - leftLen - n->length, &n->right, outRight);
+        updateNode(n);
+        *outLeft = n;
+    } else {
+        const PieceBuffer* b = &doc->buffers[n->buffer];
+        size_t cut = pos - leftLen;
+        size_t headFeeds = countLineFeeds(b, n->start, cut);
+
+        // The tail keeps the head's priority so both halves stay valid heaps over their children.
+        PieceNode* tail = newNode(n->buffer, n->start + cut, n->length - cut, n->lineFeeds - headFeeds, n->priority);
+        if (!tail) {
+            *outLeft = n;
+            *outRight = NULL;
+            return;
+        }
+
+        tail->right = n->right;
+        updateNode(tail);
+
+        n->right = NULL;
+        n->length = cut;
+        n->lineFeeds = headFeeds;
+        updateNode(n);
+
+        *outLeft = n;
+        *outRight = tail;
+    }
+}
+
+static int appendToAddBuffer(Document* doc, const char* text, size_t length) {
+    PieceBuffer* b = &doc->buffers[PIECE_ADD];
+
+    if (b->length + length > b->capacity) {
+        size_t cap = b->capacity ? b->capacity : 4096;
+        while (cap < b->length + length) cap *= 2;
+        char* grown = realloc(b->data, cap);
+        if (!grown) return 0;
+        b->data = grown;
+        b->capacity = cap;
+    }
+
+    memcpy(b->data + b->length, text, length);
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n' && !pushLineStart(b, b->length + i + 1)) return 0;
+    }
+    b->length += length;
+    return 1;
+}
+
+Document* docCreate(const char* text, size_t length) {
+    Document* doc = calloc(1, sizeof(Document));
+    if (!doc) return NULL;
+    doc->seed = 0x9E3779B9u;
+
+    PieceBuffer* b = &doc->buffers[PIECE_ORIGINAL];
+    b->data = malloc(length + 1);
+    if (!b->data) {
+        free(doc);
+        return NULL;
+    }
+
+    // The file's first line break decides how lines are saved.
+    const char* firstFeed = memchr(text, '\n', length);
+    doc->crlf = firstFeed && firstFeed > text && firstFeed[-1] == '\r';
+
+    size_t j = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\r' && i + 1 < length && text[i + 1] == '\n') continue;
+        b->data[j++] = text[i];
+        if (text[i] == '\n') pushLineStart(b, j);
+    }
+    b->data[j] = '\0';
+    b->length = j;
+    b->capacity = length + 1;
+
+    if (j > 0) doc->root = newNode(PIECE_ORIGINAL, 0, j, b->lineStartCount, nextPriority(doc));
+    return doc;
+}
+
+// Builds a document directly on already-normalized text without copying it. data must hold
+// length bytes plus a terminator, and lineStarts the offset just past every '\n' in it; the
+// document takes ownership of both.
+Document* docAdopt(char* data, size_t length, size_t* lineStarts, size_t lineStartCount) {
+    Document* doc = calloc(1, sizeof(Document));
+    if (!doc) return NULL;
+    doc->seed = 0x9E3779B9u;
+
+    PieceBuffer* b = &doc->buffers[PIECE_ORIGINAL];
+    b->data = data;
+    b->length = length;
+    b->capacity = length + 1;
+    b->lineStarts = lineStarts;
+    b->lineStartCount = lineStartCount;
+    b->lineStartCapacity = lineStartCount;
+
+    if (length > 0) doc->root = newNode(PIECE_ORIGINAL, 0, length, lineStartCount, nextPriority(doc));
+    return doc;
+}
+
+void docFree(Document* doc) {
+    if (!doc) return;
+    freeTree(doc->root);
+    for (int i = 0; i < 2; i++) {
+        free(doc->buffers[i].data);
+        free(doc->buffers[i].lineStarts);
+    }
+    free(doc->scratch);
+    free(doc);
+}
+
+size_t docLength(const Document* doc) {
+    return doc ? subLength(doc->root) : 0;
+}
+
+int docLineCount(const Document* doc) {
+    return doc ? (int)subLineFeeds(doc->root) + 1 : 0;
+}
+
+unsigned int docVersion(const Document* doc) {
+    return doc ? doc->version : 0;
+}
+
+size_t docLineStart(const Document* doc, int line) {
+    if (!doc || line <= 0) return 0;
+    if ((size_t)line > subLineFeeds(doc->root)) return docLength(doc);
+
+    const PieceNode* n = doc->root;
+    size_t k = (size_t)line;
+    size_t base = 0;
+
+    while (n) {
+        size_t leftFeeds = subLineFeeds(n->left);
+        if (k <= leftFeeds) {
+            n = n->left;
+            continue;
+        }
+
+        k -= leftFeeds;
+        base += subLength(n->left);
+
+        if (k <= n->lineFeeds) {
+            const PieceBuffer* b = &doc->buffers[n->buffer];
+            size_t lineStart = b->lineStarts[upperBound(b, n->start) + k - 1];
+            return base + (lineStart - n->start);
+        }
+
+        k -= n->lineFeeds;
+        base += n->length;
+        n = n->right;
+    }
+
+    return docLength(doc);
+}
+
+int docLineLength(const Document* doc, int line) {
+    if (!doc || line < 0 || line >= docLineCount(doc)) return 0;
+
+    size_t start = docLineStart(doc, line);
+    if (line + 1 >= docLineCount(doc)) return (int)(docLength(doc) - start);
+    return (int)(docLineStart(doc, line + 1) - start - 1);
+}
+
+size_t docOffset(const Document* doc, int line, int col) {
+    if (!doc) return 0;
+    if (line < 0) return 0;
+    if (line >= docLineCount(doc)) return docLength(doc);
+
+    int len = docLineLength(doc, line);
+    if (col < 0) col = 0;
+    if (col > len) col = len;
+    return docLineStart(doc, line) + (size_t)col;
+}
+
+// Grows the rightmost piece of n in place when it ends exactly where the add buffer did.
+static int extendRightmost(PieceNode* n, size_t addEnd, size_t length, size_t lineFeeds) {
+    if (!n) return 0;
+
+    PieceNode* last = n;
+    while (last->right) last = last->right;
+    if (last->buffer != PIECE_ADD || last->start + last->length != addEnd) return 0;
+
+    for (PieceNode* p = n; p; p = p->right) {
+        p->subLength += length;
+        p->subLineFeeds += lineFeeds;
+    }
+    last->length += length;
+    last->lineFeeds += lineFeeds;
+    return 1;
+}
+
+void docInsert(Document* doc, size_t offset, const char* text, size_t length) {
+    if (!doc || !text || length == 0) return;
+    if (offset > docLength(doc)) offset = docLength(doc);
+
+    PieceBuffer* add = &doc->buffers[PIECE_ADD];
+    size_t start = add->length;
+    size_t feedsBefore = add->lineStartCount;
+    if (!appendToAddBuffer(doc, text, length)) return;
+    size_t lineFeeds = add->lineStartCount - feedsBefore;
+
+    PieceNode *left, *right;
+    splitTree(doc, doc->root, offset, &left, &right);
+
+    if (!extendRightmost(left, start, length, lineFeeds)) {
+        PieceNode* piece = newNode(PIECE_ADD, start, length, lineFeeds, nextPriority(doc));
+        if (piece) left = mergeTrees(left, piece);
+    }
+
+    doc->root = mergeTrees(left, right);
+    doc->version++;
+}
+
+void docDelete(Document* doc, size_t offset, size_t length) {
+    if (!doc || length == 0) return;
+
+    size_t total = docLength(doc);
+    if (offset >= total) return;
+    if (length > total - offset) length = total - offset;
+
+    PieceNode *left, *middle, *right;
+    splitTree(doc, doc->root, offset, &left, &middle);
+    splitTree(doc, middle, length, &middle, &right);
+    freeTree(middle);
+
+    doc->root = mergeTrees(left, right);
+    doc->version++;
+}
+
+static void copyNode(const Document* doc, const PieceNode* n, size_t base, size_t from, size_t to, char** out) {
+    if (!n || from >= to) return;
+
+    size_t pieceStart = base + subLength(n->left);
+    size_t pieceEnd = pieceStart + n->length;
+
+    if (from < pieceStart) copyNode(doc, n->left, base, from, to < pieceStart ? to : pieceStart, out);
+
+    size_t a = from > pieceStart ? from : pieceStart;
+    size_t b = to < pieceEnd ? to : pieceEnd;
+    if (a < b) {
+        memcpy(*out, doc->buffers[n->buffer].data + n->start + (a - pieceStart), b - a);
+        *out += b - a;
+    }
+
+    if (to > pieceEnd) copyNode(doc, n->right, pieceEnd, from > pieceEnd ? from : pieceEnd, to, out);
+}
+
+size_t docCopy(const Document* doc, size_t offset, size_t length, char* out) {
+    if (!doc || !out) return 0;
+
+    size_t total = docLength(doc);
+    if (offset >= total) return 0;
+    if (length > total - offset) length = total - offset;
+
+    char* p = out;
+    copyNode(doc, doc->root, 0, offset, offset + length, &p);
+    return (size_t)(p - out);
+}
+
+const char* docLine(Document* doc, int line, int* outLength) {
+    if (outLength) *outLength = 0;
+    if (!doc || line < 0 || line >= docLineCount(doc)) return "";
+
+    size_t start = docLineStart(doc, line);
+    int len = docLineLength(doc, line);
+
+    if ((size_t)len + 1 > doc->scratchCapacity) {
+        size_t cap = doc->scratchCapacity ? doc->scratchCapacity : 256;
+        while (cap < (size_t)len + 1) cap *= 2;
+        char* grown = realloc(doc->scratch, cap);
+        if (!grown) return "";
+        doc->scratch = grown;
+        doc->scratchCapacity = cap;
+    }
+
+    docCopy(doc, start, (size_t)len, doc->scratch);
+    doc->scratch[len] = '\0';
+
+    if (outLength) *outLength = len;
+    return doc->scratch;
+}
+
+// Writes length bytes of a piece, turning each '\n' into "\r\n" when crlf is set.
+static int writePiece(const char* p, size_t length, int crlf, FILE* f) {
+    if (!crlf) return length == 0 || fwrite(p, 1, length, f) == length;
+
+    while (length > 0) {
+        const char* feed = memchr(p, '\n', length);
+        size_t run = feed ? (size_t)(feed - p) : length;
+        if (run && fwrite(p, 1, run, f) != run) return 0;
+        if (!feed) break;
+        if (fwrite("\r\n", 1, 2, f) != 2) return 0;
+
+        p += run + 1;
+        length -= run + 1;
+    }
+    return 1;
+}
+
+static int writeNode(const Document* doc, const PieceNode* n, FILE* f) {
+    if (!n) return 1;
+    if (!writeNode(doc, n->left, f)) return 0;
+    if (!writePiece(doc->buffers[n->buffer].data + n->start, n->length, doc->crlf, f)) return 0;
+    return writeNode(doc, n->right, f);
+}
+
+// Writes the text with the line endings the file was loaded with.
+int docWrite(const Document* doc, FILE* f) {
+    if (!doc || !f) return 0;
+    return writeNode(doc, doc->root, f);
+}
+
+// Marks whether docWrite ends lines with "\r\n", for documents not built by docCreate.
+void docSetCRLF(Document* doc, int crlf) {
+    if (doc) doc->crlf = crlf;
+}
@@ -0,0 +1,33 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Piece-table text buffer. The original file bytes and an append-only add
+// buffer are never modified in place; the document is a balanced tree of
+// pieces pointing into them, so edits cost O(log n) and memory stays close
+// to file size plus edit volume. Lines are separated by '\n' ("\r\n" is
+// normalized on load, and written back by docWrite for a document marked CRLF).
+typedef struct Document Document;
+
+Document* docCreate(const char* text, size_t length);
+Document* docAdopt(char* data, size_t length, size_t* lineStarts, size_t lineStartCount);
+void docFree(Document* doc);
+
+size_t docLength(const Document* doc);
+int docLineCount(const Document* doc);
+size_t docLineStart(const Document* doc, int line);
+int docLineLength(const Document* doc, int line);
+size_t docOffset(const Document* doc, int line, int col);
+unsigned int docVersion(const Document* doc);
+
+void docInsert(Document* doc, size_t offset, const char* text, size_t length);
+void docDelete(Document* doc, size_t offset, size_t length);
+
+size_t docCopy(const Document* doc, size_t offset, size_t length, char* out);
+const char* docLine(Document* doc, int line, int* outLength);
+int docWrite(const Document* doc, FILE* f);
+void docSetCRLF(Document* doc, int crlf);
+
+#endif
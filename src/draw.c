@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,21 +13,114 @@
 GLuint fontTexture = 0;
 int fontLoaded = 0;
 stbtt_bakedchar cdata[96];
-unsigned char fontBitmap[BITMAP_W * BITMAP_H];
+FontAtlas fontAtlas;
 
 extern int screenWidth;
 extern int screenHeight;
 extern int mode;
 
+// A text shader and the uniforms the batcher sets on it; paletteUploaded counts the
+// palette entries it already has.
+typedef struct {
+    GLuint program;
+    GLint tex;
+    GLint glyphs;
+    GLint rects;
+    GLint palette;
+    GLint screen;
+    GLint scale;
+    GLint offset;
+    int paletteUploaded;
+} TextProgram;
+
 static GLuint textVAO = 0;
-static GLuint textVBO = 0;
-static GLuint textShaderProgram = 0;
+static StreamBuffer instanceStream;
+static TextProgram textProgram;
+static TextProgram sdfProgram;
 static int textBuffersInitialized = 0;
-static GLuint solidProgram = 0;
 static int prevMouseDown = 0;
-static GLuint solidVAO = 0;
-static GLuint solidVBO = 0;
-static GLint solidColorLoc = -1;
+
+// Frame batcher: glyphs and solid rects are drawn as one instanced quad each, from a
+// GlyphInstance. The shader reads the glyph's box and UVs from the glyph metrics buffer; ids
+// from BATCH_RECT_ID up index this batch's rect sizes instead. Everything in a batch is moved
+// by batchOffset. The batch is drawn when something that affects it changes (scissor,
+// texture, text scale, offset, full palette, end of frame).
+#define BATCH_RECT_ID 0x8000
+#define BATCH_MAX_RECTS 0x8000
+#define BATCH_PALETTE_SIZE 128
+
+static GlyphInstance* batchInstances = NULL;
+static int batchCount = 0;
+static int batchCapacity = 0;
+static GLuint batchTexture = 0;
+static float batchScale = 1.0f;
+static int batchGlyphs = 0;
+static float batchOffset[2] = {0.0f, 0.0f};
+
+// Bumped whenever palette indices or glyph ids handed out before stop being good, which
+// makes every cached TextRun stale.
+static unsigned int runGeneration = 1;
+
+// Widths and heights of the rects in the batch, read through rectTexture.
+static float* batchRects = NULL;
+static int batchRectCount = 0;
+static int batchRectCapacity = 0;
+static GLuint rectBuffer = 0;
+static GLuint rectTexture = 0;
+
+// Colors the batch refers to by index; kept across flushes until it fills up.
+static float batchPalette[BATCH_PALETTE_SIZE][4];
+static int paletteCount = 0;
+
+// Two texels per glyph id: (xoff, yoff, width, height) in pixels and (s0, t0, s1, t1).
+static GLuint glyphBuffer = 0;
+static GLuint glyphTexture = 0;
+static int scissorEnabled = 0;
+static int scissorEmpty = 0;
+static int scissorRect[4] = {0, 0, 0, 0};
+static DrawFrameStats frameStats = {0};
+static DrawFrameStats lastFrameStats = {0};
+static unsigned long batchTotal = 0;
+static int batchMax = 0;
+static FrameCounters frameCounters = {0, 0};
+static int dirtyPanes = DIRTY_ALL;
+
+// Partial redraw: panes report damaged rects, and a frame clears and redraws only those,
+// scissored, into a retained framebuffer that is then copied to the window. Rects are kept
+// in top-left pixels as x0, y0, x1, y1 and are empty when x1 <= x0.
+#define PANE_COUNT 4
+#define PANE_MARGIN 2
+#define DAMAGE_FLASH_SECONDS 0.15
+
+static int damagePanes = 0;
+static int paneDamage[PANE_COUNT][4];
+static int frameClips[PANE_COUNT][4];
+
+// Scissor of the pane being drawn, in GL pixels as x, y, w, h; drawSetScissor stays inside it.
+static int clipRect[4] = {0, 0, 0, 0};
+static int clipFull = 1;
+
+static GLuint frameFbo = 0;
+static GLuint frameColor = 0;
+static int frameW = 0;
+static int frameH = 0;
+static int frameTargetFailed = 0;
+static GLuint frameTarget = 0;
+
+// MCODE_SHOW_DAMAGE or F9 tints what each frame redrew until DAMAGE_FLASH_SECONDS pass.
+static int showDamage = -1;
+static int flashShown = 0;
+static double flashUntil = 0.0;
+static double fillTotal = 0.0;
+static double screenTotal = 0.0;
+
+// One texture per atlas page; page 0, which holds ASCII, is fontTexture.
+static GLuint pageTextures[ATLAS_MAX_PAGES];
+
+// Rasterized atlases are cached on disk per font, pixel size and DPI.
+static AtlasCacheKey fontCacheKey;
+static char fontCachePath[MAX_PATH];
+static int fontCacheRasterized = 0;
 
 float pxToNDC_X(int x) { return 2.0f * ((float)x / screenWidth) - 1.0f; }
 float pxToNDC_Y(int y) { return 1.0f - 2.0f * ((float)y / screenHeight); }
@@ -79,20 +173,54 @@ static GLuint linkProgramChecked(GLuint vs, GLuint fs) {
     return prog;
 }
 
+static void linkTextProgram(TextProgram* p, const char* vsSrc, const char* fsSrc) {
+    GLuint vs = compileShaderChecked(vsSrc, GL_VERTEX_SHADER);
+    GLuint fs = compileShaderChecked(fsSrc, GL_FRAGMENT_SHADER);
+    p->program = linkProgramChecked(vs, fs);
+    p->tex = glGetUniformLocation(p->program, "uTex");
+    p->glyphs = glGetUniformLocation(p->program, "uGlyphs");
+    p->rects = glGetUniformLocation(p->program, "uRects");
+    p->palette = glGetUniformLocation(p->program, "uPalette");
+    p->screen = glGetUniformLocation(p->program, "uScreen");
+    p->scale = glGetUniformLocation(p->program, "uScale");
+    p->offset = glGetUniformLocation(p->program, "uOffset");
+    p->paletteUploaded = 0;
+}
+
 static void initTextShaderOnce() {
-    if (textShaderProgram) return;
+    if (textProgram.program) return;
 
+    // One quad per instance, its corner picked by gl_VertexID. Glyphs are scaled about the
+    // pen and snapped to whole pixels; at scale 1 this is what stbtt_GetBakedQuad gives.
+    // Rects get a negative u so the fragment shader skips the font texture for them.
     const char* vsSrc =
         "#version 330 core\n"
-        "layout(location=0) in vec3 aPos;\n"
-        "layout(location=1) in vec2 aUV;\n"
-        "layout(location=2) in vec4 aColor;\n"
+        "layout(location=0) in ivec2 aPos;\n"
+        "layout(location=1) in uint aGlyph;\n"
+        "layout(location=2) in uint aPalette;\n"
+        "uniform samplerBuffer uGlyphs;\n"
+        "uniform samplerBuffer uRects;\n"
+        "uniform vec4 uPalette[128];\n"
+        "uniform vec2 uScreen;\n"
+        "uniform float uScale;\n"
+        "uniform vec2 uOffset;\n"
         "out vec2 vUV;\n"
         "out vec4 vColor;\n"
+        "const vec2 corners[6] = vec2[6](vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,0), vec2(1,1), vec2(0,1));\n"
         "void main(){\n"
-        "  gl_Position = vec4(aPos,1.0);\n"
-        "  vUV = aUV;\n"
-        "  vColor = aColor;\n"
+        "  vec2 c = corners[gl_VertexID];\n"
+        "  vec2 p;\n"
+        "  if (aGlyph >= 32768u) {\n"
+        "    p = vec2(aPos) + uOffset + c * texelFetch(uRects, int(aGlyph - 32768u)).xy;\n"
+        "    vUV = vec2(-1.0);\n"
+        "  } else {\n"
+        "    vec4 box = texelFetch(uGlyphs, int(aGlyph) * 2);\n"
+        "    vec4 uv = texelFetch(uGlyphs, int(aGlyph) * 2 + 1);\n"
+        "    p = floor(vec2(aPos) + uOffset + box.xy * uScale + 0.5) + c * box.zw * uScale;\n"
+        "    vUV = mix(uv.xy, uv.zw, c);\n"
+        "  }\n"
+        "  gl_Position = vec4(2.0 * p.x / uScreen.x - 1.0, 1.0 - 2.0 * p.y / uScreen.y, 0.0, 1.0);\n"
+        "  vColor = uPalette[aPalette];\n"
         "}\n";
 
     const char* fsSrc =
@@ -102,50 +230,80 @@ static void initTextShaderOnce() {
         "out vec4 FragColor;\n"
         "uniform sampler2D uTex;\n"
         "void main(){\n"
-        "  float a = texture(uTex, vUV).r;\n"
+        "  float a = vUV.x < 0.0 ? 1.0 : texture(uTex, vUV).r;\n"
         "  FragColor = vec4(vColor.rgb, a * vColor.a);\n"
         "}\n";
 
-    GLuint vs = compileShaderChecked(vsSrc, GL_VERTEX_SHADER);
-    GLuint fs = compileShaderChecked(fsSrc, GL_FRAGMENT_SHADER);
-    textShaderProgram = linkProgramChecked(vs, fs);
+    // Distance-field glyphs: the edge sits at 0.5 and is smoothed over about one screen pixel,
+    // which fwidth keeps right at any zoom.
+    const char* sdfFsSrc =
+        "#version 330 core\n"
+        "in vec2 vUV;\n"
+        "in vec4 vColor;\n"
+        "out vec4 FragColor;\n"
+        "uniform sampler2D uTex;\n"
+        "void main(){\n"
+        "  float a = 1.0;\n"
+        "  if (vUV.x >= 0.0) {\n"
+        "    float d = texture(uTex, vUV).r;\n"
+        "    float w = max(fwidth(d) * 0.7, 1e-4);\n"
+        "    a = smoothstep(0.5 - w, 0.5 + w, d);\n"
+        "  }\n"
+        "  FragColor = vec4(vColor.rgb, a * vColor.a);\n"
+        "}\n";
+
+    linkTextProgram(&textProgram, vsSrc, fsSrc);
+    linkTextProgram(&sdfProgram, vsSrc, sdfFsSrc);
+}
+
+static GLuint createBufferTexture(GLuint buffer, GLenum format) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_BUFFER, tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    return tex;
 }
 
 static void initTextBuffersOnce() {
     if (textBuffersInitialized) return;
     textBuffersInitialized = 1;
 
+    // Instances are streamed through a ring, so the attribute pointers are set per batch.
     glGenVertexArrays(1, &textVAO);
-    glGenBuffers(1, &textVBO);
-
     glBindVertexArray(textVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-
-    glBufferData(GL_ARRAY_BUFFER, MAX_TEXT_CHARS * 6 * 9 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-
-    // layout: pos (x,y,z)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // layout: uv (s,t)
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // layout: color (r,g,b,a)
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(5 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    for (int i = 0; i < 3; i++) {
+        glVertexAttribDivisor(i, 1);
+        glEnableVertexAttribArray(i);
+    }
+    glBindVertexArray(0);
 
+    streamInit(&instanceStream, GL_ARRAY_BUFFER, 4 * 1024 * 1024);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+
+    // Room for every possible glyph id up front; only changed ids are sent later.
+    glGenBuffers(1, &glyphBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, glyphBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)ATLAS_MAX_GLYPH_IDS * 8 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    glyphTexture = createBufferTexture(glyphBuffer, GL_RGBA32F);
+
+    glGenBuffers(1, &rectBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, rectBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, 2 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    rectTexture = createBufferTexture(rectBuffer, GL_RG32F);
 }
 
-static GLuint createFontTexture() {
+static GLuint createPageTexture(int page) {
     GLuint tex;
     glGenTextures(1, &tex);
     glBindTexture(GL_TEXTURE_2D, tex);
 
+    int from, to;
+    atlasTakeDirty(&fontAtlas, page, &from, &to);
+
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, BITMAP_W, BITMAP_H, 0, GL_RED, GL_UNSIGNED_BYTE, fontBitmap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, fontAtlas.pages[page].pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -156,9 +314,65 @@ static GLuint createFontTexture() {
     return tex;
 }
 
+static GLuint pageTexture(int page) {
+    if (!pageTextures[page]) pageTextures[page] = createPageTexture(page);
+    return pageTextures[page];
+}
+
+// Sends glyphs rasterized since the last flush to their page textures.
+static void uploadAtlasPages() {
+    for (int i = 0; i < fontAtlas.pageCount; i++) {
+        int from, to;
+        if (!pageTextures[i] || !atlasTakeDirty(&fontAtlas, i, &from, &to)) continue;
+
+        glBindTexture(GL_TEXTURE_2D, pageTextures[i]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, from, ATLAS_PAGE_SIZE, to - from + 1, GL_RED, GL_UNSIGNED_BYTE, fontAtlas.pages[i].pixels + from * ATLAS_PAGE_SIZE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Sends the boxes and UVs of glyph ids the atlas handed out or reused since the last flush.
+static void uploadGlyphMetrics() {
+    int from, to;
+    if (!atlasTakeDirtyQuads(&fontAtlas, &from, &to)) return;
+
+    int count = to - from + 1;
+    float* texels = malloc((size_t)count * 8 * sizeof(float));
+    if (!texels) return;
+
+    for (int i = 0; i < count; i++) {
+        const stbtt_bakedchar* q = &fontAtlas.quads[from + i];
+        float* t = &texels[i * 8];
+        t[0] = q->xoff;
+        t[1] = q->yoff;
+        t[2] = (float)(q->x1 - q->x0);
+        t[3] = (float)(q->y1 - q->y0);
+        t[4] = q->x0 / (float)ATLAS_PAGE_SIZE;
+        t[5] = q->y0 / (float)ATLAS_PAGE_SIZE;
+        t[6] = q->x1 / (float)ATLAS_PAGE_SIZE;
+        t[7] = q->y1 / (float)ATLAS_PAGE_SIZE;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, glyphBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)from * 8 * sizeof(float), (GLsizeiptr)count * 8 * sizeof(float), texels);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    frameStats.uploadBytes += count * 8 * (int)sizeof(float);
+    free(texels);
+}
+
+// Quads already batched from a page have to be drawn before the atlas reuses it, and runs
+// built with ids from it have to be built again.
+static void atlasEvicting(int page, void* user) {
+    drawFlush();
+    runGeneration++;
+}
+
 void initFont(int h) {
     if (fontLoaded) return;
 
+    double started = glfwGetTime();
+
     size_t TTFsize = 0;
     unsigned char* TTFbuffer = loadFile("src/font/codenamecoderfree4f-Bold.ttf", &TTFsize);
     if (!TTFbuffer) {
@@ -167,176 +381,814 @@ void initFont(int h) {
     }
 
     int pixelHeight = h > 0 ? (h / 30) : 18;
-    if (stbtt_BakeFontBitmap(TTFbuffer, 0, (float)pixelHeight, fontBitmap, BITMAP_W, BITMAP_H, 32, 96, cdata) <= 0) {
-        printf("Failed to bake font bitmap\n");
-        free(TTFbuffer);
-        return;
+
+    float xscale = 1.0f, yscale = 1.0f;
+    if (glfwGetCurrentContext()) glfwGetWindowContentScale(glfwGetCurrentContext(), &xscale, &yscale);
+
+    fontCacheKey.fontHash = atlasFontHash(TTFbuffer, TTFsize);
+    fontCacheKey.pixelHeight = pixelHeight;
+    fontCacheKey.dpi = (int)(96.0f * yscale + 0.5f);
+    fontCacheKey.sdf = 1;
+    snprintf(fontCachePath, sizeof(fontCachePath), "src/font/atlas-%08x-%d-%d.cache", fontCacheKey.fontHash, fontCacheKey.pixelHeight, fontCacheKey.dpi);
+
+    int cached = atlasLoadCache(&fontAtlas, fontCachePath, &fontCacheKey, TTFbuffer, cdata);
+    if (!cached) {
+        if (!atlasInit(&fontAtlas, TTFbuffer, (float)pixelHeight, fontCacheKey.sdf, cdata)) {
+            printf("Failed to build font atlas\n");
+            return;
+        }
+        atlasSaveCache(&fontAtlas, fontCachePath, &fontCacheKey, cdata);
     }
-    free(TTFbuffer);
+    fontCacheRasterized = fontAtlas.rasterized;
+    fontAtlas.onEvict = atlasEvicting;
 
     initTextShaderOnce();
     initTextBuffersOnce();
 
-    fontTexture = createFontTexture();
+    fontTexture = pageTexture(0);
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     fontLoaded = 1;
+    printf("Font atlas %s in %.1f ms\n", cached ? "loaded from cache" : "rasterized", (glfwGetTime() - started) * 1000.0);
 }
 
-static void renderTextChunk(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, int count, float baseX, float baseY, int screenWidth, int screenHeight, float scale, float r, float g, float b, float a) {
-    int maxCount = (int)strlen(text);
-    if (count > maxCount) count = maxCount;
-    
-    float* vertexBuffer = persistentVertexBuffer;
-    if (!vertexBuffer) return;
+// Writes glyphs rasterized this session to the atlas cache, then frees the atlas.
+void fontShutdown() {
+    if (!fontLoaded) return;
 
-    int vertCount = 0;
+    if (fontAtlas.rasterized != fontCacheRasterized) atlasSaveCache(&fontAtlas, fontCachePath, &fontCacheKey, cdata);
+    atlasFree(&fontAtlas);
+    fontLoaded = 0;
+}
 
-    float x = FLOORF(baseX * scale);
-    float y = FLOORF(baseY * scale);
+// Returns room for count more instances at the end of the batch, growing it if needed.
+static GlyphInstance* batchReserve(int count) {
+    if (batchCount + count > batchCapacity) {
+        int cap = batchCapacity ? batchCapacity : 4096;
+        while (cap < batchCount + count) cap *= 2;
+        GlyphInstance* grown = realloc(batchInstances, (size_t)cap * sizeof(GlyphInstance));
+        if (!grown) return NULL;
+        batchInstances = grown;
+        batchCapacity = cap;
+    }
+    return &batchInstances[batchCount];
+}
 
-    for (int i = 0; i < count; i++) {
-        unsigned char c = (unsigned char)text[i];
-        if (c < 32 || c >= 128) continue;
-
-        stbtt_aligned_quad q;
-        stbtt_GetBakedQuad((stbtt_bakedchar*)cdata, BITMAP_W, BITMAP_H, c - 32, &x, &y, &q, 1);
-
-        q.x0 = FLOORF(q.x0);
-        q.y0 = FLOORF(q.y0);
-        q.x1 = FLOORF(q.x1);
-        q.y1 = FLOORF(q.y1);
-
-        float x0 =  2.0f * q.x0 / screenWidth  - 1.0f;
-        float y0 =  1.0f - 2.0f * q.y0 / screenHeight;
-        float x1 =  2.0f * q.x1 / screenWidth  - 1.0f;
-        float y1 =  1.0f - 2.0f * q.y1 / screenHeight;
-
-        float verts[6][9] = {
-            {x0, y0, 0.0f, q.s0, q.t0, r, g, b, a},
-            {x1, y0, 0.0f, q.s1, q.t0, r, g, b, a},
-            {x1, y1, 0.0f, q.s1, q.t1, r, g, b, a},
-
-            {x0, y0, 0.0f, q.s0, q.t0, r, g, b, a},
-            {x1, y1, 0.0f, q.s1, q.t1, r, g, b, a},
-            {x0, y1, 0.0f, q.s0, q.t1, r, g, b, a}
-        };
+// Palette index of a color, adding it when new. A full palette is drawn and started over,
+// so this must not be called while instances are reserved but not yet committed.
+static int paletteIndex(float r, float g, float b, float a) {
+    for (int i = paletteCount - 1; i >= 0; i--) {
+        const float* c = batchPalette[i];
+        if (c[0] == r && c[1] == g && c[2] == b && c[3] == a) return i;
+    }
 
-        memcpy(&vertexBuffer[vertCount * 9], verts, sizeof(verts));
-        vertCount += 6;
+    if (paletteCount == BATCH_PALETTE_SIZE) {
+        drawFlush();
+        paletteCount = 0;
+        textProgram.paletteUploaded = 0;
+        sdfProgram.paletteUploaded = 0;
+        runGeneration++;
     }
 
-    glUseProgram(textShaderProgram);
+    float* c = batchPalette[paletteCount];
+    c[0] = r;
+    c[1] = g;
+    c[2] = b;
+    c[3] = a;
+    return paletteCount++;
+}
+
+void drawFlush() {
+    if (batchCount == 0) return;
+
+    // Nothing under an empty scissor would reach the frame.
+    if (scissorEmpty) {
+        batchCount = 0;
+        batchGlyphs = 0;
+        batchRectCount = 0;
+        return;
+    }
+
+    initTextShaderOnce();
+    initTextBuffersOnce();
+    uploadAtlasPages();
+    uploadGlyphMetrics();
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    TextProgram* p = fontAtlas.sdf ? &sdfProgram : &textProgram;
+    glUseProgram(p->program);
+    glUniform2f(p->screen, (float)screenWidth, (float)screenHeight);
+    glUniform1f(p->scale, batchScale);
+    glUniform2f(p->offset, batchOffset[0], batchOffset[1]);
+    if (p->paletteUploaded < paletteCount) {
+        glUniform4fv(p->palette + p->paletteUploaded, paletteCount - p->paletteUploaded, batchPalette[p->paletteUploaded]);
+        frameStats.uploadBytes += (paletteCount - p->paletteUploaded) * 4 * (int)sizeof(float);
+        p->paletteUploaded = paletteCount;
+    }
+
+    // A texture buffer can only be bound whole in GL 3.3, so rect sizes cannot share the
+    // ring; their buffer is orphaned instead, which keeps the write from waiting on the
+    // previous batch's draw.
+    if (batchRectCount > 0) {
+        GLsizeiptr rectBytes = (GLsizeiptr)batchRectCount * 2 * sizeof(float);
+        glBindBuffer(GL_TEXTURE_BUFFER, rectBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, rectBytes, batchRects, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        frameStats.uploadBytes += (int)rectBytes;
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, glyphTexture);
+    glUniform1i(p->glyphs, 1);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, rectTexture);
+    glUniform1i(p->rects, 2);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, fontTex);
-    glUniform1i(glGetUniformLocation(textShaderProgram, "uTex"), 0);
+    glBindTexture(GL_TEXTURE_2D, batchTexture);
+    glUniform1i(p->tex, 0);
 
     glBindVertexArray(textVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vertCount * 9 * sizeof(float), vertexBuffer);
-    glDrawArrays(GL_TRIANGLES, 0, vertCount);
+
+    GLsizeiptr bytes = (GLsizeiptr)batchCount * sizeof(GlyphInstance);
+    GLintptr base = streamUpload(&instanceStream, batchInstances, bytes);
+
+    // layout: pen (x,y), glyph id, palette index
+    glVertexAttribIPointer(0, 2, GL_SHORT, sizeof(GlyphInstance), (void*)(base + offsetof(GlyphInstance, x)));
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(GlyphInstance), (void*)(base + offsetof(GlyphInstance, glyph)));
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE, sizeof(GlyphInstance), (void*)(base + offsetof(GlyphInstance, palette)));
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, batchCount);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    glUseProgram(0);
+
+    frameStats.batches++;
+    frameStats.uploadBytes += (int)bytes;
+    batchCount = 0;
+    batchGlyphs = 0;
+    batchRectCount = 0;
 }
 
-int renderText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, float x, float y, int screenWidth, int screenHeight, float scale, float r, float g, float b, float a) {
-    if (!text || !*text) return 0;
+// Scissors to (x, y, w, h) in GL pixels, cut down to the clip of the pane being drawn.
+void drawSetScissor(int x, int y, int w, int h) {
+    if (!clipFull) {
+        int x1 = x + w, y1 = y + h;
+        if (x < clipRect[0]) x = clipRect[0];
+        if (y < clipRect[1]) y = clipRect[1];
+        if (x1 > clipRect[0] + clipRect[2]) x1 = clipRect[0] + clipRect[2];
+        if (y1 > clipRect[1] + clipRect[3]) y1 = clipRect[1] + clipRect[3];
+        w = x1 > x ? x1 - x : 0;
+        h = y1 > y ? y1 - y : 0;
+    }
 
-    initTextBuffersOnce();
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (scissorEnabled && scissorRect[0] == x && scissorRect[1] == y && scissorRect[2] == w && scissorRect[3] == h) return;
+
+    drawFlush();
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x, y, w, h);
+
+    scissorEnabled = 1;
+    scissorEmpty = w <= 0 || h <= 0;
+    scissorRect[0] = x;
+    scissorRect[1] = y;
+    scissorRect[2] = w;
+    scissorRect[3] = h;
+}
+
+// Goes back to the pane's clip, or to no scissor at all outside of a partial frame.
+void drawClearScissor() {
+    if (!clipFull) {
+        drawSetScissor(clipRect[0], clipRect[1], clipRect[2], clipRect[3]);
+        return;
+    }
+    if (!scissorEnabled) return;
+
+    drawFlush();
+    glDisable(GL_SCISSOR_TEST);
+    scissorEnabled = 0;
+    scissorEmpty = 0;
+}
+
+// Moves everything batched from now on by (x, y) pixels, which the shader adds; a TextRun
+// drawn under an offset does not have to be rebuilt when the offset alone changes.
+void drawSetOffset(float x, float y) {
+    if (batchOffset[0] == x && batchOffset[1] == y) return;
+
+    drawFlush();
+    batchOffset[0] = x;
+    batchOffset[1] = y;
+}
+
+static int rectEmpty(const int* r) {
+    return r[2] <= r[0] || r[3] <= r[1];
+}
+
+static void rectUnion(int* dst, const int* src) {
+    if (rectEmpty(src)) return;
+    if (rectEmpty(dst)) {
+        memcpy(dst, src, 4 * sizeof(int));
+        return;
+    }
+    if (src[0] < dst[0]) dst[0] = src[0];
+    if (src[1] < dst[1]) dst[1] = src[1];
+    if (src[2] > dst[2]) dst[2] = src[2];
+    if (src[3] > dst[3]) dst[3] = src[3];
+}
+
+static void rectIntersect(int* dst, const int* a, const int* b) {
+    dst[0] = a[0] > b[0] ? a[0] : b[0];
+    dst[1] = a[1] > b[1] ? a[1] : b[1];
+    dst[2] = a[2] < b[2] ? a[2] : b[2];
+    dst[3] = a[3] < b[3] ? a[3] : b[3];
+}
+
+static int rectContains(const int* outer, const int* inner) {
+    return inner[0] >= outer[0] && inner[1] >= outer[1] && inner[2] <= outer[2] && inner[3] <= outer[3];
+}
+
+static int paneIndex(int pane) {
+    for (int i = 0; i < PANE_COUNT; i++) {
+        if (pane == 1 << i) return i;
+    }
+    return -1;
+}
+
+// Where a pane draws, in top-left pixels. Neighbours share their border rows, and with
+// margin set the bounds also take in a few pixels past the edges.
+static void paneBounds(int i, int margin, int* r) {
+    int explorerW = (int)(screenWidth * EXPLORER_RATIO);
+    int cmdTop = screenHeight - 250 - 1;
+
+    switch (i) {
+        case 0: r[0] = 0;         r[1] = 0;      r[2] = screenWidth; r[3] = 81;           break;
+        case 1: r[0] = 0;         r[1] = 81;     r[2] = explorerW;   r[3] = screenHeight; break;
+        case 2: r[0] = explorerW; r[1] = 81;     r[2] = screenWidth; r[3] = cmdTop + 1;   break;
+        default: r[0] = explorerW; r[1] = cmdTop; r[2] = screenWidth; r[3] = screenHeight; break;
+    }
+
+    r[0] -= margin;
+    r[1] -= margin;
+    r[2] += margin;
+    r[3] += margin;
+}
+
+// Returns the DIRTY_ bit of the pane at (x, y) in top-left pixels, or 0.
+int drawPaneAt(int x, int y) {
+    for (int i = 0; i < PANE_COUNT; i++) {
+        int r[4];
+        paneBounds(i, 0, r);
+        if (x >= r[0] && x < r[2] && y >= r[1] && y < r[3]) return 1 << i;
+    }
+    return 0;
+}
+
+// Returns 1 when the retained framebuffer was made anew (or cannot be used) and the whole
+// frame has to be drawn.
+static int ensureFrameTarget() {
+    if (frameTargetFailed || screenWidth <= 0 || screenHeight <= 0) return 1;
+    if (frameFbo && frameW == screenWidth && frameH == screenHeight) return 0;
+
+    if (!frameFbo) {
+        glGenFramebuffers(1, &frameFbo);
+        glGenRenderbuffers(1, &frameColor);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, frameColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, screenWidth, screenHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, frameColor);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("drawBeginFrame: retained framebuffer incomplete (0x%x), redrawing whole frames\n", status);
+        glDeleteFramebuffers(1, &frameFbo);
+        glDeleteRenderbuffers(1, &frameColor);
+        frameFbo = 0;
+        frameColor = 0;
+        frameTargetFailed = 1;
+        return 1;
+    }
+
+    frameW = screenWidth;
+    frameH = screenHeight;
+    return 1;
+}
+
+// Binds the retained framebuffer and clears what this frame redraws to clearColor. The
+// panes' clips are worked out by drawTakeDirty.
+void drawBeginFrame(float clearColor[4]) {
+    if (showDamage < 0) showDamage = getenv("MCODE_SHOW_DAMAGE") != NULL;
+
+    if (ensureFrameTarget()) {
+        int screen[4] = {0, 0, screenWidth, screenHeight};
+        for (int i = 0; i < PANE_COUNT; i++) memcpy(frameClips[i], screen, sizeof(screen));
+    }
+
+    frameTarget = (frameFbo && frameW == screenWidth && frameH == screenHeight) ? frameFbo : 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, frameTarget);
+
+    drawClearScissor();
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glEnable(GL_SCISSOR_TEST);
+    for (int i = 0; i < PANE_COUNT; i++) {
+        const int* r = frameClips[i];
+        if (rectEmpty(r)) continue;
+
+        glScissor(r[0], screenHeight - r[3], r[2] - r[0], r[3] - r[1]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        frameStats.fillPixels += (r[2] - r[0]) * (r[3] - r[1]);
+    }
+    glDisable(GL_SCISSOR_TEST);
+
+    // Nothing is drawn until a pane is begun.
+    clipFull = 0;
+    memset(clipRect, 0, sizeof(clipRect));
+    scissorEnabled = 0;
+    drawClearScissor();
+}
+
+// Keeps what is drawn from now on inside the part of pane that this frame redraws.
+void drawBeginPane(int pane) {
+    int i = paneIndex(pane);
+    if (i < 0) return;
+
+    const int* r = frameClips[i];
+    if (rectEmpty(r)) {
+        memset(clipRect, 0, sizeof(clipRect));
+    } else {
+        clipRect[0] = r[0];
+        clipRect[1] = screenHeight - r[3];
+        clipRect[2] = r[2] - r[0];
+        clipRect[3] = r[3] - r[1];
+    }
+    drawClearScissor();
+}
+
+static void drawDamageOverlay() {
+    float tint[4] = {1.0f, 0.0f, 1.0f, 0.3f};
+    int drawn = 0;
+
+    for (int i = 0; i < PANE_COUNT; i++) {
+        const int* r = frameClips[i];
+        if (rectEmpty(r)) continue;
+
+        float v[] = {
+            pxToNDC_X(r[0]), pxToNDC_Y(r[1]), 0.0f,
+            pxToNDC_X(r[2]), pxToNDC_Y(r[1]), 0.0f,
+            pxToNDC_X(r[2]), pxToNDC_Y(r[3]), 0.0f,
+            pxToNDC_X(r[0]), pxToNDC_Y(r[3]), 0.0f
+        };
+        drawRectangle(v, sizeof(v), tint);
+        drawn = 1;
+    }
+    drawFlush();
+
+    if (drawn) {
+        flashShown = 1;
+        flashUntil = glfwGetTime() + DAMAGE_FLASH_SECONDS;
+    }
+}
+
+// Copies the retained frame to the window, which is left bound, and tints the redrawn
+// areas on top when the damage overlay is on.
+void drawEndFrame() {
+    drawSetOffset(0.0f, 0.0f);
+    drawFlush();
+
+    clipFull = 1;
+    drawClearScissor();
+
+    if (frameTarget) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, frameTarget);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, frameW, frameH, 0, 0, frameW, frameH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        frameTarget = 0;
+    }
+
+    if (showDamage > 0) drawDamageOverlay();
+
+    for (int i = 0; i < PANE_COUNT; i++) memset(frameClips[i], 0, sizeof(frameClips[i]));
+    fillTotal += frameStats.fillPixels;
+    screenTotal += (double)screenWidth * screenHeight;
+
+    batchTotal += frameStats.batches;
+    if (frameStats.batches > batchMax) batchMax = frameStats.batches;
+
+    lastFrameStats = frameStats;
+    memset(&frameStats, 0, sizeof(frameStats));
+    frameCounters.rendered++;
+}
+
+DrawFrameStats drawGetFrameStats() {
+    return lastFrameStats;
+}
+
+// Reports frames drawn and skipped, batches per frame, redraw area and how the instance
+// stream fared, and frees the GL objects; the GL context must still be current.
+void drawShutdown() {
+    printf("Frames: %lu rendered, %lu skipped with nothing to redraw\n", frameCounters.rendered, frameCounters.skipped);
+    if (frameCounters.rendered > 0) {
+        printf("Batches per frame: %.1f on average, %d at most, %d in the last frame\n",
+               (double)batchTotal / frameCounters.rendered, batchMax, lastFrameStats.batches);
+    }
+    if (screenTotal > 0) printf("Partial redraw: %.1f%% of the window's pixels filled over %lu frames\n", 100.0 * fillTotal / screenTotal, frameCounters.rendered);
+    if (frameFbo) {
+        glDeleteFramebuffers(1, &frameFbo);
+        glDeleteRenderbuffers(1, &frameColor);
+        frameFbo = 0;
+        frameColor = 0;
+    }
+
+    if (!textBuffersInitialized) return;
+
+    StreamStats s = instanceStream.stats;
+    printf("Instance stream (%s): %lu uploads, %lu stalls avoided, %lu fence waits, %lu orphans\n",
+           instanceStream.persistent ? "persistent" : "orphaning", s.uploads, s.stallsAvoided, s.waits, s.orphans);
+    streamFree(&instanceStream);
+}
+
+// Damages the given panes whole.
+void drawMarkDirty(int panes) {
+    dirtyPanes |= panes;
+}
+
+// Damages a rect of one pane, in top-left pixels. A pane's damage is kept as the box
+// around everything reported for it.
+void drawDamage(int pane, int x, int y, int w, int h) {
+    int i = paneIndex(pane);
+    if (i < 0 || w <= 0 || h <= 0) return;
+
+    int r[4] = {x, y, x + w, y + h};
+    rectUnion(paneDamage[i], r);
+    damagePanes |= pane;
+}
+
+int drawIsDirty() {
+    return (dirtyPanes | damagePanes) != 0;
+}
+
+// Returns the panes damaged since the last call and turns their damage into the clips the
+// next frame redraws.
+int drawTakeDirty() {
+    int panes = dirtyPanes | damagePanes;
+    int screen[4] = {0, 0, screenWidth, screenHeight};
+    int bounds[PANE_COUNT][4];
+
+    for (int i = 0; i < PANE_COUNT; i++) {
+        paneBounds(i, PANE_MARGIN, bounds[i]);
+        if (dirtyPanes & (1 << i)) memcpy(frameClips[i], bounds[i], sizeof(bounds[i]));
+        else memcpy(frameClips[i], paneDamage[i], sizeof(paneDamage[i]));
+        rectIntersect(frameClips[i], frameClips[i], screen);
+        memset(paneDamage[i], 0, sizeof(paneDamage[i]));
+    }
+
+    // A cleared pixel has to be painted again by every pane that paints there, so each pane
+    // also redraws the part of the others' clips inside its bounds, until no clip grows.
+    int grew = 1;
+    while (grew) {
+        grew = 0;
+        for (int i = 0; i < PANE_COUNT; i++) {
+            for (int j = 0; j < PANE_COUNT; j++) {
+                int part[4];
+                if (i == j || rectEmpty(frameClips[j])) continue;
+                rectIntersect(part, frameClips[j], bounds[i]);
+                if (rectEmpty(part) || rectContains(frameClips[i], part)) continue;
+
+                rectUnion(frameClips[i], part);
+                grew = 1;
+            }
+        }
+    }
+
+    dirtyPanes = 0;
+    damagePanes = 0;
+    return panes;
+}
+
+void drawToggleDamageOverlay() {
+    showDamage = !(showDamage > 0);
+}
+
+// Asks for the frame to be shown again once the damage overlay has been up long enough.
+// Returns the seconds until that is due.
+double drawDamageFlashTick(double now) {
+    if (!flashShown) return 1.0;
+    if (now < flashUntil) return flashUntil - now;
+
+    flashShown = 0;
+    dirtyPanes |= DIRTY_PRESENT;
+    return 1.0;
+}
+
+void drawCountSkippedFrame() {
+    frameCounters.skipped++;
+}
+
+FrameCounters drawGetFrameCounters() {
+    return frameCounters;
+}
+
+// Adds glyphs written past the end of the batch to it.
+static void batchCommit(int count) {
+    batchCount += count;
+    batchGlyphs += count;
+    frameStats.quads += count;
+}
+
+static float renderTextRun(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, int len, float x, float y, int screenWidth, int screenHeight, float scale, float r, float g, float b, float a) {
+    if (len <= 0) return x;
 
     x = FLOORF(x);
     y = FLOORF(y);
 
-    int len = (int)strlen(text);
-    int offset = 0;
+    // Pens are sent as int16, so lines far off screen are not drawn at all.
+    if (y < -1024.0f || y > screenHeight + 1024.0f) return x;
+
+    if (scale != batchScale) {
+        if (batchGlyphs > 0) drawFlush();
+        batchScale = scale;
+    }
+    int colorIndex = paletteIndex(r, g, b, a);
+
+    const unsigned char* s = (const unsigned char*)text;
+    GlyphInstance* out = NULL;
+    int count = 0;
+
+    for (int i = 0; i < len; ) {
+        unsigned int c = s[i];
+        const stbtt_bakedchar* glyph;
+        unsigned short id;
+        int page = 0;
+        GLuint tex = fontTex;
+
+        if (c < 128) {
+            i++;
+            if (c < 32) continue;
+            glyph = &cdata[c - 32];
+            id = (unsigned short)(c - 32);
+        } else {
+            // The atlas may flush the batch to free a page, so what is written so far is
+            // committed first.
+            batchCommit(count);
+            count = 0;
+            out = NULL;
+
+            i += utf8Decode(s + i, len - i, &c);
+            const AtlasGlyph* ag = atlasGlyph(&fontAtlas, c);
+            if (!ag) continue;
+            glyph = &ag->quad;
+            id = ag->id;
+            page = ag->page;
+            tex = pageTexture(page);
+        }
+
+        float pen = x;
+        x += glyph->xadvance * scale;
+        if (glyph->x1 == glyph->x0 || x < 0.0f) continue;
+        if (pen > screenWidth) break;
+
+        if (tex != batchTexture) {
+            batchCommit(count);
+            count = 0;
+            out = NULL;
 
-    while (offset < len) {
-        int count = len - offset;
-        if (count > MAX_TEXT_CHARS)
-            count = MAX_TEXT_CHARS;
+            drawFlush();
+            batchTexture = tex;
+        }
+
+        // Room for this glyph and every byte after it is taken at once.
+        if (!out) {
+            out = batchReserve(len - i + 1);
+            if (!out) break;
+        }
 
-        renderTextChunk(fontTex, cdata, text + offset, count, x, y, screenWidth, screenHeight, scale, r, g, b, a);
-        offset += count;
+        GlyphInstance* inst = &out[count++];
+        inst->x = (short)floorf(pen + 0.5f);
+        inst->y = (short)y;
+        inst->glyph = id;
+        inst->palette = (unsigned char)colorIndex;
+        inst->page = (unsigned char)page;
     }
 
+    batchCommit(count);
+    return x;
+}
+
+int renderText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, float x, float y, int screenWidth, int screenHeight, float scale, float r, float g, float b, float a) {
+    if (!text || !*text) return 0;
+
+    renderTextRun(fontTex, cdata, text, (int)strlen(text), x, y, screenWidth, screenHeight, scale, r, g, b, a);
     return 0;
 }
 
-static const char* solidVS =
-    "#version 330 core\n"
-    "layout(location=0) in vec3 aPos;\n"
-    "void main(){ gl_Position = vec4(aPos,1.0); }\n";
+float renderHighlightedText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, const HighlightSpan* spans, int spanCount, const float palette[][4], float x, float y, int screenW, int screenH, float scale) {
+    if (!text) return x;
 
-static const char* solidFS =
-    "#version 330 core\n"
-    "uniform vec4 uColor;\n"
-    "out vec4 FragColor;\n"
-    "void main(){ FragColor = uColor; }\n";
+    for (int i = 0; i < spanCount; i++) {
+        const float* c = palette[spans[i].palette];
+        x = renderTextRun(fontTex, cdata, text + spans[i].start, spans[i].length, x, y, screenW, screenH, scale, c[0], c[1], c[2], c[3]);
+    }
 
-static void ensureSolidProgram() {
-    if (solidProgram) return;
-    GLuint vs = compileShaderChecked(solidVS, GL_VERTEX_SHADER);
-    GLuint fs = compileShaderChecked(solidFS, GL_FRAGMENT_SHADER);
-    solidProgram = linkProgramChecked(vs, fs);
+    return x;
 }
 
-static void initSolidBuffersOnce() {
-    if (solidVAO) return;
-
-    glGenVertexArrays(1, &solidVAO);
-    glGenBuffers(1, &solidVBO);
+// Lays out spans of text into run with the pen starting at (x, y), all glyphs together, as
+// renderHighlightedText would draw them. Returns 0 if the atlas or palette had to start
+// over twice while doing so, in which case the run is left empty.
+int textRunBuild(TextRun* run, unsigned int key, const char* text, const HighlightSpan* spans, int spanCount, const float palette[][4], float scale, int x, int y) {
+    run->key = 0;
+    run->count = 0;
 
-    glBindVertexArray(solidVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, solidVBO);
+    int length = 0;
+    for (int i = 0; i < spanCount; i++) {
+        if (spans[i].start + spans[i].length > length) length = spans[i].start + spans[i].length;
+    }
+    if (length > run->capacity) {
+        GlyphInstance* grown = realloc(run->glyphs, (size_t)length * sizeof(GlyphInstance));
+        if (!grown) return 0;
+        run->glyphs = grown;
+        run->capacity = length;
+    }
 
-    glBufferData(GL_ARRAY_BUFFER, 6 * 3 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        unsigned int generation = runGeneration;
+        unsigned char colors[HL_PALETTE_COUNT];
+        for (int k = 0; k < HL_PALETTE_COUNT; k++) colors[k] = (unsigned char)paletteIndex(palette[k][0], palette[k][1], palette[k][2], palette[k][3]);
+
+        const unsigned char* s = (const unsigned char*)text;
+        float pen = (float)x;
+        int count = 0;
+        int mixedPages = 0;
+
+        for (int k = 0; k < spanCount; k++) {
+            int end = spans[k].start + spans[k].length;
+            for (int i = spans[k].start; i < end; ) {
+                unsigned int c = s[i];
+                const stbtt_bakedchar* glyph;
+                unsigned short id;
+                int page = 0;
+
+                if (c < 128) {
+                    i++;
+                    if (c < 32) continue;
+                    glyph = &cdata[c - 32];
+                    id = (unsigned short)(c - 32);
+                } else {
+                    i += utf8Decode(s + i, end - i, &c);
+                    const AtlasGlyph* ag = atlasGlyph(&fontAtlas, c);
+                    if (!ag) continue;
+                    glyph = &ag->quad;
+                    id = ag->id;
+                    page = ag->page;
+                }
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+                float left = pen;
+                pen += glyph->xadvance * scale;
+                if (glyph->x1 == glyph->x0) continue;
+
+                GlyphInstance* inst = &run->glyphs[count++];
+                inst->x = (short)floorf(left + 0.5f);
+                inst->y = (short)y;
+                inst->glyph = id;
+                inst->palette = colors[spans[k].palette];
+                inst->page = (unsigned char)page;
+                if (page != run->glyphs[0].page) mixedPages = 1;
+            }
+        }
 
-    glBindVertexArray(0);
+        if (generation != runGeneration) continue;
+
+        run->key = key;
+        run->count = count;
+        run->generation = generation;
+        run->scale = scale;
+        run->palette = palette;
+        run->x = x;
+        run->y = y;
+        run->mixedPages = mixedPages;
+        frameStats.runsBuilt++;
+        return 1;
+    }
+    return 0;
+}
 
-    ensureSolidProgram();
-    solidColorLoc = glGetUniformLocation(solidProgram, "uColor");
+// Whether run still holds key laid out at scale in palette's colors.
+int textRunValid(const TextRun* run, unsigned int key, float scale, const float palette[][4]) {
+    return key && run->key == key && run->generation == runGeneration && run->scale == scale && run->palette == palette;
 }
 
-void drawTriangle(float vertices[], size_t size, float color[4]) {
-    initSolidBuffersOnce(); // lazy init
+// Adds a built run to the batch with its pen at (x, y). Runs are normally drawn where they
+// were built, making this a copy; any other pen moves the stored glyphs there first.
+void drawTextRun(TextRun* run, int x, int y) {
+    if (run->count == 0) return;
+
+    if (x != run->x || y != run->y) {
+        short dx = (short)(x - run->x);
+        short dy = (short)(y - run->y);
+        for (int i = 0; i < run->count; i++) {
+            run->glyphs[i].x += dx;
+            run->glyphs[i].y += dy;
+        }
+        run->x = x;
+        run->y = y;
+    }
 
-    glUseProgram(solidProgram);
-    if (solidColorLoc != -1) {
-        glUniform4f(solidColorLoc, color[0], color[1], color[2], color[3]);
+    if (run->scale != batchScale) {
+        if (batchGlyphs > 0) drawFlush();
+        batchScale = run->scale;
     }
 
-    glBindVertexArray(solidVAO);
+    for (int start = 0; start < run->count; ) {
+        int page = run->glyphs[start].page;
+        int end = run->count;
+        if (run->mixedPages) {
+            end = start + 1;
+            while (end < run->count && run->glyphs[end].page == page) end++;
+        }
 
-    glBindBuffer(GL_ARRAY_BUFFER, solidVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices);
+        GLuint tex = pageTexture(page);
+        if (tex != batchTexture) {
+            drawFlush();
+            batchTexture = tex;
+        }
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+        GlyphInstance* out = batchReserve(end - start);
+        if (!out) return;
+        memcpy(out, &run->glyphs[start], (size_t)(end - start) * sizeof(GlyphInstance));
+        batchCommit(end - start);
+        start = end;
+    }
+    frameStats.runsReused++;
+}
 
-    glBindVertexArray(0);
-    glUseProgram(0);
+// The run slot for key. Slots are direct-mapped, so a key can push out another one that
+// hashes to the same slot; the caller checks textRunValid and builds when it is not.
+TextRun* textRunSlot(TextRunCache* cache, unsigned int key) {
+    if (!cache->runs) {
+        cache->runs = calloc(TEXT_RUN_SLOTS, sizeof(TextRun));
+        if (!cache->runs) return NULL;
+    }
+    return &cache->runs[(key * 2654435761u) >> (32 - TEXT_RUN_SLOT_BITS)];
 }
 
+void textRunCacheFree(TextRunCache* cache) {
+    if (cache->runs) {
+        for (int i = 0; i < TEXT_RUN_SLOTS; i++) free(cache->runs[i].glyphs);
+    }
+    free(cache->runs);
+    cache->runs = NULL;
+}
+
+// Takes the four corners of an axis-aligned rect in NDC and batches it as one instance.
 void drawRectangle(float vertices[], size_t size, float color[4]) {
-    float triA[] = {
-        vertices[0], vertices[1], vertices[2],
-        vertices[3], vertices[4], vertices[5],
-        vertices[6], vertices[7], vertices[8],
-    };
-    float triB[] = {
-        vertices[0],  vertices[1],  vertices[2],
-        vertices[6],  vertices[7],  vertices[8],
-        vertices[9],  vertices[10], vertices[11]
-    };
-    drawTriangle(triA, sizeof(triA), color);
-    drawTriangle(triB, sizeof(triB), color);
+    float x0 = vertices[0], y0 = vertices[1], x1 = x0, y1 = y0;
+    for (int i = 1; i < 4; i++) {
+        x0 = fminf(x0, vertices[i * 3]);
+        x1 = fmaxf(x1, vertices[i * 3]);
+        y0 = fminf(y0, vertices[i * 3 + 1]);
+        y1 = fmaxf(y1, vertices[i * 3 + 1]);
+    }
+
+    // Back to pixels, top-left first.
+    float left = floorf((x0 + 1.0f) * 0.5f * screenWidth + 0.5f);
+    float right = floorf((x1 + 1.0f) * 0.5f * screenWidth + 0.5f);
+    float top = floorf((1.0f - y1) * 0.5f * screenHeight + 0.5f);
+    float bottom = floorf((1.0f - y0) * 0.5f * screenHeight + 0.5f);
+    if (right <= left || bottom <= top) return;
+
+    int colorIndex = paletteIndex(color[0], color[1], color[2], color[3]);
+    if (batchRectCount == BATCH_MAX_RECTS) drawFlush();
+
+    if (batchRectCount == batchRectCapacity) {
+        int cap = batchRectCapacity ? batchRectCapacity * 2 : 256;
+        float* grown = realloc(batchRects, (size_t)cap * 2 * sizeof(float));
+        if (!grown) return;
+        batchRects = grown;
+        batchRectCapacity = cap;
+    }
+
+    GlyphInstance* inst = batchReserve(1);
+    if (!inst) return;
+
+    batchRects[batchRectCount * 2] = right - left;
+    batchRects[batchRectCount * 2 + 1] = bottom - top;
+    inst->x = (short)left;
+    inst->y = (short)top;
+    inst->glyph = (unsigned short)(BATCH_RECT_ID + batchRectCount);
+    inst->palette = (unsigned char)colorIndex;
+    inst->page = 0;
+
+    batchRectCount++;
+    batchCount++;
+    frameStats.quads++;
 }
 
 const char* readFile(const char* path) {
@@ -423,6 +1275,9 @@ int renderButton(const char* label, float x, float y, float width, float height,
 
     if (mouseClicked && !prevMouseDown && inside) clicked = 1;
 
+    // Whatever the click changes only shows up on the next frame.
+    if (clicked) drawMarkDirty(DIRTY_ALL);
+
     if (inside) {
         float bgColor[4] = { mouseClicked ? 1.0f : 0.8f, 0.0f, 0.0f, 1.0f };
         float vertices[] = {
@@ -450,142 +1305,19 @@ int isDirectory(const char *path) {
     return (attrib & FILE_ATTRIBUTE_DIRECTORY) != 0;
 }
 
-char* preprocessText(const char* text) {
-    const char* green  = "[color=#00FF00]";
-    const char* grey   = "[color=#424242]";
-    const char* red    = "[color=#FF0000]";
-    const char* purple = "[color=#800080]";
-
-    const char* usual = (mode == 2 || mode == 3) ? "[color=#FFFFFF]" : "[color=#000000]";
-
-    const char* redWords[]    = {"and", "or", "if", "else", "true", "false", "null", NULL};
-    const char* purpleWords[] = {"class", "for", "def", "return", "super", "this", "int", "while", NULL};
-
-    int inQuotes = 0;
-    int inComment = 0;
-
-    size_t len = strlen(text);
-
-    size_t maxTag = strlen(green);
-    if (strlen(usual) > maxTag)  maxTag = strlen(usual);
-    if (strlen(grey) > maxTag)   maxTag = strlen(grey);
-    if (strlen(red) > maxTag)    maxTag = strlen(red);
-    if (strlen(purple) > maxTag) maxTag = strlen(purple);
-
-    size_t maxLen = len * (maxTag + 8);
-    char* newText = malloc(maxLen);
-    if (!newText) return NULL;
-
-    size_t j = 0;
-    for (size_t i = 0; i < len;) {
-        char c = text[i];
-
-        if (!inComment && i + 1 < len && c == '/' && text[i+1] == '/') {
-            strcpy(&newText[j], green);
-            j += strlen(green);
-            newText[j++] = '/';
-            newText[j++] = '/';
-            inComment = 1;
-            i += 2;
-        } else if (inComment) {
-            if (c == '\n') {
-                strcpy(&newText[j], usual);
-                j += strlen(usual);
-                newText[j++] = '\n';
-                inComment = 0;
-                i++;
-            } else {
-                newText[j++] = c;
-                i++;
-            }
-        } else if (c == '"') {
-            if (!inQuotes) {
-                strcpy(&newText[j], green);
-                j += strlen(green);
-                newText[j++] = '"';
-                inQuotes = 1;
-            } else {
-                newText[j++] = '"';
-                strcpy(&newText[j], usual);
-                j += strlen(usual);
-                inQuotes = 0;
-            }
-            i++;
-        } else if (c == '(' || c == ')' || c == '{' || c == '}' || c == ';' || c == '+' || c == '-' || c == '=' || c == '*') {
-            strcpy(&newText[j], grey);
-            j += strlen(grey);
-            newText[j++] = c;
-            strcpy(&newText[j], usual);
-            j += strlen(usual);
-            i++;
-        } else if (isalpha(c)) {
-            char word[128];
-            size_t k = 0;
-            while (i < len && (isalnum(text[i]) || text[i] == '_')) {
-                if (k < sizeof(word) - 1)
-                    word[k++] = text[i];
-                i++;
-            }
-            word[k] = '\0';
-
-            int isRed = 0, isPurple = 0;
-            for (int r = 0; redWords[r]; r++) {
-                if (strcmp(word, redWords[r]) == 0) { isRed = 1; break; }
-            }
-            for (int p = 0; purpleWords[p]; p++) {
-                if (strcmp(word, purpleWords[p]) == 0) { isPurple = 1; break; }
-            }
-
-            if (isRed) {
-                strcpy(&newText[j], red);
-                j += strlen(red);
-                strcpy(&newText[j], word);
-                j += strlen(word);
-                strcpy(&newText[j], usual);
-                j += strlen(usual);
-            } else if (isPurple) {
-                strcpy(&newText[j], purple);
-                j += strlen(purple);
-                strcpy(&newText[j], word);
-                j += strlen(word);
-                strcpy(&newText[j], usual);
-                j += strlen(usual);
-            } else {
-    			strcpy(&newText[j], usual);
-    			j += strlen(usual);
-    			strcpy(&newText[j], word);
-    			j += strlen(word);
-			}
-        } else {
-            newText[j++] = c;
-            i++;
-        }
-    }
-
-    if (inComment) {
-        strcpy(&newText[j], usual);
-        j += strlen(usual);
-    }
-
-    newText[j] = '\0';
-    return newText;
-}
-
-void saveFile(const char* path, char** lines) {
-    if (!path) printf("saveFile: path is NULL\n");
-    if (!lines) printf("saveFile: lines is NULL\n");
-    FILE* f = fopen(path, "w");
+void saveFile(const char* path, const Document* doc) {
+    if (!path) { printf("saveFile: path is NULL\n"); return; }
+    if (!doc) { printf("saveFile: document is NULL\n"); return; }
+    FILE* f = fopen(path, "wb");
     if (!f) return;
 
-    for (int i = 0; lines[i]; i++) {
-        fprintf(f, "%s\n", lines[i]);
-    }
+    if (!docWrite(doc, f)) printf("saveFile: failed to write %s\n", path);
 
     fclose(f);
 }
 
-void saveFileAs(char** lines) {
-    if (!lines) return;
+void saveFileAs(const Document* doc) {
+    if (!doc) return;
 
     char filePath[MAX_PATH] = {0};
 
@@ -616,14 +1348,7 @@ void saveFileAs(char** lines) {
         strcat(filePath, ext);
     }
 
-    FILE* f = fopen(filePath, "w");
-    if (!f) return;
-
-    for (int i = 0; lines[i]; i++) {
-        fprintf(f, "%s\n", lines[i]);
-    }
-
-    fclose(f);
+    saveFile(filePath, doc);
 }
 
 char* newFile() {
@@ -697,150 +1422,22 @@ void openFolder() {
 float getTextWidth(stbtt_bakedchar* cdata, const char* text, float scale) {
     float width = 0.0f;
 
-    for (const char* p = text; *p; p++) {
-        unsigned char c = (unsigned char)*p;
-
-        if (c < 32 || c >= 128) {
-            c = 'e';
-        }
-
-        width += cdata[c - 32].xadvance * scale;
-    }
-
-    return width;
-}
-
-float getTextWidthRange(stbtt_bakedchar* cdata, const char* text, int count, float scale) {
-    float width = 0.0f;
-
-    for (int i = 0; i < count && text[i]; i++) {
-        stbtt_bakedchar* b = &cdata[(int)text[i] - 32];
-        width += b->xadvance * scale;
-    }
-
-    return width;
-}
-
-static void parse_hex_to_rgb(const char* s, float* r, float* g, float* b, float* a) {
-    *r = *g = *b = 1.0f;
-    *a = 1.0f;
-    if (!s) return;
-    if (s[0] == '#') s++;
-    if (strlen(s) < 6) return;
-    unsigned int v = 0;
-    if (sscanf(s, "%6x", &v) == 1) {
-        unsigned int rv = (v >> 16) & 0xFF;
-        unsigned int gv = (v >> 8) & 0xFF;
-        unsigned int bv = (v >> 0) & 0xFF;
-        *r = rv / 255.0f;
-        *g = gv / 255.0f;
-        *b = bv / 255.0f;
-        *a = 1.0f;
-    }
-}
-
-float renderColoredText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, float x, float y, int screenW, int screenH, float scale) {
-    if (!text) return x;
-
-    float r = 1.0f, g = 1.0f, b = 1.0f, a = 1.0f;
-    const char* p = text;
-    const char* chunkStart = p;
-
-    while (*p) {
-        if (*p == '[') {
-            if (strncmp(p, "[color=", 7) == 0) {
-                const char* colorStart = p + 7;
-                const char* end = strchr(colorStart, ']');
-                if (!end) { p++; continue; }
-
-                if (p > chunkStart) {
-                    size_t len = (size_t)(p - chunkStart);
-                    char* chunk = (char*)malloc(len + 1);
-                    if (!chunk) return x;
-                    memcpy(chunk, chunkStart, len);
-                    chunk[len] = '\0';
-                    renderText(fontTex, cdata, chunk, x, y, screenW, screenH, scale, r, g, b, a);
-                    x += getTextWidth((stbtt_bakedchar*)cdata, chunk, scale);
-                    free(chunk);
-                }
-
-                size_t colorLen = (size_t)(end - colorStart);
-                char colorBuf[32];
-                if (colorLen >= sizeof(colorBuf)) colorLen = sizeof(colorBuf) - 1;
-                memcpy(colorBuf, colorStart, colorLen);
-                colorBuf[colorLen] = '\0';
-
-                if (strcmp(colorBuf, "#") == 0) {
-                    r = g = b = 1.0f;
-                    a = 1.0f;
-                } else {
-                    parse_hex_to_rgb(colorBuf, &r, &g, &b, &a);
-                }
-
-                p = end + 1;
-                chunkStart = p;
-                continue;
-            } else if (p[1] == '#') {
-                const char* colorStart = p + 1;
-                const char* end = strchr(colorStart, ']');
-                if (!end) { p++; continue; }
-
-                if (p > chunkStart) {
-                    size_t len = (size_t)(p - chunkStart);
-                    char* chunk = (char*)malloc(len + 1);
-                    if (!chunk) return x;
-                    memcpy(chunk, chunkStart, len);
-                    chunk[len] = '\0';
-                    renderText(fontTex, cdata, chunk, x, y, screenW, screenH, scale, r, g, b, a);
-                    x += getTextWidth((stbtt_bakedchar*)cdata, chunk, scale);
-                    free(chunk);
-                }
-
-                size_t colorLen = (size_t)(end - colorStart);
-                char colorBuf[32];
-                if (colorLen >= sizeof(colorBuf)) colorLen = sizeof(colorBuf) - 1;
-                memcpy(colorBuf, colorStart, colorLen);
-                colorBuf[colorLen] = '\0';
+    const unsigned char* s = (const unsigned char*)text;
+    int len = (int)strlen(text);
 
-                if (strcmp(colorBuf, "#") == 0) {
-                    r = g = b = 1.0f; a = 1.0f;
-                } else {
-                    parse_hex_to_rgb(colorBuf, &r, &g, &b, &a);
-                }
+    for (int i = 0; i < len; ) {
+        unsigned int c = s[i];
 
-                p = end + 1;
-                chunkStart = p;
-                continue;
-            }
+        if (c < 128) {
+            i++;
+            if (c >= 32) width += cdata[c - 32].xadvance * scale;
+        } else {
+            i += utf8Decode(s + i, len - i, &c);
+            width += atlasAdvance(&fontAtlas, c) * scale;
         }
-        p++;
     }
 
-    if (p > chunkStart) {
-        size_t len = (size_t)(p - chunkStart);
-        char* chunk = (char*)malloc(len + 1);
-        if (!chunk) return x;
-        memcpy(chunk, chunkStart, len);
-        chunk[len] = '\0';
-        renderText(fontTex, cdata, chunk, x, y, screenW, screenH, scale, r, g, b, a);
-        x += getTextWidth((stbtt_bakedchar*)cdata, chunk, scale);
-        free(chunk);
-    }
-
-    return x;
-}
-
-void normalizeSelection(const TextSelection* sel, int* sl, int* sc, int* el, int* ec) {
-    *sl = sel->startLine;
-    *sc = sel->startCol;
-    *el = sel->endLine;
-    *ec = sel->endCol;
-
-    if (*sl > *el || (*sl == *el && *sc > *ec)) {
-        int tl = *sl, tc = *sc;
-        *sl = *el; *sc = *ec;
-        *el = tl;  *ec = tc;
-    }
+    return width;
 }
 
 static inline void selectionSet(TextSelection* s, int sl, int sc, int el, int ec) {
@@ -922,31 +1519,8 @@ void drawSelectionRect(float x1, float y1, float x2, float y2, float color[4]) {
     drawRectangle(verts, sizeof(verts), color);
 }
 
-int caretIndexFromMouse(const char* text, float mouseX) {
-    if (!text || !*text) return 0;
-
-    float x = 0.0f;
-    int index = 0;
-
-    for (const char* p = text; *p; p++) {
-        int c = (unsigned char)*p;
-
-        if (c < 32 || c > 126) continue;
-
-        stbtt_bakedchar* b = &cdata[c - 32];
-        float advance = b->xadvance;
-
-        if (mouseX < x + advance * 0.5f) return index;
-
-        x += advance;
-        index++;
-    }
-
-    return index;
-}
-
 void resetGLState() {
-    glDisable(GL_SCISSOR_TEST);
+    drawClearScissor();
     glDisable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
@@ -6,23 +6,17 @@
 #include <stddef.h>
 #include <FreeType/stb_truetype.h>
 
-#define BITMAP_W 512
-#define BITMAP_H 512
+#include "document.h"
+#include "highlight.h"
+#include "edit.h"
+#include "atlas.h"
+#include "stream.h"
+
 #define EXPLORER_RATIO 0.3f
-#define MAX_TEXT_CHARS 8192
-#define MAX_VERTEX_BUFFER_SIZE (MAX_TEXT_CHARS * 6 * 9)
 #define FLOORF(x) ((float)((int)(x)))
-#define MAX_LINE_LEN 4096
-
-static float persistentVertexBuffer[MAX_VERTEX_BUFFER_SIZE];
-static int caretLine = 0;
-static int caretCol = 0;
-static int caretMoved = 0;
-static int lineCount = 0;
-static int lineCapacity = 0;
 
 extern stbtt_bakedchar cdata[96];
-extern unsigned char fontBitmap[BITMAP_W * BITMAP_H];
+extern FontAtlas fontAtlas;
 extern GLuint fontTexture;
 extern int fontLoaded;
 extern int shiftHeld;
@@ -43,13 +37,67 @@ typedef enum {
 	FOCUS_EXPLORER
 } InputFocus;
 
+// Counters for the last finished frame; batches is the number of draw calls issued and
+// uploadBytes what was sent to the GPU for them. runsBuilt counts TextRuns laid out again
+// and runsReused the ones drawn. fillPixels is the area cleared and redrawn.
+typedef struct {
+    int batches;
+    int quads;
+    int uploadBytes;
+    int runsBuilt;
+    int runsReused;
+    int fillPixels;
+} DrawFrameStats;
+
+// One glyph or rect as the GPU sees it: the top-left pen position in pixels, a glyph id (or
+// a rect from BATCH_RECT_ID up) and a palette index. page says which atlas texture the glyph
+// is on; the shader does not read it.
+typedef struct {
+    short x;
+    short y;
+    unsigned short glyph;
+    unsigned char palette;
+    unsigned char page;
+} GlyphInstance;
+
+// Glyphs of one piece of highlighted text kept in the batch's own format, so text that has
+// not changed is copied into the batch instead of laid out again. key is the caller's
+// version stamp for the text and its spans; 0 is never valid.
+typedef struct {
+    unsigned int key;
+    unsigned int generation;
+    float scale;
+    const float (*palette)[4];
+    int x;
+    int y;
+    int mixedPages;
+    GlyphInstance* glyphs;
+    int count;
+    int capacity;
+} TextRun;
+
+#define TEXT_RUN_SLOT_BITS 10
+#define TEXT_RUN_SLOTS (1 << TEXT_RUN_SLOT_BITS)
+
 typedef struct {
-    int active;
-    int startLine;
-    int startCol;
-    int endLine;
-    int endCol;
-} TextSelection;
+    TextRun* runs;
+} TextRunCache;
+
+// Counts main-loop iterations that drew a frame versus ones that found nothing dirty.
+typedef struct {
+    unsigned long rendered;
+    unsigned long skipped;
+} FrameCounters;
+
+// Panes that need to be redrawn on the next frame.
+#define DIRTY_HOTBAR   0x1
+#define DIRTY_EXPLORER 0x2
+#define DIRTY_EDITOR   0x4
+#define DIRTY_CMD      0x8
+#define DIRTY_ALL      (DIRTY_HOTBAR | DIRTY_EXPLORER | DIRTY_EDITOR | DIRTY_CMD)
+
+// Nothing to redraw, but the retained frame has to be shown again.
+#define DIRTY_PRESENT  0x10
 
 static InputFocus g_focus = FOCUS_EDITOR;
 
@@ -57,9 +105,29 @@ float pxToNDC_X(int x);
 float pxToNDC_Y(int y);
 
 void initFont(int screenHeight);
+void fontShutdown();
 int renderText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, float x, float y, int screenWidth, int screenHeight, float scale, float r, float g, float b, float a);
 
-void drawTriangle(float vertices[], size_t size, float color[4]);
+void drawFlush();
+void drawSetScissor(int x, int y, int w, int h);
+void drawClearScissor();
+void drawBeginFrame(float clearColor[4]);
+void drawBeginPane(int pane);
+void drawEndFrame();
+void drawSetOffset(float x, float y);
+DrawFrameStats drawGetFrameStats();
+void drawShutdown();
+
+void drawMarkDirty(int panes);
+void drawDamage(int pane, int x, int y, int w, int h);
+int drawPaneAt(int x, int y);
+void drawToggleDamageOverlay();
+double drawDamageFlashTick(double now);
+int drawIsDirty();
+int drawTakeDirty();
+void drawCountSkippedFrame();
+FrameCounters drawGetFrameCounters();
+
 void drawRectangle(float vertices[], size_t size, float color[4]);
 
 char** readText(const char* text);
@@ -70,24 +138,23 @@ int isDirectory(const char *path);
 int renderButton(const char* label, float x, float y, float width, float height, int screenWidth, int screenHeight, int mouseX, int mouseY, int mouseClicked, float r, float g, float b, float a);
 void updateMouseState(int mouseClicked);
 
-char* preprocessText(const char* text);
-
-void saveFile(const char* path, char** lines);
-void saveFileAs(char** lines);
+void saveFile(const char* path, const Document* doc);
+void saveFileAs(const Document* doc);
 void openFolder();
 char* newFile();
 
 float getTextWidth(stbtt_bakedchar* cdata, const char* text, float scale);
-float getTextWidthRange(stbtt_bakedchar* cdata, const char* text, int count, float scale);
-static void parse_hex_to_rgb(const char* s, float* r, float* g, float* b, float* a);
-float renderColoredText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, float x, float y, int screenW, int screenH, float scale);
+int textRunBuild(TextRun* run, unsigned int key, const char* text, const HighlightSpan* spans, int spanCount, const float palette[][4], float scale, int x, int y);
+int textRunValid(const TextRun* run, unsigned int key, float scale, const float palette[][4]);
+void drawTextRun(TextRun* run, int x, int y);
+TextRun* textRunSlot(TextRunCache* cache, unsigned int key);
+void textRunCacheFree(TextRunCache* cache);
+float renderHighlightedText(GLuint fontTex, const stbtt_bakedchar* cdata, const char* text, const HighlightSpan* spans, int spanCount, const float palette[][4], float x, float y, int screenW, int screenH, float scale);
 
 static inline void selectionSet(TextSelection* s, int sl, int sc, int el, int ec);
-void normalizeSelection(const TextSelection* sel, int* sl, int* sc, int* el, int* ec);
 char* clipboardGetText();
 void clipboardSetText(const char* text);
 void drawSelectionRect(float x1, float y1, float x2, float y2, float color[4]);
-int caretIndexFromMouse(const char* text, float mouseX);
 
 void resetGLState();
 
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "edit.h"
+
+void editInit(EditState* e) {
+    memset(e, 0, sizeof(*e));
+    hlInit(&e->hl);
+    layoutInit(&e->layout);
+}
+
+void editFree(EditState* e) {
+    docFree(e->doc);
+    hlFree(&e->hl);
+    layoutFree(&e->layout);
+    editInit(e);
+}
+
+// Tells the highlighter and the layout cache that line changed and lineDelta lines were
+// inserted after it, or removed when negative.
+static void editChanged(EditState* e, int line, int lineDelta) {
+    hlEdit(&e->hl, e->doc, line, lineDelta);
+    layoutEdit(&e->layout, line, lineDelta);
+}
+
+// Column one character before (dir -1) or after (dir 1) col, stepping over the continuation
+// bytes of a UTF-8 sequence.
+static int stepColumn(EditState* e, int line, int col, int dir) {
+    int len;
+    const unsigned char* text = (const unsigned char*)docLine(e->doc, line, &len);
+
+    do col += dir; while (col > 0 && col < len && (text[col] & 0xC0) == 0x80);
+    return col;
+}
+
+// Column on toLine for Up and Down. With glyph advances set it is the one nearest the
+// caret's x, so the caret keeps its place over proportional and multi-byte text; without
+// them the byte column is kept, backed up to the start of a character.
+static int verticalColumn(EditState* e, int toLine) {
+    if (e->layout.advance[0] > 0.0f) {
+        float x = layoutX(&e->layout, e->doc, e->caretLine, e->caretCol);
+        return layoutHitTest(&e->layout, e->doc, toLine, x);
+    }
+
+    int len;
+    const unsigned char* text = (const unsigned char*)docLine(e->doc, toLine, &len);
+    int col = e->caretCol < len ? e->caretCol : len;
+    while (col > 0 && col < len && (text[col] & 0xC0) == 0x80) col--;
+    return col;
+}
+
+int editLoad(EditState* e, const char* text, size_t length) {
+    editFree(e);
+
+    e->doc = docCreate(text, length);
+    if (!e->doc) return 0;
+
+    hlReset(&e->hl, e->doc);
+    layoutReset(&e->layout, docLineCount(e->doc));
+    return 1;
+}
+
+// Takes a document built elsewhere (the background loader). Highlighting starts empty and is
+// filled in by hlContinue, so a large file is editable before it is fully lexed.
+void editAdopt(EditState* e, Document* doc) {
+    editFree(e);
+
+    e->doc = doc;
+    if (doc) {
+        hlResetLazy(&e->hl, doc);
+        layoutReset(&e->layout, docLineCount(doc));
+    }
+}
+
+void editBeginBatch(EditState* e) {
+    hlBeginBatch(&e->hl);
+}
+
+void editEndBatch(EditState* e) {
+    hlEndBatch(&e->hl, e->doc);
+}
+
+void selectionClear(TextSelection* sel) {
+    sel->active    = 0;
+    sel->startLine = 0;
+    sel->startCol  = 0;
+    sel->endLine   = 0;
+    sel->endCol    = 0;
+}
+
+void normalizeSelection(const TextSelection* sel, int* sl, int* sc, int* el, int* ec) {
+    *sl = sel->startLine;
+    *sc = sel->startCol;
+    *el = sel->endLine;
+    *ec = sel->endCol;
+
+    if (*sl > *el || (*sl == *el && *sc > *ec)) {
+        int tl = *sl, tc = *sc;
+        *sl = *el; *sc = *ec;
+        *el = tl;  *ec = tc;
+    }
+}
+
+void editDeleteSelection(EditState* e) {
+    int sl, sc, el, ec;
+    normalizeSelection(&e->sel, &sl, &sc, &el, &ec);
+
+    size_t start = docOffset(e->doc, sl, sc);
+    size_t end   = docOffset(e->doc, el, ec);
+    docDelete(e->doc, start, end - start);
+    editChanged(e, sl, sl - el);
+
+    e->caretLine = sl;
+    e->caretCol  = sc;
+
+    selectionClear(&e->sel);
+}
+
+// Returns the selected text as a new string, or NULL when nothing is selected.
+char* editCopySelection(EditState* e) {
+    if (!e->doc || !e->sel.active) return NULL;
+
+    int sl, sc, el, ec;
+    normalizeSelection(&e->sel, &sl, &sc, &el, &ec);
+
+    size_t start = docOffset(e->doc, sl, sc);
+    size_t end   = docOffset(e->doc, el, ec);
+
+    char* buf = malloc(end - start + 1);
+    if (!buf) return NULL;
+    buf[docCopy(e->doc, start, end - start, buf)] = '\0';
+    return buf;
+}
+
+void editInsertText(EditState* e, const char* text) {
+    if (!text || !*text || !e->doc) return;
+
+    if (e->sel.active) {
+        editDeleteSelection(e);
+    }
+
+    size_t len = strlen(text);
+    char* clean = malloc(len + 1);
+    if (!clean) return;
+
+    size_t n = 0;
+    for (const char* p = text; *p; p++) {
+        if (*p != '\r') clean[n++] = *p;
+    }
+
+    int startLine = e->caretLine;
+    docInsert(e->doc, docOffset(e->doc, e->caretLine, e->caretCol), clean, n);
+
+    for (size_t i = 0; i < n; i++) {
+        if (clean[i] == '\n') {
+            e->caretLine++;
+            e->caretCol = 0;
+        } else {
+            e->caretCol++;
+        }
+    }
+    free(clean);
+
+    editChanged(e, startLine, e->caretLine - startLine);
+}
+
+// Handles navigation and editing keys. Clipboard shortcuts are left to the caller, which
+// owns the clipboard.
+void editKeyDown(EditState* e, int key, int mods) {
+    if (!e->doc) return;
+
+    int lineCount = docLineCount(e->doc);
+    int lineLen = docLineLength(e->doc, e->caretLine);
+
+    if (key == GLFW_KEY_BACKSPACE && e->sel.active) {
+        editDeleteSelection(e);
+        return;
+    }
+
+    switch (key) {
+        case GLFW_KEY_LEFT:
+            if (e->caretCol > 0) {
+                e->caretCol = stepColumn(e, e->caretLine, e->caretCol, -1);
+            } else if (e->caretLine > 0) {
+                e->caretLine--;
+                e->caretCol = docLineLength(e->doc, e->caretLine);
+            }
+            selectionClear(&e->sel);
+            break;
+        case GLFW_KEY_RIGHT:
+            if (e->caretCol < lineLen) {
+                e->caretCol = stepColumn(e, e->caretLine, e->caretCol, 1);
+            } else if (e->caretLine + 1 < lineCount) {
+                e->caretLine++;
+                e->caretCol = 0;
+            }
+            selectionClear(&e->sel);
+            break;
+        case GLFW_KEY_UP:
+            if (e->caretLine > 0) {
+                e->caretCol = verticalColumn(e, e->caretLine - 1);
+                e->caretLine--;
+                e->caretMoved = 1;
+            }
+            selectionClear(&e->sel);
+            break;
+        case GLFW_KEY_DOWN:
+            if (e->caretLine + 1 < lineCount) {
+                e->caretCol = verticalColumn(e, e->caretLine + 1);
+                e->caretLine++;
+                e->caretMoved = 1;
+            }
+            selectionClear(&e->sel);
+            break;
+        case GLFW_KEY_BACKSPACE:
+            if (e->caretCol > 0) {
+                int col = stepColumn(e, e->caretLine, e->caretCol, -1);
+                docDelete(e->doc, docOffset(e->doc, e->caretLine, col), e->caretCol - col);
+                e->caretCol = col;
+                editChanged(e, e->caretLine, 0);
+            } else if (e->caretLine > 0) {
+                int prevLen = docLineLength(e->doc, e->caretLine - 1);
+                docDelete(e->doc, docLineStart(e->doc, e->caretLine) - 1, 1);
+                e->caretLine--;
+                e->caretCol = prevLen;
+                editChanged(e, e->caretLine, -1);
+            }
+            break;
+        case GLFW_KEY_ENTER:
+        case GLFW_KEY_KP_ENTER: {
+            docInsert(e->doc, docOffset(e->doc, e->caretLine, e->caretCol), "\n", 1);
+            editChanged(e, e->caretLine, 1);
+
+            e->caretLine++;
+            e->caretCol = 0;
+            break;
+        }
+    }
+
+    int maxLen = docLineLength(e->doc, e->caretLine);
+    if (e->caretCol < 0) e->caretCol = 0;
+    if (e->caretCol > maxLen) e->caretCol = maxLen;
+}
+
+void editCharInput(EditState* e, unsigned int codepoint) {
+    if (!e->doc) return;
+    if (codepoint < 32 || codepoint > 126) return;
+
+    char c = (char)codepoint;
+    docInsert(e->doc, docOffset(e->doc, e->caretLine, e->caretCol), &c, 1);
+    editChanged(e, e->caretLine, 0);
+    e->caretCol++;
+}
\ No newline at end of file
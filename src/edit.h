@@ -0,0 +1,48 @@
+#ifndef EDIT_H
+#define EDIT_H
+
+#include <stddef.h>
+
+#include "document.h"
+#include "highlight.h"
+#include "layout.h"
+
+typedef struct {
+    int active;
+    int startLine;
+    int startCol;
+    int endLine;
+    int endCol;
+} TextSelection;
+
+// Editing state with no GL or window-system dependencies: the document, its highlighting and
+// line layout, the caret and the selection. The editor pane owns one; mcode-bench drives one
+// headlessly.
+typedef struct {
+    Document* doc;
+    Highlighter hl;
+    LayoutCache layout;
+    int caretLine;
+    int caretCol;
+    int caretMoved;
+    TextSelection sel;
+} EditState;
+
+void editInit(EditState* e);
+void editFree(EditState* e);
+int editLoad(EditState* e, const char* text, size_t length);
+void editAdopt(EditState* e, Document* doc);
+
+void editBeginBatch(EditState* e);
+void editEndBatch(EditState* e);
+
+void editKeyDown(EditState* e, int key, int mods);
+void editCharInput(EditState* e, unsigned int codepoint);
+void editInsertText(EditState* e, const char* text);
+void editDeleteSelection(EditState* e);
+char* editCopySelection(EditState* e);
+
+void selectionClear(TextSelection* sel);
+void normalizeSelection(const TextSelection* sel, int* sl, int* sc, int* el, int* ec);
+
+#endif
\ No newline at end of file
@@ -1,13 +1,29 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <ctype.h>
 
 #include "editor.h"
 #include "draw.h"
-
-static float scrollOffset = 0.0f;
+#include "document.h"
+#include "highlight.h"
+#include "loader.h"
+#include "bigfile.h"
+
+#define CARET_BLINK_SECONDS 0.53
+#define HIGHLIGHT_LINES_PER_POLL 4096
+#define LARGE_FILE_BYTES (256LL * 1024 * 1024)
+#define PLAIN_LINE_MAX 4096
+#define MIN_TEXT_PX 6.0f
+#define MAX_TEXT_PX 72.0f
+
+// Cached line glyphs are positioned within blocks of lines no taller than this, and cached
+// lines are no wider, which keeps their int16 positions from wrapping.
+#define LINE_BLOCK_PX 30000.0f
+
+static double scrollOffset = 0.0;
 static float scrollOffsetX = 0.0f;
+static float textZoom = 1.0f;
 static int g_mouseX = 0;
 static int g_mouseY = 0;
 static int g_screenWidth = 0;
@@ -15,331 +31,148 @@ static int g_screenHeight = 0;
 static int selecting = 0;
 static int mouseDown = 0;
 static char* loadedFile = NULL;
-static TextSelection editorSel = {0, 0, 0};
+static EditState edit;
+static FileLoader* loader = NULL;
+static BigFile* bigFile = NULL;
+static int shownLines = 0;
+static double caretBlinkStart = 0.0;
+static int caretShown = 1;
+
+// Where the caret was last laid out, in top-left pixels; w is 0 when it was off screen.
+static int caretRect[4] = {0, 0, 0, 0};
+static TextRunCache lineRuns;
+
+static const float hlPalette[2][HL_PALETTE_COUNT][4] = {
+    { // Light modes
+        {0.0f, 0.0f, 0.0f, 1.0f},   // HL_TEXT
+        {0.0f, 1.0f, 0.0f, 1.0f},   // HL_COMMENT
+        {0.26f, 0.26f, 0.26f, 1.0f}, // HL_PUNCTUATION
+        {1.0f, 0.0f, 0.0f, 1.0f},   // HL_KEYWORD
+        {0.5f, 0.0f, 0.5f, 1.0f}    // HL_DECLARATION
+    },
+    { // Dark modes
+        {1.0f, 1.0f, 1.0f, 1.0f},
+        {0.0f, 1.0f, 0.0f, 1.0f},
+        {0.26f, 0.26f, 0.26f, 1.0f},
+        {1.0f, 0.0f, 0.0f, 1.0f},
+        {0.5f, 0.0f, 0.5f, 1.0f}
+    }
+};
 
-char** rawLines = NULL;
-char** renderLines = NULL;
+Document* editorDoc = NULL;
 char* currentFilePath = NULL;
 
-extern int ctrlHeld;
 extern int mode;
 
-void selectionClear(TextSelection* sel) {
-    sel->active    = 0;
-    sel->startLine = 0;
-    sel->startCol  = 0;
-    sel->endLine   = 0;
-    sel->endCol    = 0;
+static void resetCaretBlink() {
+    caretBlinkStart = glfwGetTime();
+    caretShown = 1;
 }
 
-void deleteSelection(char** lines) {
-    int sl, sc, el, ec;
-    normalizeSelection(&editorSel, &sl, &sc, &el, &ec);
-
-    if (sl == el) {
-        char* line = lines[sl];
-        memmove(&line[sc], &line[ec], strlen(line) - ec + 1);
-        caretLine = sl;
-        caretCol  = sc;
-    } else {
-        char* first = lines[sl];
-        char* last  = lines[el];
-
-        first[sc] = '\0';
-        strcat(first, &last[ec]);
-
-        for (int i = el; i > sl; i--) {
-            free(lines[i]);
-            for (int j = i; j < lineCount; j++) lines[j] = lines[j + 1];
-            lineCount--;
-        }
-
-        caretLine = sl;
-        caretCol  = sc;
-    }
-
-    selectionClear(&editorSel);
+static void wakeMainLoop() {
+    glfwPostEmptyEvent();
 }
 
-void freeLines(char** lines) {
-    if (!lines) return;
-    for (int i = 0; lines[i]; i++) {
-        free(lines[i]);
+// Picks up lines published by the background loader or large-file indexer, adopts the
+// document once it is complete, and highlights a slice of any lines not lexed yet.
+void editorPoll() {
+    if (bigFile) {
+        int lines = bigFileLineCount(bigFile);
+        if (lines != shownLines) {
+            shownLines = lines;
+            drawMarkDirty(DIRTY_EDITOR);
+        }
     }
-    free(lines);
-}
 
-char* joinLines(char **lines) {
-    if (!lines) return NULL;
+    if (loader) {
+        int lines = loaderLineCount(loader);
+        if (lines != shownLines) {
+            shownLines = lines;
+            drawMarkDirty(DIRTY_EDITOR);
+        }
 
-    size_t total = 0;
-    for (int i = 0; lines[i]; i++) {
-        total += strlen(lines[i]) + 1; // + newline
+        if (loaderDone(loader)) {
+            editAdopt(&edit, loaderFinish(loader));
+            loader = NULL;
+            shownLines = 0;
+            editorDoc = edit.doc;
+            drawMarkDirty(DIRTY_EDITOR);
+        }
     }
 
-    char *out = malloc(total + 1);
-    if (!out) return NULL;
-
-    out[0] = '\0';
-    for (int i = 0; lines[i]; i++) {
-        strcat(out, lines[i]);
-        strcat(out, "\n");
+    if (edit.doc && edit.hl.lexedLines < edit.hl.count) {
+        hlContinue(&edit.hl, edit.doc, HIGHLIGHT_LINES_PER_POLL);
+        drawMarkDirty(DIRTY_EDITOR);
     }
-
-    return out;
 }
 
-void rebuildRenderLines() {
-    if (renderLines) {
-        freeLines(renderLines);
-        renderLines = NULL;
-    }
-
-    char *joined = joinLines(rawLines);
-    if (!joined) return;
+// Flips the caret when its blink phase changes and damages the caret's rect if it did.
+// Returns the seconds until the next flip.
+double editorBlinkTick(double now) {
+    if (!edit.doc) return 1.0;
 
-    char *processed = preprocessText(joined);
-    free(joined);
-
-    renderLines = readText(processed);
-    free(processed);
-}
+    double elapsed = now - caretBlinkStart;
+    int phase = (int)(elapsed / CARET_BLINK_SECONDS);
+    int shown = (phase & 1) == 0;
 
-void insertTextAtCaret(const char* text) {
-    if (!text || !*text || !rawLines || !rawLines[caretLine]) return;
-
-    if (editorSel.active) {
-        deleteSelection(rawLines);
-    }
-
-    const char* p = text;
-    while (*p) {
-        if (*p == '\n') {
-            char* line = rawLines[caretLine];
-            int len = (int)strlen(line);
-
-            if (lineCapacity <= 0) lineCapacity = 16;
-            if (lineCount + 1 >= lineCapacity) {
-                lineCapacity *= 2;
-                rawLines = realloc(rawLines, lineCapacity * sizeof(char*));
-            }
-
-            for (int i = lineCount; i > caretLine; i--)
-                rawLines[i] = rawLines[i - 1];
-
-            char* newLine = calloc(MAX_LINE_LEN, 1);
-            strncpy(newLine, &line[caretCol], MAX_LINE_LEN - 1);
-            line[caretCol] = '\0';
-
-            rawLines[caretLine + 1] = newLine;
-            lineCount++;
-            rawLines[lineCount] = NULL;
-
-            caretLine++;
-            caretCol = 0;
-            p++;
-            continue;
-        }
-
-        char* line = rawLines[caretLine];
-        int len = (int)strlen(line);
-
-        if (len >= MAX_LINE_LEN - 1) {
-            p++;
-            continue;
-        }
-
-        memmove(&line[caretCol + 1], &line[caretCol], len - caretCol + 1);
-        line[caretCol] = *p;
-        caretCol++;
-
-        p++;
+    if (shown != caretShown) {
+        caretShown = shown;
+        drawDamage(DIRTY_EDITOR, caretRect[0], caretRect[1], caretRect[2], caretRect[3]);
     }
 
-    rebuildRenderLines();
+    return (phase + 1) * CARET_BLINK_SECONDS - elapsed;
 }
 
-void editorKeyDown(int key, char** lines) {
-    if (!lines || !lines[caretLine]) return;
-
-    char* line = lines[caretLine];
-    int lineLen = (int)strlen(line);
-
-    if (key == GLFW_KEY_BACKSPACE && editorSel.active) {
-        deleteSelection(lines);
-        rebuildRenderLines();
-        return;
-    }
-
-    if (ctrlHeld && key == GLFW_KEY_C && editorSel.active) {
-        int sl, sc, el, ec;
-        normalizeSelection(&editorSel, &sl, &sc, &el, &ec);
+void rebuildRenderLines() {
+    hlReset(&edit.hl, edit.doc);
+}
 
-        size_t total = 0;
-        for (int i = sl; i <= el; i++) {
-            int start = (i == sl) ? sc : 0;
-            int end   = (i == el) ? ec : strlen(lines[i]);
-            total += (end - start) + 1; // + newline
-        }
+void editorKeyDown(int key, int mods) {
+    if (!edit.doc) return;
 
-        char* buf = malloc(total + 1);
-        char* p = buf;
+    resetCaretBlink();
 
-        for (int i = sl; i <= el; i++) {
-            int start = (i == sl) ? sc : 0;
-            int end   = (i == el) ? ec : strlen(lines[i]);
-            memcpy(p, &lines[i][start], end - start);
-            p += end - start;
-            if (i != el) *p++ = '\n';
+    if ((mods & GLFW_MOD_CONTROL) && key == GLFW_KEY_C) {
+        char* buf = editCopySelection(&edit);
+        if (buf) {
+            clipboardSetText(buf);
+            free(buf);
         }
-        *p = '\0';
-
-        clipboardSetText(buf);
-        free(buf);
         return;
     }
 
-    if (ctrlHeld && key == GLFW_KEY_V) {
+    if ((mods & GLFW_MOD_CONTROL) && key == GLFW_KEY_V) {
         char* clip = clipboardGetText();
         if (clip) {
-            insertTextAtCaret(clip);
+            editInsertText(&edit, clip);
             free(clip);
         }
         return;
     }
 
-    switch (key) {
-        case GLFW_KEY_LEFT:
-            if (caretCol > 0) {
-                caretCol--;
-            } else if (caretLine > 0) {
-                caretLine--;
-                caretCol = (int)strlen(lines[caretLine]);
-            }
-            selectionClear(&editorSel);
-            break;
-        case GLFW_KEY_RIGHT:
-            if (caretCol < lineLen) {
-                caretCol++;
-            } else if (lines[caretLine + 1]) {
-                caretLine++;
-                caretCol = 0;
-            }
-            selectionClear(&editorSel);
-            break;
-        case GLFW_KEY_UP:
-            if (caretLine > 0) {
-                caretLine--;
-                caretMoved = 1;
-                int prevLen = (int)strlen(lines[caretLine]);
-                if (caretCol > prevLen) caretCol = prevLen;
-            }
-            selectionClear(&editorSel);
-            break;
-        case GLFW_KEY_DOWN:
-            if (lines[caretLine + 1]) {
-                caretLine++;
-                caretMoved = 1;
-                int nextLen = (int)strlen(lines[caretLine]);
-                if (caretCol > nextLen) caretCol = nextLen;
-            }
-            selectionClear(&editorSel);
-            break;
-        case GLFW_KEY_BACKSPACE:
-            if (caretCol > 0) {
-                memmove(&line[caretCol - 1], &line[caretCol], (lineLen - caretCol) + 1);
-                caretCol--;
-            } else if (caretLine > 0) {
-                int prevLen = (int)strlen(lines[caretLine - 1]);
-                lines[caretLine - 1] = realloc(lines[caretLine - 1], prevLen + lineLen + 1);
-                if (!lines[caretLine - 1]) return;
-
-                strcat(lines[caretLine - 1], line);
-                free(line);
-
-                for (int i = caretLine; i < lineCount; i++) {
-                    lines[i] = lines[i + 1];
-                }
-                lineCount--;
-                caretLine--;
-                caretCol = prevLen;
-            }
-            rebuildRenderLines();
-            break;
-        case GLFW_KEY_ENTER:
-        case GLFW_KEY_KP_ENTER: {
-            if (lineCapacity <= 0) lineCapacity = 16;
-            if (lineCount + 1 >= lineCapacity) {
-                lineCapacity *= 2;
-                rawLines = realloc(rawLines, lineCapacity * sizeof(char*));
-                lines = rawLines;
-            }
-
-            for (int i = lineCount; i > caretLine; i--) {
-                lines[i] = lines[i - 1];
-            }
-
-            char* newLine = calloc(MAX_LINE_LEN, 1);
-            if (!newLine) return;
-
-            strncpy(newLine, &line[caretCol], MAX_LINE_LEN - 1);
-            line[caretCol] = '\0';
+    editKeyDown(&edit, key, mods);
+}
 
-            lines[caretLine + 1] = newLine;
-            lineCount++;
-            lines[lineCount] = NULL;
+void editorCharInput(unsigned int codepoint) {
+    if (!edit.doc) return;
 
-            caretLine++;
-            caretCol = 0;
+    resetCaretBlink();
+    editCharInput(&edit, codepoint);
+}
 
-            rebuildRenderLines();
-            break;
-        }
-        default:
-            if (key >= 32 && key <= 126) {
-                if (lineLen >= MAX_LINE_LEN - 1) break;
-                if (ctrlHeld) break;
-                memmove(&line[caretCol + 1], &line[caretCol], (lineLen - caretCol) + 1);
-
-                char c = tolower((char)key);
-                if (shiftHeld == 1) c = toupper(c);
-                if (shiftHeld == 1 && (ispunct((char)key) || isdigit((char)key))) {
-                    switch ((char)key) {
-                        case '1': c = '!'; break;
-                        case '2': c = '@'; break;
-                        case '3': c = '#'; break;
-                        case '4': c = '$'; break;
-                        case '5': c = '%'; break;
-                        case '6': c = '^'; break;
-                        case '7': c = '&'; break;
-                        case '8': c = '*'; break;
-                        case '9': c = '('; break;
-                        case '0': c = ')'; break;
-                        case '-': c = '_'; break;
-                        case '=': c = '+'; break;
-                        case '[': c = '{'; break;
-                        case ']': c = '}'; break;
-                        case '\\': c = '|'; break;
-                        case ';': c = ':'; break;
-                        case '\'': c = '"'; break;
-                        case ',': c = '<'; break;
-                        case '.': c = '>'; break;
-                        case '/': c = '?'; break;
-                        case '`': c = '~'; break;
-                    }
-                }
+// Applies everything typed since the last frame as one edit, highlighted once, and damages
+// the editor. Input that arrives while there is no editable document, or
+// while a large file is shown read-only, is dropped.
+void editorApplyInput(const InputEvent* events, int eventCount) {
+    if (eventCount == 0 || !edit.doc || bigFile) return;
 
-                line[caretCol] = c;
-                caretCol++;
-                line[lineLen + 1] = '\0';
-                rebuildRenderLines();
-            }
-            break;
+    editBeginBatch(&edit);
+    for (int i = 0; i < eventCount; i++) {
+        if (events[i].type == INPUT_KEY) editorKeyDown(events[i].key, events[i].mods);
+        else editorCharInput(events[i].codepoint);
     }
-
-    int maxLen = (int)strlen(lines[caretLine]);
-    if (caretCol < 0) caretCol = 0;
-    if (caretCol > maxLen) caretCol = maxLen;
+    editEndBatch(&edit);
+    drawMarkDirty(DIRTY_EDITOR);
 }
 
 static void drawEditorBase(int screenWidth, int screenHeight, float color[4]) {
@@ -361,7 +194,7 @@ void editorScroll(int delta) {
     int editorH = g_screenHeight - 250 - editorY;
 
     if (g_mouseX >= editorX && g_mouseX <= editorX + editorW && g_mouseY >= editorY && g_mouseY <= editorY + editorH) {
-        scrollOffset += delta * 32.5f;
+        scrollOffset += delta * 32.5f * textZoom;
         if (scrollOffset < 0) scrollOffset = 0;
     }
 }
@@ -373,11 +206,31 @@ void editorScrollHorizontal(int delta) {
     int editorH = g_screenHeight - 250 - editorY;
 
     if (g_mouseX >= editorX && g_mouseX <= editorX + editorW && g_mouseY >= editorY && g_mouseY <= editorY + editorH) {
-        scrollOffsetX += delta * 32.5f;
+        scrollOffsetX += delta * 32.5f * textZoom;
         if (scrollOffsetX < 0) scrollOffsetX = 0;
     }
 }
 
+// Scales editor text by steps wheel notches, keeping the same line at the top. Glyphs are
+// distance fields, so every size from MIN_TEXT_PX to MAX_TEXT_PX is drawn from one atlas.
+void editorZoom(int steps) {
+    int editorX = (int)(g_screenWidth * EXPLORER_RATIO);
+    int editorY = 81;
+    int editorW = g_screenWidth - editorX;
+    int editorH = g_screenHeight - 250 - editorY;
+
+    if (!fontLoaded || steps == 0) return;
+    if (g_mouseX < editorX || g_mouseX > editorX + editorW || g_mouseY < editorY || g_mouseY > editorY + editorH) return;
+
+    float zoom = textZoom * powf(1.1f, (float)steps);
+    if (zoom < MIN_TEXT_PX / fontAtlas.pixelHeight) zoom = MIN_TEXT_PX / fontAtlas.pixelHeight;
+    if (zoom > MAX_TEXT_PX / fontAtlas.pixelHeight) zoom = MAX_TEXT_PX / fontAtlas.pixelHeight;
+
+    scrollOffset *= zoom / textZoom;
+    scrollOffsetX *= zoom / textZoom;
+    textZoom = zoom;
+}
+
 float measureTextWidth(const char* text, stbtt_bakedchar* cdata, float scale) {
     float width = 0.0f;
 
@@ -389,7 +242,98 @@ float measureTextWidth(const char* text, stbtt_bakedchar* cdata, float scale) {
     return width;
 }
 
-int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, int mouseY, int mouseClicked, int keyPressed) {
+// Width of the "n|" line number drawn left of a line's text.
+static float gutterWidth(int line) {
+    char number[32];
+    snprintf(number, sizeof(number), "%d|", line + 1);
+    return measureTextWidth(number, cdata, textZoom);
+}
+
+// Where a line's text starts, split into the part that depends on the line alone and the
+// part that moves with the pane and horizontal scroll.
+static int lineTextX(int line) {
+    return (int)(gutterWidth(line) + 10.0f);
+}
+
+static float paneTextX(float editorX) {
+    return floorf(editorX - scrollOffsetX);
+}
+
+// Lines per block at the current line height. It follows the zoom, and a zoom lays every
+// cached line out again anyway.
+static int lineBlock(float lineHeight) {
+    int lines = (int)(LINE_BLOCK_PX / lineHeight);
+    return lines > 1 ? lines : 1;
+}
+
+// Likewise for a line's baseline: its place within its block, and where the block is.
+static int lineBlockY(int line, float lineHeight) {
+    return (int)floorf((float)(line % lineBlock(lineHeight)) * lineHeight);
+}
+
+static float blockY(int line, double yStart, float lineHeight) {
+    return (float)floor(yStart + (double)(line - line % lineBlock(lineHeight)) * lineHeight);
+}
+
+// Whether a line is short enough to cache: no glyph is wider than the pixel height, so its
+// glyph positions then fit in int16. Longer lines are laid out every frame.
+static int lineFitsRun(int lineLen) {
+    return (float)lineLen * fontAtlas.pixelHeight * textZoom < LINE_BLOCK_PX;
+}
+
+typedef const char* (*PlainLineFunc)(void* source, int line, int* outLength);
+
+static const char* loaderLineAt(void* source, int line, int* outLength) {
+    return loaderLine(source, line, outLength);
+}
+
+static const char* bigFileLineAt(void* source, int line, int* outLength) {
+    return bigFileLine(source, line, outLength);
+}
+
+// Read-only view for a file that is still loading or too large to edit: line numbers and
+// plain text, fetching only the lines inside the pane.
+static void drawPlainLines(int lineCount, PlainLineFunc lineAt, void* source, float editorX, float editorY, float editorW, float editorH, int screenWidth, int screenHeight) {
+    float lineHeight = 32.5f * textZoom;
+    double contentHeight = (double)lineCount * lineHeight;
+    if (scrollOffset > contentHeight - editorH + lineHeight) scrollOffset = contentHeight - editorH + lineHeight;
+    if (scrollOffset < 0) scrollOffset = 0;
+
+    int scissorW = (int)editorW;
+    int scissorH = (int)editorH;
+    if (scissorW <= 0 || scissorH <= 0) return;
+    drawSetScissor((int)editorX, screenHeight - (int)(editorY + editorH), scissorW, scissorH);
+
+    // Offsets are computed relative to the first visible line so huge files keep precision.
+    int first = (int)(scrollOffset / lineHeight);
+    float firstY = editorY + 44.0f * textZoom - (float)(scrollOffset - (double)first * lineHeight);
+    const float* textColor = hlPalette[mode == 2 || mode == 3][HL_TEXT];
+
+    for (int i = first; i < lineCount; i++) {
+        float lineY = FLOORF(firstY + (i - first) * lineHeight);
+        if (lineY - lineHeight > editorY + editorH) break;
+
+        int lineLen;
+        const char* line = lineAt(source, i, &lineLen);
+        if (lineLen > PLAIN_LINE_MAX) lineLen = PLAIN_LINE_MAX;
+
+        char buffer2[128];
+        snprintf(buffer2, sizeof(buffer2), "%d|", i + 1);
+
+        float numberX = editorX + 5.0f;
+        float numberWidth = measureTextWidth(buffer2, cdata, textZoom);
+        float textX = FLOORF(editorX + numberWidth + 10.0f - scrollOffsetX);
+
+        renderText(fontTexture, cdata, buffer2, numberX, lineY, screenWidth, screenHeight, textZoom, textColor[0], textColor[1], textColor[2], textColor[3]);
+
+        HighlightSpan plain = { 0, lineLen, HL_TEXT };
+        renderHighlightedText(fontTexture, cdata, line, &plain, 1, hlPalette[mode == 2 || mode == 3], textX, lineY, screenWidth, screenHeight, textZoom);
+    }
+
+    drawClearScissor();
+}
+
+int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, int mouseY, int mouseClicked) {
     if (screenWidth <= 0 || screenHeight <= 0) return 0;
 
     static int lastFontH = -1;
@@ -410,6 +354,7 @@ int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, in
     }
 
     drawEditorBase(screenWidth, screenHeight, color);
+    caretRect[2] = 0;
 
     float editorX = (int)(screenWidth * EXPLORER_RATIO);
     float editorY = 81;
@@ -426,14 +371,14 @@ int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, in
 
     if (fontLoaded && fileChosen) {
         if (!loadedFile || strcmp(loadedFile, fileChosen) != 0) {
-            freeLines(rawLines);
-            freeLines(renderLines);
-
-            rawLines = NULL;
-            renderLines = NULL;
+            if (loader) loaderCancel(loader);
+            loader = NULL;
+            if (bigFile) bigFileClose(bigFile);
+            bigFile = NULL;
+            shownLines = 0;
+            editFree(&edit);
+            editorDoc = NULL;
 
-            caretLine = 0;
-            caretCol = 0;
             scrollOffset = 0.0f;
             scrollOffsetX = 0.0f;
 
@@ -441,55 +386,57 @@ int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, in
             loadedFile = _strdup(fileChosen);
             free(currentFilePath);
             currentFilePath = _strdup(fileChosen);
+
+            // Files too large to edit are mapped and viewed read-only.
+            if (bigFileSize(fileChosen) >= LARGE_FILE_BYTES) bigFile = bigFileOpen(fileChosen, wakeMainLoop);
+            if (!bigFile) loader = loaderStart(fileChosen, wakeMainLoop);
         }
 
-        if (!rawLines) {
-            const char* text = readFile(fileChosen);
-            rawLines = readText(text);
-            lineCount = 0;
-            while (rawLines[lineCount]) lineCount++;
-
-            lineCapacity = lineCount + 128;
-            rawLines = realloc(rawLines, lineCapacity * sizeof(char*));
-            rawLines[lineCount] = NULL;
-
-            for (int i = 0; i < lineCount; i++) {
-                char* buf = calloc(MAX_LINE_LEN, 1);
-                if (!buf) continue;
-                strncpy(buf, rawLines[i], MAX_LINE_LEN - 1);
-                free(rawLines[i]);
-                rawLines[i] = buf;
-            }
+        if (bigFile) {
+            drawPlainLines(bigFileLineCount(bigFile), bigFileLineAt, bigFile, editorX, editorY, editorW, editorH, screenWidth, screenHeight);
+            return 0;
+        }
 
-            char *processed = preprocessText(text);
-            renderLines = readText(processed);
-            free(processed);
-            free((void*)text);
+        if (!edit.doc && loader) {
+            drawPlainLines(loaderLineCount(loader), loaderLineAt, loader, editorX, editorY, editorW, editorH, screenWidth, screenHeight);
+            return 0;
         }
 
-        char** lines = rawLines;
-        if (!lines || !lines[caretLine]) return -1;
+        if (!edit.doc) {
+            const char* text = readFile(fileChosen);
+            editLoad(&edit, text, strlen(text));
+            free((void*)text);
 
-        if (keyPressed) {
-            editorKeyDown(keyPressed, lines);
+            editorDoc = edit.doc;
         }
 
-        float lineHeight = 32.5f;
-        float yStart = 125.0f - scrollOffset;
+        if (!edit.doc) return -1;
+
+        int lineCount = docLineCount(edit.doc);
+
+        float advance[96];
+        for (int i = 0; i < 96; i++) advance[i] = cdata[i].xadvance;
+        layoutSetAdvances(&edit.layout, advance);
+        layoutSetAtlas(&edit.layout, &fontAtlas);
+
+        // Layout widths are kept at the atlas size and scaled by the zoom here.
+        float lineHeight = 32.5f * textZoom;
+        double yStart = editorY + 44.0 * textZoom - scrollOffset;
 
         if (mousePressed) {
             int clickedLine = (int)((mouseY - yStart) / lineHeight);
             if (clickedLine >= 0 && clickedLine < lineCount) {
-                caretLine = clickedLine;
+                edit.caretLine = clickedLine;
+                resetCaretBlink();
 
-                float editorTextX = editorX + 10.0f - scrollOffsetX;
-                caretCol = caretIndexFromMouse(rawLines[caretLine], mouseX - editorTextX);
+                float editorTextX = lineTextX(edit.caretLine) + paneTextX(editorX);
+                edit.caretCol = layoutHitTest(&edit.layout, edit.doc, edit.caretLine, (mouseX - editorTextX) / textZoom);
 
-                editorSel.startLine = caretLine;
-                editorSel.startCol  = caretCol;
-                editorSel.endLine   = caretLine;
-                editorSel.endCol    = caretCol;
-                editorSel.active = 1;
+                edit.sel.startLine = edit.caretLine;
+                edit.sel.startCol  = edit.caretCol;
+                edit.sel.endLine   = edit.caretLine;
+                edit.sel.endCol    = edit.caretCol;
+                edit.sel.active = 1;
                 selecting = 1;
             }
         }
@@ -503,84 +450,80 @@ int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, in
             if (hoveredLine < 0) hoveredLine = 0;
             if (hoveredLine >= lineCount) hoveredLine = lineCount - 1;
 
-            caretLine = hoveredLine;
+            edit.caretLine = hoveredLine;
 
-            float editorTextX = editorX + 10.0f - scrollOffsetX;
-            caretCol = caretIndexFromMouse(rawLines[caretLine], mouseX - editorTextX);
+            float editorTextX = lineTextX(edit.caretLine) + paneTextX(editorX);
+            edit.caretCol = layoutHitTest(&edit.layout, edit.doc, edit.caretLine, (mouseX - editorTextX) / textZoom);
 
-            editorSel.endLine = caretLine;
-            editorSel.endCol  = caretCol;
+            edit.sel.endLine = edit.caretLine;
+            edit.sel.endCol  = edit.caretCol;
         }
 
-        int numLines = 0;
-        for (; lines[numLines]; numLines++);
-        float contentHeight = numLines * lineHeight;
+        double contentHeight = (double)lineCount * lineHeight;
         if (scrollOffset > contentHeight - editorH + lineHeight) scrollOffset = contentHeight - editorH + lineHeight;
 
-        float maxLineWidth = 0.0f;
-        for (int i = 0; lines[i]; i++) {
-            float width = getTextWidth(cdata, lines[i], 1.0f);
-            if (width > maxLineWidth) maxLineWidth = width;
-        }
+        // Only lines edited since the last frame are measured again.
+        float maxLineWidth = layoutMaxWidth(&edit.layout, edit.doc) * textZoom;
 
         if (scrollOffsetX > maxLineWidth - editorW + 40.0f) scrollOffsetX = maxLineWidth - editorW + 40.0f;
         if (scrollOffsetX < 0) scrollOffsetX = 0;
 
-        glEnable(GL_SCISSOR_TEST);
         int scissorX = (int)editorX;
         int scissorY = screenHeight - (int)(editorY + editorH);
         int scissorW = (int)editorW;
         int scissorH = (int)editorH;
-		if (scissorW <= 0 || scissorH <= 0) {
-            glDisable(GL_SCISSOR_TEST);
-            return 0;
-        }
-        glScissor(scissorX, scissorY, scissorW, scissorH);
+		if (scissorW <= 0 || scissorH <= 0) return 0;
+        drawSetScissor(scissorX, scissorY, scissorW, scissorH);
+
+        // Only the lines inside the pane are visited. Positions are taken within blocks of
+        // lines so they stay exact deep into very long files.
+        int first = (int)((editorY - lineHeight - yStart) / lineHeight);
+        if (first < 0) first = 0;
+
+        int sl = 0, sc = 0, el = -1, ec = 0;
+        if (edit.sel.active) normalizeSelection(&edit.sel, &sl, &sc, &el, &ec);
+
+        const float (*palette)[4] = hlPalette[mode == 2 || mode == 3];
+        int last = first - 1;
 
-        for (int i = 0; lines[i]; i++) {
-            float lineY = yStart + i * lineHeight;
-            lineY = FLOORF(lineY);
-            if (lineY + lineHeight < editorY || lineY > editorY + editorH) continue;
+        // Caret, selection, line numbers and any line that is not cached are drawn first, in
+        // place; cached lines follow, moved by the pane offset.
+        for (int i = first; i < lineCount; i++) {
+            float lineY = blockY(i, yStart, lineHeight) + lineBlockY(i, lineHeight);
+            if (lineY > editorY + editorH) break;
+            last = i;
+            if (lineY + lineHeight < editorY) continue;
 
-            char buffer[4096];
             char buffer2[128];
+            int lineLen = docLineLength(edit.doc, i);
 
             snprintf(buffer2, sizeof(buffer2), "%d|", i + 1);
-            strncpy(buffer, renderLines[i], sizeof(buffer) - 1);
-            buffer[sizeof(buffer) - 1] = '\0';
 
             float numberX = editorX + 5.0f;
-            float numberWidth = measureTextWidth(buffer2, cdata, 1.0f);
-            float textX = editorX + numberWidth + 10.0f - scrollOffsetX;
-            textX = FLOORF(textX);
-
-            if (i == caretLine) {
-                char renderedCaret[4096];
-                renderedCaret[0] = '\0';
-
-                int rawCount = 0;
-                for (const char* p = renderLines[i]; *p && rawCount < caretCol; p++) {
-                    if (*p == '[') {
-                        const char* end = strchr(p, ']');
-                        if (!end) break;
-                        p = end;
-                        continue;
-                    }
-
-                    size_t len = strlen(renderedCaret);
-                    renderedCaret[len] = *p;
-                    renderedCaret[len + 1] = '\0';
-                    rawCount++;
-                }
+            float textX = lineTextX(i) + paneTextX(editorX);
 
-                float caretX = textX + measureTextWidth(renderedCaret, cdata, 1.0f);
-                float caretY = lineY - 25.0f;
+            if (i == edit.caretLine) {
+                float caretX = textX + layoutX(&edit.layout, edit.doc, i, edit.caretCol) * textZoom;
+                float caretY = lineY - 25.0f * textZoom;
                 float caretWidth = 2.0f;
                 float caretHeight = lineHeight;
 
                 caretX = FLOORF(caretX);
                 caretY = FLOORF(caretY);
 
+                // Recorded while hidden too, so the blink can redraw just this rect.
+                caretRect[0] = (int)caretX;
+                caretRect[1] = (int)caretY;
+                caretRect[2] = (int)(caretX + caretWidth) - (int)caretX;
+                caretRect[3] = (int)(caretY + caretHeight) - (int)caretY;
+            }
+
+            if (i == edit.caretLine && caretShown) {
+                float caretX = (float)caretRect[0];
+                float caretY = (float)caretRect[1];
+                float caretWidth = (float)caretRect[2];
+                float caretHeight = (float)caretRect[3];
+
                 float cx1 = pxToNDC_X((int)caretX);
                 float cy1 = pxToNDC_Y((int)caretY);
                 float cx2 = pxToNDC_X((int)(caretX + caretWidth));
@@ -599,68 +542,78 @@ int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, in
                 drawRectangle(caretVerts, sizeof(caretVerts), caretColor);
             }
 
-            if (editorSel.active) {
-                int sl, sc, el, ec;
-                normalizeSelection(&editorSel, &sl, &sc, &el, &ec);
+            if (i >= sl && i <= el) {
+                int selStartCol = (i == sl) ? sc : 0;
+                int selEndCol   = (i == el) ? ec : lineLen;
 
-                if (i < sl || i > el) {
-                    // no selection on this line
-                } else {
-                    int lineLen = strlen(lines[i]);
+                float x1 = textX + layoutX(&edit.layout, edit.doc, i, selStartCol) * textZoom;
+                float x2 = textX + layoutX(&edit.layout, edit.doc, i, selEndCol) * textZoom;
 
-                    int selStartCol = (i == sl) ? sc : 0;
-                    int selEndCol   = (i == el) ? ec : lineLen;
+                float selTop    = lineY - lineHeight + 6.0f * textZoom;
+                float selBottom = lineY + 6.0f * textZoom;
 
-                    float x1 = textX + getTextWidthRange(cdata, lines[i], selStartCol, 1.0f);
-                    float x2 = textX + getTextWidthRange(cdata, lines[i], selEndCol,   1.0f);
-
-                    float selTop    = lineY - lineHeight + 6.0f;
-                    float selBottom = lineY + 6.0f;
-
-                    drawSelectionRect(
-                        x1, selTop, x2, selBottom,
-                        (float[]){0.25f, 0.25f, 0.5f, 0.5f}
-                    );
-                }
+                drawSelectionRect(
+                    x1, selTop, x2, selBottom,
+                    (float[]){0.25f, 0.25f, 0.5f, 0.5f}
+                );
             }
 
-            if (editorSel.active) {
-                int sl, sc, el, ec;
-                normalizeSelection(&editorSel, &sl, &sc, &el, &ec);
-
-                if (i >= sl && i <= el) {
-                    int lineLen = strlen(lines[i]);
+            if (mode == 0 || mode == 1) renderText(fontTexture, cdata, buffer2, numberX, lineY, screenWidth, screenHeight, textZoom, 0.0f, 0.0f, 0.0f, 1.0f);
+			else renderText(fontTexture, cdata, buffer2, numberX, lineY, screenWidth, screenHeight, textZoom, 1.0f, 1.0f, 1.0f, 1.0f);
 
-                    int a = (i == sl) ? sc : 0;
-                    int b = (i == el) ? ec : lineLen;
+            int spanCount;
+            const HighlightSpan* spans = hlLineSpans(&edit.hl, i, &spanCount);
+            if (spanCount > 0 && lineFitsRun(lineLen)) continue;
 
-                    if (a < 0) a = 0;
-                    if (b > lineLen) b = lineLen;
+            const char* line = docLine(edit.doc, i, &lineLen);
 
-                    if (a != b) {
-                        char dbg[1024];
-                        int len = b - a;
-                        if (len > 1023) len = 1023;
+            // Lines the lazy highlighter has not reached yet are drawn as plain text.
+            HighlightSpan plain = { 0, lineLen, HL_TEXT };
+            if (spanCount == 0 && lineLen > 0) {
+                spans = &plain;
+                spanCount = 1;
+            }
+            renderHighlightedText(fontTexture, cdata, line, spans, spanCount, palette, textX, lineY, screenWidth, screenHeight, textZoom);
+        }
 
-                        memcpy(dbg, &lines[i][a], len);
-                        dbg[len] = '\0';
-                    }
+        // A cached line is only laid out again when the highlighter has re-lexed it, so while
+        // scrolling a file that is not being edited, lines are copied as they are and the
+        // scroll position only reaches the GPU as the offset.
+        for (int i = first; i <= last; i++) {
+            int x = lineTextX(i);
+            int y = lineBlockY(i, lineHeight);
+            float lineY = blockY(i, yStart, lineHeight) + y;
+            if (lineY + lineHeight < editorY) continue;
+
+            int spanCount, lineLen;
+            const HighlightSpan* spans = hlLineSpans(&edit.hl, i, &spanCount);
+            if (spanCount == 0 || !lineFitsRun(docLineLength(edit.doc, i))) continue;
+
+            unsigned int version = hlLineVersion(&edit.hl, i);
+            TextRun* run = textRunSlot(&lineRuns, version);
+            if (!run) break;
+
+            if (!textRunValid(run, version, textZoom, palette)) {
+                const char* line = docLine(edit.doc, i, &lineLen);
+                if (!textRunBuild(run, version, line, spans, spanCount, palette, textZoom, x, y)) {
+                    drawSetOffset(0.0f, 0.0f);
+                    renderHighlightedText(fontTexture, cdata, line, spans, spanCount, palette, x + paneTextX(editorX), lineY, screenWidth, screenHeight, textZoom);
+                    continue;
                 }
             }
-
-            if (mode == 0 || mode == 1) renderText(fontTexture, cdata, buffer2, numberX, lineY, screenWidth, screenHeight, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
-			else renderText(fontTexture, cdata, buffer2, numberX, lineY, screenWidth, screenHeight, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f);
-
-            renderColoredText(fontTexture, cdata, buffer, textX, lineY, screenWidth, screenHeight, 1.0f);
+            drawSetOffset(paneTextX(editorX), blockY(i, yStart, lineHeight));
+            drawTextRun(run, x, y);
         }
+        drawSetOffset(0.0f, 0.0f);
 
-        if (caretMoved) {
-            float caretY = yStart + caretLine * lineHeight;
-            if (caretY < editorY) scrollOffset = caretLine * lineHeight; else if (caretY + lineHeight > editorY + editorH) scrollOffset = caretLine * lineHeight - editorH + lineHeight;
-            caretMoved = 0;
+        if (edit.caretMoved) {
+            double caretY = yStart + (double)edit.caretLine * lineHeight;
+            if (caretY < editorY) scrollOffset = (double)edit.caretLine * lineHeight; else if (caretY + lineHeight > editorY + editorH) scrollOffset = (double)edit.caretLine * lineHeight - editorH + lineHeight;
+            edit.caretMoved = 0;
+            drawMarkDirty(DIRTY_EDITOR);
         }
 
-        glDisable(GL_SCISSOR_TEST);
+        drawClearScissor();
     }
     return 0;
 }
\ No newline at end of file
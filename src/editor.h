@@ -1,9 +1,15 @@
 #ifndef EDITOR_H
 #define EDITOR_H
 
+#include "input.h"
+
 void rebuildRenderLines();
 void editorScroll(int delta);
 void editorScrollHorizontal(int delta);
-int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, int mouseY, int mouseClicked, int keyPressed);
+void editorZoom(int steps);
+double editorBlinkTick(double now);
+void editorPoll();
+void editorApplyInput(const InputEvent* events, int eventCount);
+int drawEditor(int screenWidth, int screenHeight, float color[4], int mouseX, int mouseY, int mouseClicked);
 
 #endif
\ No newline at end of file
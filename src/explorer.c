@@ -1,8 +1,11 @@
 #include <stdio.h>
-#include <dirent/dirent.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "explorer.h"
 #include "draw.h"
+#include "dirmodel.h"
+#include "settings.h"
 
 static int ex_mouseX = 0;
 static int ex_mouseY = 0;
@@ -10,6 +13,7 @@ static int ex_screenW = 0;
 static int ex_screenH = 0;
 static char* currentDir = NULL;
 static float explorerScroll = 0.0f;
+static DirModel dirModel = { 0 };
 
 char* fileChosen;
 
@@ -27,6 +31,15 @@ void explorerScrollWheel(int delta) {
     }
 }
 
+// Reloads the listing if the watcher saw a change. Called every loop iteration.
+void explorerPoll() {
+    if (dirModelPoll(&dirModel)) drawMarkDirty(DIRTY_EXPLORER);
+}
+
+void explorerRefresh() {
+    dirModelRefresh(&dirModel);
+}
+
 static void drawExplorerBase(int screenWidth, int screenHeight, float color[4]) {
     int explorerW = (int)(screenWidth * EXPLORER_RATIO);
     float vertices[] = {
@@ -60,24 +73,11 @@ void explorerSetCurrentDir(const char* path) {
 
 void explorerSetHomeAndCurrent(const char* path) {
     explorerSetCurrentDir(path);
-
-    const char* text = readFile("src/settings/settings.txt");
-    if (!text) return;
-
-    char** lines = readText(text);
-    free((void*)text);
-
-    if (!lines) return;
-    if (lines[1]) free(lines[1]);
-    if (lines[2]) free(lines[2]);
-
-    lines[1] = _strdup(path);
-    lines[2] = _strdup(path);
-
-    writeText("src/settings/settings.txt", lines);
+    settingsSetString("lastOpened", path);
+    settingsSetString("home", path);
 }
 
-int drawExplorer(int screenWidth, int screenHeight, float color[4], float borderlineColor[4], char* lastOpened, char* homePath, float dark, int mouseX, int mouseY, int mouseClicked) {
+int drawExplorer(int screenWidth, int screenHeight, float color[4], float borderlineColor[4], const char* lastOpened, const char* homePath, float dark, int mouseX, int mouseY, int mouseClicked) {
     if (screenWidth <= 0 || screenHeight <= 0) return 0;
 
     static int lastFontH = -1;
@@ -107,93 +107,66 @@ int drawExplorer(int screenWidth, int screenHeight, float color[4], float border
     drawExplorerBase(screenWidth, screenHeight, color);
 
     if (fontLoaded) {
-        DIR *d;
-        struct dirent *dir;
         if (!currentDir) return 0;
-        d = opendir(currentDir);
-
-        if (d) {
-            int depth = (int)(200 - explorerScroll);
-            int wentBack = 0;
-
-			int totalItems = 0;
-			while (readdir(d)) totalItems++;
-			rewinddir(d);
-
-			float contentHeight = totalItems * 50.0f + 200.0f;
-			float explorerH = screenHeight - 81;
-
-			if (explorerScroll > contentHeight - explorerH) explorerScroll = contentHeight - explorerH;
-			if (explorerScroll < 0) explorerScroll = 0;
-
-			glEnable(GL_SCISSOR_TEST);
-			int explorerW = (int)(screenWidth * EXPLORER_RATIO);
-			int scX = 0;
-			int scY = 0;
-			int scW = explorerW;
-			int scH = (int)(screenHeight - 81);
-
-			if (scW < 0) scW = 0;
-			if (scH < 0) scH = 0;
-			glScissor(scX, scY, scW, scH);
-
-            if (strcmp(currentDir, homePath) != 0) wentBack = renderButton("Go to home dir", 25, 150, minLength, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
-            if (wentBack) {
-                closedir(d);
-                explorerSetCurrentDir(homePath);
-                const char* text = readFile("src/settings/settings.txt");
-                if (text) {
-                    char** lines = readText(text);
-                    free((void*)text);
-
-                    if (lines) {
-                        if (lines[1]) { free(lines[1]); }
-                        lines[1] = _strdup(homePath);
-                        writeText("src/settings/settings.txt", lines);
-                    }
+        if (!dirModel.path || strcmp(dirModel.path, currentDir) != 0) dirModelOpen(&dirModel, currentDir);
+
+        int wentBack = 0;
+
+        float contentHeight = dirModel.count * 50.0f + 200.0f;
+        float explorerH = screenHeight - 81;
+
+        if (explorerScroll > contentHeight - explorerH) explorerScroll = contentHeight - explorerH;
+        if (explorerScroll < 0) explorerScroll = 0;
+        int depth = (int)(200 - explorerScroll);
+
+        int scX = 0;
+        int scY = 0;
+        int scW = explorerW;
+        int scH = (int)(screenHeight - 81);
+
+        if (scW < 0) scW = 0;
+        if (scH < 0) scH = 0;
+        drawSetScissor(scX, scY, scW, scH);
+
+        if (homePath && strcmp(currentDir, homePath) != 0) wentBack = renderButton("Go to home dir", 25, 150, minLength, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
+        if (wentBack) {
+            explorerSetCurrentDir(homePath);
+            settingsSetString("lastOpened", homePath);
+            return 0;
+        }
+
+        // Only rows that reach below the hotbar are drawn; rows are 50 px apart and 40 px tall.
+        int first = depth > 41 ? 0 : (41 - depth) / 50 + 1;
+
+        // Clicks over the hotbar belong to it, not to a row scrolled under it.
+        int rowMouseY = mouseY >= 81 ? mouseY : -1;
+
+        for (int i = first; i < dirModel.count; i++) {
+            int rowY = depth + i * 50;
+            if (rowY > screenHeight) break;
+
+            const DirEntry* entry = &dirModel.entries[i];
+            int clicked = renderButton(entry->name, 25, rowY, minLength, 40, screenWidth, screenHeight, mouseX, rowMouseY, mouseClicked, dark, dark, dark, 1.0f);
+            if (clicked) {
+                char* fullPath = malloc(strlen(currentDir) + strlen(entry->name) + 2);
+                if (!fullPath) {
+                    perror("malloc failed");
+                    return -1;
                 }
-                return 0;
-            }
 
-            while ((dir = readdir(d)) != NULL) {
-                char* name = dir->d_name;
-                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) { continue; }
-                int clicked = renderButton(name, 25, depth, minLength, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
-                if (clicked) {
-                    char* fullPath = malloc(strlen(currentDir) + strlen(name) + 2);
-                    if (!fullPath) {
-                        perror("malloc failed");
-                        closedir(d);
-                        return -1;
-                    }
-
-                    sprintf(fullPath, "%s\\%s", currentDir, name);
-                    if (isDirectory(fullPath)) {
-                        closedir(d);
-                        explorerSetCurrentDir(fullPath);
-                        free(fullPath);
-                        const char* text = readFile("src/settings/settings.txt");
-                        if (text) {
-                            char** lines = readText(text);
-                            free((void*)text);
-
-                            if (lines) {
-                                if (lines[1]) { free(lines[1]); }
-                                lines[1] = _strdup(currentDir);
-                                writeText("src/settings/settings.txt", lines);
-                            }
-                        }
-                        return 0;
-                    } else {
-                        if (fileChosen) free(fileChosen);
-                        fileChosen = fullPath;
-                    }
+                sprintf(fullPath, "%s\\%s", currentDir, entry->name);
+                if (entry->isDir) {
+                    explorerSetCurrentDir(fullPath);
+                    free(fullPath);
+                    settingsSetString("lastOpened", currentDir);
+                    return 0;
+                } else {
+                    if (fileChosen) free(fileChosen);
+                    fileChosen = fullPath;
                 }
-                depth += 50;
             }
-			glDisable(GL_SCISSOR_TEST);
-            closedir(d);
         }
+        drawClearScissor();
     }
     return 0;
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define EXPLORER_H
 
 void explorerSetHomeAndCurrent(const char* path);
-int drawExplorer(int screenWidth, int screenHeight, float color[4], float borderlineColor[4], char* lastOpened, char* homePath, float dark, int mouseX, int mouseY, int mouseClicked);
+int drawExplorer(int screenWidth, int screenHeight, float color[4], float borderlineColor[4], const char* lastOpened, const char* homePath, float dark, int mouseX, int mouseY, int mouseClicked);
 void explorerScrollWheel(int delta);
+void explorerPoll();
+void explorerRefresh();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "highlight.h"
+
+static const char* redWords[]    = {"and", "or", "if", "else", "true", "false", "null", NULL};
+static const char* purpleWords[] = {"class", "for", "def", "return", "super", "this", "int", "while", NULL};
+
+// Shared by every highlighter, so a line version is never reused even across files.
+static unsigned int lineVersionClock = 0;
+
+void hlInit(Highlighter* hl) {
+    memset(hl, 0, sizeof(*hl));
+}
+
+static void freeLineRange(Highlighter* hl, int from, int to) {
+    for (int i = from; i < to; i++) {
+        free(hl->lines[i].spans);
+        hl->lines[i].spans = NULL;
+        hl->lines[i].spanCount = 0;
+        hl->lines[i].version = 0;
+    }
+}
+
+void hlFree(Highlighter* hl) {
+    if (hl->lines) freeLineRange(hl, 0, hl->count);
+    free(hl->lines);
+    free(hl->scratch);
+    hlInit(hl);
+}
+
+static int ensureLineCapacity(Highlighter* hl, int count) {
+    if (count <= hl->capacity) return 1;
+
+    int cap = hl->capacity ? hl->capacity : 256;
+    while (cap < count) cap *= 2;
+
+    HighlightLine* grown = realloc(hl->lines, cap * sizeof(HighlightLine));
+    if (!grown) return 0;
+    hl->lines = grown;
+    hl->capacity = cap;
+    return 1;
+}
+
+static int isWordIn(const char* word, const char** list) {
+    for (int i = 0; list[i]; i++) {
+        if (strcmp(word, list[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Appends a span, merging it into the previous one when the color matches.
+static void pushSpan(HighlightSpan* spans, int* count, int start, int length, unsigned char palette) {
+    if (length <= 0) return;
+
+    if (*count > 0) {
+        HighlightSpan* last = &spans[*count - 1];
+        if (last->palette == palette && last->start + last->length == start) {
+            last->length += length;
+            return;
+        }
+    }
+
+    spans[*count].start = start;
+    spans[*count].length = length;
+    spans[*count].palette = palette;
+    (*count)++;
+}
+
+// Splits one line into colored spans, starting from the state the previous line ended in.
+// Returns the state at the end of this line.
+static unsigned char lexLine(Highlighter* hl, const char* text, int len, unsigned char state, HighlightLine* out) {
+    out->spans = NULL;
+    out->spanCount = 0;
+    if (++lineVersionClock == 0) lineVersionClock = 1;
+    out->version = lineVersionClock;
+
+    if (len + 1 > hl->scratchCapacity) {
+        int cap = hl->scratchCapacity ? hl->scratchCapacity : 256;
+        while (cap < len + 1) cap *= 2;
+        HighlightSpan* grown = realloc(hl->scratch, cap * sizeof(HighlightSpan));
+        if (!grown) return state;
+        hl->scratch = grown;
+        hl->scratchCapacity = cap;
+    }
+
+    HighlightSpan* spans = hl->scratch;
+    int count = 0;
+
+    for (int i = 0; i < len;) {
+        char c = text[i];
+
+        if (state == HL_STATE_IN_QUOTES) {
+            int start = i;
+            while (i < len && text[i] != '"') i++;
+            if (i < len) {
+                i++;
+                state = HL_STATE_NORMAL;
+            }
+            pushSpan(spans, &count, start, i - start, HL_COMMENT);
+        } else if (c == '/' && i + 1 < len && text[i + 1] == '/') {
+            pushSpan(spans, &count, i, len - i, HL_COMMENT);
+            i = len;
+        } else if (c == '"') {
+            pushSpan(spans, &count, i, 1, HL_COMMENT);
+            state = HL_STATE_IN_QUOTES;
+            i++;
+        } else if (c == '(' || c == ')' || c == '{' || c == '}' || c == ';' || c == '+' || c == '-' || c == '=' || c == '*') {
+            pushSpan(spans, &count, i, 1, HL_PUNCTUATION);
+            i++;
+        } else if (isalpha((unsigned char)c)) {
+            char word[128];
+            size_t k = 0;
+            int start = i;
+            while (i < len && (isalnum((unsigned char)text[i]) || text[i] == '_')) {
+                if (k < sizeof(word) - 1) word[k++] = text[i];
+                i++;
+            }
+            word[k] = '\0';
+
+            unsigned char palette = HL_TEXT;
+            if (isWordIn(word, redWords)) palette = HL_KEYWORD;
+            else if (isWordIn(word, purpleWords)) palette = HL_DECLARATION;
+            pushSpan(spans, &count, start, i - start, palette);
+        } else {
+            pushSpan(spans, &count, i, 1, HL_TEXT);
+            i++;
+        }
+    }
+
+    if (count > 0) {
+        out->spans = malloc(count * sizeof(HighlightSpan));
+        if (out->spans) {
+            memcpy(out->spans, spans, count * sizeof(HighlightSpan));
+            out->spanCount = count;
+        }
+    }
+    return state;
+}
+
+// Re-lexes from line onwards. Lines up to mustLex are always redone; after that the walk
+// stops as soon as a line ends in the same state it ended in before the edit. Lines that
+// hlContinue has not reached yet are left to it.
+static void relex(Highlighter* hl, Document* doc, int line, int mustLex) {
+    unsigned char state = HL_STATE_NORMAL;
+    if (line > 0 && hl->lines[line - 1].endState != HL_STATE_UNKNOWN) state = hl->lines[line - 1].endState;
+
+    int lexed = 0;
+    for (int i = line; i < hl->lexedLines; i++) {
+        int len;
+        const char* text = docLine(doc, i, &len);
+
+        unsigned char oldState = hl->lines[i].endState;
+        free(hl->lines[i].spans);
+        state = lexLine(hl, text, len, state, &hl->lines[i]);
+        hl->lines[i].endState = state;
+        lexed++;
+
+        if (i >= mustLex && state == oldState) break;
+    }
+
+    hl->lastRelexCount = lexed;
+}
+
+// Sizes the line cache for doc with nothing lexed yet; hlContinue fills it in.
+void hlResetLazy(Highlighter* hl, Document* doc) {
+    freeLineRange(hl, 0, hl->count);
+    hl->count = 0;
+    hl->lexedLines = 0;
+    if (!doc) return;
+
+    int count = docLineCount(doc);
+    if (!ensureLineCapacity(hl, count)) return;
+
+    for (int i = 0; i < count; i++) {
+        hl->lines[i].spans = NULL;
+        hl->lines[i].spanCount = 0;
+        hl->lines[i].endState = HL_STATE_UNKNOWN;
+        hl->lines[i].version = 0;
+    }
+    hl->count = count;
+}
+
+void hlReset(Highlighter* hl, Document* doc) {
+    hlResetLazy(hl, doc);
+    if (!doc) return;
+
+    hl->lexedLines = hl->count;
+    relex(hl, doc, 0, hl->count - 1);
+}
+
+// Lexes up to maxLines more lines after a lazy reset. Returns 1 while lines remain.
+int hlContinue(Highlighter* hl, Document* doc, int maxLines) {
+    if (!doc) return 0;
+
+    int end = hl->lexedLines + maxLines;
+    if (end > hl->count) end = hl->count;
+
+    int line = hl->lexedLines;
+    unsigned char state = HL_STATE_NORMAL;
+    if (line > 0 && hl->lines[line - 1].endState != HL_STATE_UNKNOWN) state = hl->lines[line - 1].endState;
+
+    for (int i = line; i < end; i++) {
+        int len;
+        const char* text = docLine(doc, i, &len);
+
+        free(hl->lines[i].spans);
+        state = lexLine(hl, text, len, state, &hl->lines[i]);
+        hl->lines[i].endState = state;
+    }
+
+    hl->lexedLines = end;
+    return hl->lexedLines < hl->count;
+}
+
+void hlEdit(Highlighter* hl, Document* doc, int line, int lineDelta) {
+    if (!doc) return;
+    if (line < 0) line = 0;
+    if (line >= hl->count) line = hl->count - 1;
+    if (line < 0) {
+        hlReset(hl, doc);
+        return;
+    }
+
+    int countBefore = hl->count;
+
+    if (lineDelta > 0) {
+        if (!ensureLineCapacity(hl, hl->count + lineDelta)) return;
+        memmove(&hl->lines[line + 1 + lineDelta], &hl->lines[line + 1], (hl->count - line - 1) * sizeof(HighlightLine));
+        for (int i = line + 1; i <= line + lineDelta; i++) {
+            hl->lines[i].spans = NULL;
+            hl->lines[i].spanCount = 0;
+            hl->lines[i].endState = HL_STATE_UNKNOWN;
+            hl->lines[i].version = 0;
+        }
+
+        // The tail of the edited line now ends the last inserted line, so that is where the
+        // old end state must be compared.
+        hl->lines[line + lineDelta].endState = hl->lines[line].endState;
+        hl->lines[line].endState = HL_STATE_UNKNOWN;
+        hl->count += lineDelta;
+    } else if (lineDelta < 0) {
+        int removed = -lineDelta;
+        if (removed > hl->count - line - 1) removed = hl->count - line - 1;
+        hl->lines[line].endState = hl->lines[line + removed].endState;
+        freeLineRange(hl, line + 1, line + 1 + removed);
+        memmove(&hl->lines[line + 1], &hl->lines[line + 1 + removed], (hl->count - line - 1 - removed) * sizeof(HighlightLine));
+        hl->count -= removed;
+    }
+
+    if (line < hl->lexedLines) {
+        hl->lexedLines += hl->count - countBefore;
+        if (hl->lexedLines < line + 1) hl->lexedLines = line + 1;
+    }
+
+    int mustLex = line + (lineDelta > 0 ? lineDelta : 0);
+
+    if (hl->batching) {
+        // Keep the pending range pointing at the same text as lines shift underneath it.
+        if (hl->dirtyFrom < 0) {
+            hl->dirtyFrom = line;
+            hl->dirtyTo = mustLex;
+            return;
+        }
+
+        if (hl->dirtyFrom > line) hl->dirtyFrom = line;
+        if (hl->dirtyTo > line) {
+            hl->dirtyTo += lineDelta;
+            if (hl->dirtyTo < line) hl->dirtyTo = line;
+        }
+        if (hl->dirtyTo < mustLex) hl->dirtyTo = mustLex;
+        return;
+    }
+
+    relex(hl, doc, line, mustLex);
+}
+
+// Between hlBeginBatch and hlEndBatch, hlEdit only keeps the line array in step with the
+// document and widens a pending range; the range is re-lexed once when the batch ends.
+void hlBeginBatch(Highlighter* hl) {
+    hl->batching = 1;
+    hl->dirtyFrom = -1;
+    hl->dirtyTo = -1;
+}
+
+void hlEndBatch(Highlighter* hl, Document* doc) {
+    hl->batching = 0;
+    if (hl->dirtyFrom < 0 || !doc) return;
+
+    if (hl->dirtyTo >= hl->count) hl->dirtyTo = hl->count - 1;
+    relex(hl, doc, hl->dirtyFrom, hl->dirtyTo);
+    hl->dirtyFrom = -1;
+    hl->dirtyTo = -1;
+}
+
+const HighlightSpan* hlLineSpans(const Highlighter* hl, int line, int* outCount) {
+    *outCount = 0;
+    if (line < 0 || line >= hl->count) return NULL;
+    *outCount = hl->lines[line].spanCount;
+    return hl->lines[line].spans;
+}
+
+unsigned int hlLineVersion(const Highlighter* hl, int line) {
+    if (line < 0 || line >= hl->count) return 0;
+    return hl->lines[line].version;
+}
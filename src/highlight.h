@@ -0,0 +1,61 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include "document.h"
+
+// Lexer state carried from the end of one line into the next.
+#define HL_STATE_NORMAL 0
+#define HL_STATE_IN_QUOTES 1
+#define HL_STATE_UNKNOWN 0xFF
+
+// Palette slots a span can refer to; the renderer maps them to colors for the current mode.
+typedef enum {
+    HL_TEXT,
+    HL_COMMENT,
+    HL_PUNCTUATION,
+    HL_KEYWORD,
+    HL_DECLARATION,
+    HL_PALETTE_COUNT
+} HighlightColor;
+
+// A run of raw line text, [start, start + length), drawn in one palette color.
+typedef struct {
+    int start;
+    int length;
+    unsigned char palette;
+} HighlightSpan;
+
+// version changes whenever the line is lexed again and is 0 until it is lexed at all, so a
+// renderer can keep whatever it built from the spans until version moves.
+typedef struct {
+    HighlightSpan* spans;
+    int spanCount;
+    unsigned char endState;
+    unsigned int version;
+} HighlightLine;
+
+typedef struct {
+    HighlightLine* lines;
+    int count;
+    int capacity;
+    int lexedLines; // lines before this one have valid spans and end states
+    int lastRelexCount;
+    int batching;
+    int dirtyFrom;
+    int dirtyTo;
+    HighlightSpan* scratch;
+    int scratchCapacity;
+} Highlighter;
+
+void hlInit(Highlighter* hl);
+void hlFree(Highlighter* hl);
+void hlReset(Highlighter* hl, Document* doc);
+void hlResetLazy(Highlighter* hl, Document* doc);
+int hlContinue(Highlighter* hl, Document* doc, int maxLines);
+void hlEdit(Highlighter* hl, Document* doc, int line, int lineDelta);
+void hlBeginBatch(Highlighter* hl);
+void hlEndBatch(Highlighter* hl, Document* doc);
+const HighlightSpan* hlLineSpans(const Highlighter* hl, int line, int* outCount);
+unsigned int hlLineVersion(const Highlighter* hl, int line);
+
+#endif
@@ -1,5 +1,3 @@
-#define STB_TRUETYPE_IMPLEMENTATION
-
 #include <stdio.h>
 #include <glad/glad.h>
 #include <stdlib.h>
@@ -10,7 +8,7 @@
 #include "editor.h"
 
 extern char* currentFilePath;
-extern char** rawLines;
+extern Document* editorDoc;
 
 static void drawHotbarBase(int screenWidth, int screenHeight, float color[4]) {
     int barHeight = 80;
@@ -67,9 +65,9 @@ int drawHotbar(int screenWidth, int screenHeight, float color[4], float borderli
             int Save = renderButton("|Save", 725, 30, 100, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
             int SaveAs = renderButton("|Save As|", 825, 30, 160, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
 
-            if (OpenFolder) { openFolder(); loadSettings(); }
-            if (Save) saveFile(currentFilePath, rawLines);
-            if (SaveAs) saveFileAs(rawLines);
+            if (OpenFolder) openFolder();
+            if (Save) saveFile(currentFilePath, editorDoc);
+            if (SaveAs) saveFileAs(editorDoc);
             if (New && !newWasDown) { free(currentFilePath); currentFilePath = newFile(); }
             newWasDown = New;
         }
@@ -80,21 +78,10 @@ int drawHotbar(int screenWidth, int screenHeight, float color[4], float borderli
             int Light = renderButton("|Light", 785, 30, 100, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
             int LightContrast = renderButton("|Light Contrast|", 900, 30, 275, 40, screenWidth, screenHeight, mouseX, mouseY, mouseClicked, dark, dark, dark, 1.0f);
 
-            const char* text = readFile("src/settings/settings.txt");
-            if (!text) return 0;
-            char** lines = readText(text);
-            free((void*)text);
-
-            if (lines && lines[0]) {
-				rebuildRenderLines();
-                if (Dark) { free(lines[0]); lines[0] = strdup("2"); }
-                else if (DarkContrast) { free(lines[0]); lines[0] = strdup("3"); }
-                else if (Light) { free(lines[0]); lines[0] = strdup("0"); }
-                else if (LightContrast) { free(lines[0]); lines[0] = strdup("1"); }
-            }
-
-            writeText("src/settings/settings.txt", lines);
-            loadSettings();
+            if (Dark) settingsSetInt("mode", 2);
+            else if (DarkContrast) settingsSetInt("mode", 3);
+            else if (Light) settingsSetInt("mode", 0);
+            else if (LightContrast) settingsSetInt("mode", 1);
         }
     }
 }
\ No newline at end of file
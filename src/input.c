@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "input.h"
+
+// Ring buffer filled by the GLFW callbacks and drained once per frame. Both sides run on
+// the main thread, so no locking is needed.
+static InputEvent queue[INPUT_QUEUE_SIZE];
+static unsigned int queueHead = 0;
+static unsigned int queueTail = 0;
+static unsigned long droppedEvents = 0;
+
+// Timestamps of events drained since the last present.
+static double awaitingPresent[INPUT_QUEUE_SIZE];
+static int awaitingCount = 0;
+
+static double latencies[INPUT_LATENCY_SAMPLES];
+static int latencyCount = 0;
+static int latencyNext = 0;
+static double lastLatency = 0.0;
+
+static FILE* traceFile = NULL;
+
+static void push(const InputEvent* e) {
+    if (queueHead - queueTail >= INPUT_QUEUE_SIZE) {
+        droppedEvents++;
+        return;
+    }
+
+    queue[queueHead % INPUT_QUEUE_SIZE] = *e;
+    queueHead++;
+
+    if (traceFile) {
+        if (e->type == INPUT_KEY) fprintf(traceFile, "K %d %d %.6f\n", e->key, e->mods, e->time);
+        else fprintf(traceFile, "C %u %d %.6f\n", e->codepoint, e->mods, e->time);
+    }
+}
+
+void inputPushKey(int key, int mods, double time) {
+    InputEvent e = { INPUT_KEY, key, 0, mods, time };
+    push(&e);
+}
+
+void inputPushChar(unsigned int codepoint, int mods, double time) {
+    InputEvent e = { INPUT_CHAR, 0, codepoint, mods, time };
+    push(&e);
+}
+
+// Copies up to max pending events into out in arrival order and returns how many were copied.
+int inputDrain(InputEvent* out, int max) {
+    int n = 0;
+
+    while (queueTail != queueHead && n < max) {
+        out[n] = queue[queueTail % INPUT_QUEUE_SIZE];
+        queueTail++;
+
+        if (awaitingCount < INPUT_QUEUE_SIZE) awaitingPresent[awaitingCount++] = out[n].time;
+        n++;
+    }
+
+    return n;
+}
+
+// Called right after the frame that consumed the drained events was swapped to the screen.
+void inputPresented(double now) {
+    for (int i = 0; i < awaitingCount; i++) {
+        lastLatency = now - awaitingPresent[i];
+        latencies[latencyNext] = lastLatency;
+        latencyNext = (latencyNext + 1) % INPUT_LATENCY_SAMPLES;
+        if (latencyCount < INPUT_LATENCY_SAMPLES) latencyCount++;
+    }
+    awaitingCount = 0;
+}
+
+// Appends every queued event to a trace file that mcode-bench can replay. One event per line:
+// "K <key> <mods> <time>" or "C <codepoint> <mods> <time>".
+int inputStartRecording(const char* path) {
+    inputStopRecording();
+
+    traceFile = fopen(path, "w");
+    if (!traceFile) {
+        printf("Could not open trace file %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+void inputStopRecording() {
+    if (!traceFile) return;
+    fclose(traceFile);
+    traceFile = NULL;
+}
+
+// Reads a recorded trace into a new array. Returns the number of events, or -1 on failure.
+int inputLoadTrace(const char* path, InputEvent** outEvents) {
+    *outEvents = NULL;
+
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    int count = 0;
+    int capacity = 0;
+    InputEvent* events = NULL;
+    char line[128];
+
+    while (fgets(line, sizeof(line), f)) {
+        InputEvent e;
+        memset(&e, 0, sizeof(e));
+
+        if (line[0] == 'K') {
+            if (sscanf(line + 1, "%d %d %lf", &e.key, &e.mods, &e.time) != 3) continue;
+            e.type = INPUT_KEY;
+        } else if (line[0] == 'C') {
+            if (sscanf(line + 1, "%u %d %lf", &e.codepoint, &e.mods, &e.time) != 3) continue;
+            e.type = INPUT_CHAR;
+        } else {
+            continue;
+        }
+
+        if (count >= capacity) {
+            int cap = capacity ? capacity * 2 : 256;
+            InputEvent* grown = realloc(events, cap * sizeof(InputEvent));
+            if (!grown) {
+                free(events);
+                fclose(f);
+                return -1;
+            }
+            events = grown;
+            capacity = cap;
+        }
+        events[count++] = e;
+    }
+
+    fclose(f);
+    *outEvents = events;
+    return count;
+}
+
+InputLatencyStats inputGetLatencyStats() {
+    InputLatencyStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    stats.samples = latencyCount;
+    stats.last = lastLatency;
+    stats.dropped = droppedEvents;
+
+    double sum = 0.0;
+    for (int i = 0; i < latencyCount; i++) {
+        sum += latencies[i];
+        if (latencies[i] > stats.max) stats.max = latencies[i];
+    }
+    if (latencyCount > 0) stats.average = sum / latencyCount;
+
+    return stats;
+}
\ No newline at end of file
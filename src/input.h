@@ -0,0 +1,40 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#define INPUT_QUEUE_SIZE 4096
+#define INPUT_LATENCY_SAMPLES 256
+
+typedef enum {
+    INPUT_KEY,
+    INPUT_CHAR
+} InputEventType;
+
+// One key press/repeat or typed character, stamped with glfwGetTime() when the callback ran.
+typedef struct {
+    InputEventType type;
+    int key;
+    unsigned int codepoint;
+    int mods;
+    double time;
+} InputEvent;
+
+// Input-to-present latency over the last INPUT_LATENCY_SAMPLES presented events, in seconds.
+typedef struct {
+    int samples;
+    double last;
+    double average;
+    double max;
+    unsigned long dropped;
+} InputLatencyStats;
+
+void inputPushKey(int key, int mods, double time);
+void inputPushChar(unsigned int codepoint, int mods, double time);
+int inputDrain(InputEvent* out, int max);
+void inputPresented(double now);
+InputLatencyStats inputGetLatencyStats();
+
+int inputStartRecording(const char* path);
+void inputStopRecording();
+int inputLoadTrace(const char* path, InputEvent** outEvents);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "layout.h"
+
+// Widths at or past the last bucket share it, so one minified line cannot make the
+// histogram huge.
+#define LAYOUT_MAX_BUCKETS 65536
+
+void layoutInit(LayoutCache* lc) {
+    memset(lc, 0, sizeof(*lc));
+    lc->dirtyFrom = -1;
+    lc->dirtyTo = -1;
+    lc->topBucket = -1;
+}
+
+static void freePrefixRange(LayoutCache* lc, int from, int to) {
+    for (int i = from; i < to; i++) {
+        free(lc->lines[i].prefix);
+        lc->lines[i].prefix = NULL;
+        lc->lines[i].prefixLength = 0;
+    }
+}
+
+// Drops every line but keeps the glyph advances.
+static void releaseLines(LayoutCache* lc) {
+    if (lc->lines) freePrefixRange(lc, 0, lc->count);
+    free(lc->lines);
+    free(lc->widthBuckets);
+
+    lc->lines = NULL;
+    lc->count = 0;
+    lc->capacity = 0;
+    lc->dirtyFrom = -1;
+    lc->dirtyTo = -1;
+    lc->widthBuckets = NULL;
+    lc->bucketCount = 0;
+    lc->topBucket = -1;
+    lc->overflowWidth = 0.0f;
+    lc->overflowStale = 0;
+}
+
+void layoutFree(LayoutCache* lc) {
+    releaseLines(lc);
+    layoutInit(lc);
+}
+
+static int ensureLineCapacity(LayoutCache* lc, int count) {
+    if (count <= lc->capacity) return 1;
+
+    int cap = lc->capacity ? lc->capacity : 256;
+    while (cap < count) cap *= 2;
+
+    LineLayout* grown = realloc(lc->lines, cap * sizeof(LineLayout));
+    if (!grown) return 0;
+    lc->lines = grown;
+    lc->capacity = cap;
+    return 1;
+}
+
+// Width of the character text starts with, setting *used to the bytes it spans. As in the
+// renderer, control bytes take no space and anything outside ASCII is decoded as UTF-8.
+static float charAdvance(const LayoutCache* lc, const unsigned char* text, int length, int* used) {
+    unsigned int c = text[0];
+    if (c < 128) {
+        *used = 1;
+        return c >= 32 ? lc->advance[c - 32] : 0.0f;
+    }
+
+    *used = utf8Decode(text, length, &c);
+    return lc->atlas ? atlasAdvance(lc->atlas, c) : lc->advance['?' - 32];
+}
+
+static int bucketOf(float width) {
+    int bucket = (int)ceilf(width);
+    return bucket < LAYOUT_MAX_BUCKETS ? bucket : LAYOUT_MAX_BUCKETS - 1;
+}
+
+static void countWidth(LayoutCache* lc, float width) {
+    int bucket = bucketOf(width);
+
+    if (bucket >= lc->bucketCount) {
+        int count = lc->bucketCount ? lc->bucketCount : 1024;
+        while (count <= bucket) count *= 2;
+        if (count > LAYOUT_MAX_BUCKETS) count = LAYOUT_MAX_BUCKETS;
+
+        int* grown = realloc(lc->widthBuckets, count * sizeof(int));
+        if (!grown) return;
+        memset(grown + lc->bucketCount, 0, (count - lc->bucketCount) * sizeof(int));
+        lc->widthBuckets = grown;
+        lc->bucketCount = count;
+    }
+
+    lc->widthBuckets[bucket]++;
+    if (bucket > lc->topBucket) lc->topBucket = bucket;
+    if (bucket == LAYOUT_MAX_BUCKETS - 1 && width > lc->overflowWidth) lc->overflowWidth = width;
+}
+
+static void uncountWidth(LayoutCache* lc, float width) {
+    int bucket = bucketOf(width);
+    if (bucket >= lc->bucketCount || lc->widthBuckets[bucket] == 0) return;
+
+    lc->widthBuckets[bucket]--;
+    if (bucket == LAYOUT_MAX_BUCKETS - 1) {
+        if (lc->widthBuckets[bucket] == 0) {
+            lc->overflowWidth = 0.0f;
+            lc->overflowStale = 0;
+        } else if (width >= lc->overflowWidth) {
+            lc->overflowStale = 1;
+        }
+    }
+    while (lc->topBucket >= 0 && lc->widthBuckets[lc->topBucket] == 0) lc->topBucket--;
+}
+
+static void forgetLine(LayoutCache* lc, LineLayout* l) {
+    if (l->counted) uncountWidth(lc, l->width);
+    free(l->prefix);
+}
+
+// Starts over for a document of lineCount lines, none of them measured yet.
+void layoutReset(LayoutCache* lc, int lineCount) {
+    releaseLines(lc);
+    if (lineCount <= 0 || !ensureLineCapacity(lc, lineCount)) return;
+
+    memset(lc->lines, 0, lineCount * sizeof(LineLayout));
+    lc->count = lineCount;
+    lc->dirtyFrom = 0;
+    lc->dirtyTo = lineCount - 1;
+}
+
+// Sets the glyph advances, from ' ' to DEL. Changing them invalidates every line.
+void layoutSetAdvances(LayoutCache* lc, const float advance[96]) {
+    if (memcmp(lc->advance, advance, sizeof(lc->advance)) == 0) return;
+
+    memcpy(lc->advance, advance, sizeof(lc->advance));
+    layoutReset(lc, lc->count);
+}
+
+// Sets the atlas characters outside ASCII are measured with.
+void layoutSetAtlas(LayoutCache* lc, FontAtlas* atlas) {
+    if (lc->atlas == atlas) return;
+
+    lc->atlas = atlas;
+    layoutReset(lc, lc->count);
+}
+
+static void invalidateLine(LayoutCache* lc, int line) {
+    LineLayout* l = &lc->lines[line];
+    free(l->prefix);
+    l->prefix = NULL;
+    l->prefixLength = 0;
+    l->measured = 0;
+}
+
+// Mirrors hlEdit: line was changed, and lineDelta lines were inserted after it (when
+// positive) or removed after it (when negative).
+void layoutEdit(LayoutCache* lc, int line, int lineDelta) {
+    if (line < 0) line = 0;
+    if (line >= lc->count) line = lc->count - 1;
+    if (line < 0) return;
+
+    if (lineDelta > 0) {
+        if (!ensureLineCapacity(lc, lc->count + lineDelta)) {
+            layoutReset(lc, lc->count + lineDelta);
+            return;
+        }
+        memmove(&lc->lines[line + 1 + lineDelta], &lc->lines[line + 1], (lc->count - line - 1) * sizeof(LineLayout));
+        memset(&lc->lines[line + 1], 0, lineDelta * sizeof(LineLayout));
+        lc->count += lineDelta;
+    } else if (lineDelta < 0) {
+        int removed = -lineDelta;
+        if (removed > lc->count - line - 1) removed = lc->count - line - 1;
+        for (int i = line + 1; i <= line + removed; i++) forgetLine(lc, &lc->lines[i]);
+        memmove(&lc->lines[line + 1], &lc->lines[line + 1 + removed], (lc->count - line - 1 - removed) * sizeof(LineLayout));
+        lc->count -= removed;
+        lineDelta = -removed;
+    }
+
+    invalidateLine(lc, line);
+
+    // Keep the dirty range pointing at the same lines as they shift underneath it.
+    int last = line + (lineDelta > 0 ? lineDelta : 0);
+    if (lc->dirtyFrom < 0) {
+        lc->dirtyFrom = line;
+        lc->dirtyTo = last;
+        return;
+    }
+
+    if (lc->dirtyTo > line) {
+        lc->dirtyTo += lineDelta;
+        if (lc->dirtyTo < line) lc->dirtyTo = line;
+    }
+    if (lc->dirtyFrom > line) lc->dirtyFrom = line;
+    if (lc->dirtyTo < last) lc->dirtyTo = last;
+    if (lc->dirtyTo >= lc->count) lc->dirtyTo = lc->count - 1;
+}
+
+// Measures a line's total width, moving it to its new histogram bucket.
+static void measureLine(LayoutCache* lc, Document* doc, int line) {
+    LineLayout* l = &lc->lines[line];
+    if (l->measured) return;
+
+    int len;
+    const unsigned char* text = (const unsigned char*)docLine(doc, line, &len);
+
+    float width = 0.0f;
+    for (int i = 0, used; i < len; i += used) width += charAdvance(lc, text + i, len - i, &used);
+
+    if (l->counted) uncountWidth(lc, l->width);
+    l->width = width;
+    l->measured = 1;
+    countWidth(lc, width);
+    l->counted = 1;
+}
+
+// Builds the prefix sums for a line if it does not have them yet.
+static const float* linePrefix(LayoutCache* lc, Document* doc, int line, int* outLength) {
+    LineLayout* l = &lc->lines[line];
+
+    if (!l->prefix) {
+        int len;
+        const unsigned char* text = (const unsigned char*)docLine(doc, line, &len);
+
+        float* prefix = malloc((len + 1) * sizeof(float));
+        if (!prefix) {
+            *outLength = 0;
+            return NULL;
+        }
+
+        // A multi-byte character's width is counted at its first byte.
+        prefix[0] = 0.0f;
+        for (int i = 0, used; i < len; i += used) {
+            prefix[i + 1] = prefix[i] + charAdvance(lc, text + i, len - i, &used);
+            for (int j = 1; j < used; j++) prefix[i + 1 + j] = prefix[i + 1];
+        }
+
+        l->prefix = prefix;
+        l->prefixLength = len;
+    }
+
+    *outLength = l->prefixLength;
+    return l->prefix;
+}
+
+// X offset of column col from the start of the line.
+float layoutX(LayoutCache* lc, Document* doc, int line, int col) {
+    if (!doc || line < 0 || line >= lc->count || col <= 0) return 0.0f;
+
+    int len;
+    const float* prefix = linePrefix(lc, doc, line, &len);
+    if (!prefix) return 0.0f;
+    return prefix[col < len ? col : len];
+}
+
+// Column whose caret position is closest to x: a binary search for the first glyph whose
+// midpoint lies right of x.
+int layoutHitTest(LayoutCache* lc, Document* doc, int line, float x) {
+    if (!doc || line < 0 || line >= lc->count) return 0;
+
+    int len;
+    const float* prefix = linePrefix(lc, doc, line, &len);
+    if (!prefix) return 0;
+
+    int lo = 0;
+    int hi = len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (x < (prefix[mid] + prefix[mid + 1]) * 0.5f) hi = mid;
+        else lo = mid + 1;
+    }
+
+    // Never leave the caret inside a multi-byte character.
+    int textLength;
+    const unsigned char* text = (const unsigned char*)docLine(doc, line, &textLength);
+    while (lo < len && lo < textLength && (text[lo] & 0xC0) == 0x80) lo++;
+    return lo;
+}
+
+// Width of the widest line. Only lines edited since the last call are measured.
+float layoutMaxWidth(LayoutCache* lc, Document* doc) {
+    if (!doc) return 0.0f;
+
+    if (lc->dirtyFrom >= 0) {
+        for (int i = lc->dirtyFrom; i <= lc->dirtyTo && i < lc->count; i++) measureLine(lc, doc, i);
+        lc->dirtyFrom = -1;
+        lc->dirtyTo = -1;
+    }
+
+    if (lc->topBucket < 0) return 0.0f;
+    if (lc->topBucket < LAYOUT_MAX_BUCKETS - 1) return (float)lc->topBucket;
+
+    // The widest overflowing line shrank or went away, so the next one is looked for.
+    if (lc->overflowStale) {
+        float widest = 0.0f;
+        for (int i = 0; i < lc->count; i++) {
+            const LineLayout* l = &lc->lines[i];
+            if (l->counted && l->width > widest) widest = l->width;
+        }
+        lc->overflowWidth = widest;
+        lc->overflowStale = 0;
+    }
+    return lc->overflowWidth;
+}
\ No newline at end of file
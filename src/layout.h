@@ -0,0 +1,53 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "document.h"
+#include "atlas.h"
+
+// Cached horizontal layout of one line. prefix[i] is the width of the first i bytes, kept
+// for lines that have been hit-tested or had a caret or selection drawn on them.
+typedef struct {
+    float width;
+    float* prefix;
+    int prefixLength;
+    unsigned char measured;
+    unsigned char counted;
+} LineLayout;
+
+// Per-line text widths for the editor, kept in step with the document by the same edit
+// calls as the highlighter, so only edited lines are measured again. The widest line is
+// tracked with a histogram of widths in whole pixels: a changed line moves between two
+// buckets, and only emptying the top bucket walks down to the next one. The last bucket
+// takes every wider line and keeps the exact widest of them in overflowWidth, which is only
+// found again by a scan once that line shrinks or goes away.
+typedef struct {
+    LineLayout* lines;
+    int count;
+    int capacity;
+
+    // Lines between these may need measuring; lines outside them are measured.
+    int dirtyFrom;
+    int dirtyTo;
+
+    int* widthBuckets;
+    int bucketCount;
+    int topBucket;
+    float overflowWidth;
+    int overflowStale;
+
+    float advance[96];
+    FontAtlas* atlas;
+} LayoutCache;
+
+void layoutInit(LayoutCache* lc);
+void layoutFree(LayoutCache* lc);
+void layoutReset(LayoutCache* lc, int lineCount);
+void layoutSetAdvances(LayoutCache* lc, const float advance[96]);
+void layoutSetAtlas(LayoutCache* lc, FontAtlas* atlas);
+void layoutEdit(LayoutCache* lc, int line, int lineDelta);
+
+float layoutX(LayoutCache* lc, Document* doc, int line, int col);
+int layoutHitTest(LayoutCache* lc, Document* doc, int line, float x);
+float layoutMaxWidth(LayoutCache* lc, Document* doc);
+
+#endif
\ No newline at end of file
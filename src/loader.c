@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+#include "thread.h"
+
+#define LOADER_FIRST_CHUNK (64 * 1024)
+#define LOADER_MAX_CHUNK (4 * 1024 * 1024)
+
+struct FileLoader {
+    char* path;
+    Thread thread;
+    Mutex lock;
+    void (*notify)(void);
+
+    // Written by the worker. data never moves once allocated, and bytes below length are
+    // never rewritten; lineStarts may be reallocated, so it is only touched under lock.
+    char* data;
+    size_t length;
+    size_t* lineStarts;
+    size_t lineStartCapacity;
+    size_t publishedLines;
+    int crlf;
+    int done;
+    int cancelled;
+    char* discarded;
+};
+
+static void publish(FileLoader* l, char* data, size_t length, size_t lineCount, int done) {
+    mutexLock(&l->lock);
+    l->data = data;
+    l->length = length;
+    l->publishedLines = lineCount;
+    l->done = done;
+    mutexUnlock(&l->lock);
+
+    if (l->notify) l->notify();
+}
+
+static int isCancelled(FileLoader* l) {
+    mutexLock(&l->lock);
+    int cancelled = l->cancelled;
+    mutexUnlock(&l->lock);
+    return cancelled;
+}
+
+static void failWith(FileLoader* l, const char* message) {
+    publish(l, strdup(message), strlen(message), 0, 1);
+}
+
+static void loaderMain(void* arg) {
+    FileLoader* l = arg;
+
+    FILE* f = fopen(l->path, "rb");
+    if (!f) {
+        failWith(l, "Could not open file");
+        return;
+    }
+
+    fseek(f, 0L, SEEK_END);
+    size_t fileSize = (size_t)ftell(f);
+    rewind(f);
+
+    char* data = malloc(fileSize + 1);
+    char* chunk = malloc(LOADER_MAX_CHUNK);
+    if (!data || !chunk) {
+        free(data);
+        free(chunk);
+        fclose(f);
+        failWith(l, "Not enough memory to read file");
+        return;
+    }
+
+    size_t readTotal = 0;
+    size_t j = 0;
+    size_t lines = 0;
+    size_t chunkSize = LOADER_FIRST_CHUNK;
+    int pendingCR = 0;
+    int outOfMemory = 0;
+
+    while (readTotal < fileSize && !outOfMemory && !isCancelled(l)) {
+        size_t want = fileSize - readTotal;
+        if (want > chunkSize) want = chunkSize;
+
+        size_t n = fread(chunk, 1, want, f);
+        if (n == 0) break;
+        readTotal += n;
+
+        for (size_t i = 0; i < n; i++) {
+            char c = chunk[i];
+
+            // A '\r' is dropped only when the next byte is '\n', which may be in the next chunk.
+            if (pendingCR) {
+                pendingCR = 0;
+                if (c != '\n') data[j++] = '\r';
+                else if (lines == 0) l->crlf = 1;
+            }
+            if (c == '\r') {
+                pendingCR = 1;
+                continue;
+            }
+
+            data[j++] = c;
+
+            if (c == '\n') {
+                if (lines >= l->lineStartCapacity) {
+                    size_t cap = l->lineStartCapacity ? l->lineStartCapacity * 2 : 1024;
+                    mutexLock(&l->lock);
+                    size_t* grown = realloc(l->lineStarts, cap * sizeof(size_t));
+                    if (grown) {
+                        l->lineStarts = grown;
+                        l->lineStartCapacity = cap;
+                    }
+                    mutexUnlock(&l->lock);
+                    if (!grown) {
+                        outOfMemory = 1;
+                        break;
+                    }
+                }
+                l->lineStarts[lines++] = j;
+            }
+        }
+
+        publish(l, data, j, lines, 0);
+        if (chunkSize < LOADER_MAX_CHUNK) chunkSize *= 2;
+    }
+
+    free(chunk);
+    fclose(f);
+
+    if (outOfMemory) {
+        // The main thread may still be drawing from data, so it is freed after the join.
+        l->discarded = data;
+        failWith(l, "Not enough memory to read file");
+        return;
+    }
+
+    if (pendingCR) data[j++] = '\r';
+    data[j] = '\0';
+    publish(l, data, j, lines, 1);
+}
+
+FileLoader* loaderStart(const char* path, void (*notify)(void)) {
+    FileLoader* l = calloc(1, sizeof(FileLoader));
+    if (!l) return NULL;
+
+    l->path = strdup(path);
+    l->notify = notify;
+    mutexInit(&l->lock);
+
+    if (!l->path || !threadStart(&l->thread, loaderMain, l)) {
+        mutexDestroy(&l->lock);
+        free(l->path);
+        free(l);
+        return NULL;
+    }
+    return l;
+}
+
+// Lines published so far; the last one may still be growing until the load is done.
+int loaderLineCount(FileLoader* l) {
+    mutexLock(&l->lock);
+    int count = l->data ? (int)l->publishedLines + 1 : 0;
+    mutexUnlock(&l->lock);
+    return count;
+}
+
+// Returns a pointer into the loaded text; the line is not NUL-terminated.
+const char* loaderLine(FileLoader* l, int line, int* outLength) {
+    *outLength = 0;
+
+    mutexLock(&l->lock);
+    if (!l->data || line < 0 || (size_t)line > l->publishedLines) {
+        mutexUnlock(&l->lock);
+        return "";
+    }
+
+    size_t start = line == 0 ? 0 : l->lineStarts[line - 1];
+    size_t end = (size_t)line < l->publishedLines ? l->lineStarts[line] - 1 : l->length;
+    const char* text = l->data + start;
+    mutexUnlock(&l->lock);
+
+    *outLength = (int)(end - start);
+    return text;
+}
+
+int loaderDone(FileLoader* l) {
+    mutexLock(&l->lock);
+    int done = l->done;
+    mutexUnlock(&l->lock);
+    return done;
+}
+
+static void joinWorker(FileLoader* l) {
+    threadJoin(&l->thread);
+    mutexDestroy(&l->lock);
+    free(l->path);
+    free(l->discarded);
+}
+
+// Waits for the worker and hands the loaded text to a new document without copying it.
+Document* loaderFinish(FileLoader* l) {
+    if (!l) return NULL;
+
+    joinWorker(l);
+
+    Document* doc = docAdopt(l->data, l->length, l->lineStarts, l->publishedLines);
+    if (!doc) {
+        free(l->data);
+        free(l->lineStarts);
+    }
+
+    // Like docCreate, the first line break decides how the file is saved.
+    docSetCRLF(doc, l->crlf);
+    free(l);
+    return doc;
+}
+
+void loaderCancel(FileLoader* l) {
+    if (!l) return;
+
+    mutexLock(&l->lock);
+    l->cancelled = 1;
+    mutexUnlock(&l->lock);
+
+    joinWorker(l);
+    free(l->data);
+    free(l->lineStarts);
+    free(l);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "document.h"
+
+// Reads a file on a worker thread, normalizing "\r\n" and indexing line starts as it goes.
+// Completed chunks are published so the first lines can be shown before the whole file is in.
+typedef struct FileLoader FileLoader;
+
+FileLoader* loaderStart(const char* path, void (*notify)(void));
+int loaderLineCount(FileLoader* l);
+const char* loaderLine(FileLoader* l, int line, int* outLength);
+int loaderDone(FileLoader* l);
+Document* loaderFinish(FileLoader* l);
+void loaderCancel(FileLoader* l);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <Image/stb_image.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -12,10 +13,13 @@
 #include "draw.h"
 #include "editor.h"
 #include "settings.h"
+#include "input.h"
 
-static int g_lastKeyPressed = 0;
-static int g_keyDown = 0;
-static int g_keyConsumed = 0;
+// Upper bound on how long the loop sleeps, so directory changes are noticed. Shell output and
+// background loads wake the loop themselves with glfwPostEmptyEvent.
+#define IDLE_WAKE_SECONDS 0.5
+
+static InputEvent g_events[INPUT_QUEUE_SIZE];
 
 int shiftHeld = 0;
 int ctrlHeld = 0;
@@ -27,55 +31,106 @@ char* lastOpened;
 char* homePath;
 
 extern char* currentFilePath;
-extern char** rawLines;
+extern Document* editorDoc;
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
     screenWidth = width;
     screenHeight = height;
     glViewport(0, 0, width, height);
     cmdRebuildRenderLines(cdata, (float)(screenWidth - (int)(screenWidth * EXPLORER_RATIO) - 20), 1.0f);
+    drawMarkDirty(DIRTY_ALL);
+}
+
+// The retained frame still holds the whole window, so it only has to be shown again.
+void refreshCallback(GLFWwindow* window) {
+    drawMarkDirty(DIRTY_PRESENT);
+}
+
+static int hoverPane = 0;
+static int pressPane = 0;
+
+void cursorPosCallback(GLFWwindow* window, double x, double y) {
+    // Buttons light up under the mouse, so the pane it is over and the one it left are
+    // redrawn. While the button is down, so is the pane the press started in, which is
+    // where a drag-selection keeps following the mouse.
+    int pane = drawPaneAt((int)x, (int)y);
+    int panes = pane | hoverPane;
+    hoverPane = pane;
+
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+        drawMarkDirty(panes | pressPane);
+        return;
+    }
+    drawMarkDirty(panes & (DIRTY_HOTBAR | DIRTY_EXPLORER));
+}
+
+// Presses and releases both show on the pane under the mouse, and a release ends whatever
+// the press started. A click that changes another pane marks it from renderButton.
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    int pane = drawPaneAt((int)x, (int)y);
+
+    drawMarkDirty(pane | pressPane);
+    pressPane = action == GLFW_PRESS ? pane : 0;
 }
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
     int ctrlPressed = glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS;
+    int shiftPressed = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
 
 	if (g_focus == FOCUS_EXPLORER) {
     	explorerScrollWheel((float)yoffset);
+        drawMarkDirty(DIRTY_EXPLORER);
     	return;
 	}
 
     if (g_focus == FOCUS_CMD) {
         cmdScrollWheel((float)yoffset);
+        drawMarkDirty(DIRTY_CMD);
         return;
     }
 
+    drawMarkDirty(DIRTY_EDITOR);
     if (ctrlPressed) {
+        editorZoom((int)yoffset);
+    } else if (shiftPressed) {
         editorScrollHorizontal((int)-yoffset);
     } else {
         editorScroll((int)-yoffset);
     }
 }
 
+// Editor input is queued and the editor marks itself when it applies it.
 void charCallback(GLFWwindow* window, unsigned int codepoint) {
     if (g_focus == FOCUS_CMD) {
         cmdCharInput(codepoint);
+        drawMarkDirty(DIRTY_CMD);
         return;
     }
+
+    if (g_focus == FOCUS_EDITOR) {
+        int mods = (shiftHeld ? GLFW_MOD_SHIFT : 0) | (ctrlHeld ? GLFW_MOD_CONTROL : 0);
+        inputPushChar(codepoint, mods, glfwGetTime());
+    }
 }
 
+// Only what a key changes is marked: the terminal when it has focus, the explorer when it is
+// reloaded, and nothing for releases. Editor keys are queued like characters.
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     if ((action == GLFW_PRESS || action == GLFW_REPEAT) && (mods & GLFW_MOD_CONTROL)) {
         if (key == GLFW_KEY_S) {
             if (shiftHeld == 1) {
-                saveFileAs(rawLines);
+                saveFileAs(editorDoc);
             } else {
-                saveFile(currentFilePath, rawLines);
+                saveFile(currentFilePath, editorDoc);
             }
         } else if (key == GLFW_KEY_O) {
             openFolder();
-            loadSettings();
+            drawMarkDirty(DIRTY_EXPLORER);
         } else if (key == GLFW_KEY_N) {
             newFile();
+            drawMarkDirty(DIRTY_EXPLORER);
         }
 
         if (key == GLFW_KEY_GRAVE_ACCENT) {
@@ -86,6 +141,17 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		}
     }
 
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        explorerRefresh();
+        drawMarkDirty(DIRTY_EXPLORER);
+        return;
+    }
+
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        drawToggleDamageOverlay();
+        return;
+    }
+
     if (key == GLFW_KEY_LEFT_CONTROL || key == GLFW_KEY_RIGHT_CONTROL) {
         ctrlHeld = (action != GLFW_RELEASE);
     }
@@ -93,31 +159,28 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     if (g_focus == FOCUS_CMD) {
         if (action == GLFW_PRESS || action == GLFW_REPEAT) {
             cmdKeyDown(key);
+            drawMarkDirty(DIRTY_CMD);
         }
         return;
     }
 
-    if (action == GLFW_PRESS) {
-        if (key == GLFW_KEY_LEFT_SHIFT || key == GLFW_KEY_RIGHT_SHIFT) {
-            shiftHeld = 1;
-            return;
-        }
+    if (key == GLFW_KEY_LEFT_SHIFT || key == GLFW_KEY_RIGHT_SHIFT) {
+        shiftHeld = (action != GLFW_RELEASE);
+        return;
+    }
 
-        g_keyDown = key;
-        g_keyConsumed = 0;
+    if ((action == GLFW_PRESS || action == GLFW_REPEAT) && g_focus == FOCUS_EDITOR) {
+        inputPushKey(key, mods, glfwGetTime());
     }
+}
 
-    if (action == GLFW_RELEASE) {
-        if (key == GLFW_KEY_LEFT_SHIFT || key == GLFW_KEY_RIGHT_SHIFT) {
-            shiftHeld = 0;
-            return;
-        }
+// The color mode is read when settings load and whenever it changes, not every frame.
+static void settingsChanged(const char* name, void* user) {
+    if (strcmp(name, "mode") != 0) return;
 
-        if (g_keyDown == key) {
-            g_keyDown = 0;
-            g_keyConsumed = 0;
-        }
-    }
+    mode = settingsGetInt("mode", 2);
+    if (mode < 0 || mode > 3) mode = 2;
+    drawMarkDirty(DIRTY_ALL);
 }
 
 int main() {
@@ -127,11 +190,17 @@ int main() {
     }
 
     loadSettings();
+    settingsSubscribe(settingsChanged, NULL);
+    settingsChanged("mode", NULL);
+
+    const char* tracePath = getenv("MCODE_RECORD_TRACE");
+    if (tracePath) inputStartRecording(tracePath);
 
     double mouseX, mouseY;
     int mouseClicked = 0;
 
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // No multisampling: frames are drawn into a single-sampled framebuffer and blitted to the
+    // window, which a multisampled window cannot take. Everything drawn is pixel-aligned.
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -163,8 +232,12 @@ int main() {
     glfwSetScrollCallback(window, scrollCallback);
     glfwSetKeyCallback(window, keyCallback);
     glfwSetCharCallback(window, charCallback);
+    glfwSetCursorPosCallback(window, cursorPosCallback);
+    glfwSetMouseButtonCallback(window, mouseButtonCallback);
+    glfwSetWindowRefreshCallback(window, refreshCallback);
     
-    cmdStart(settings[2]);
+    cmdSetScrollback(settingsGetInt("scrollbackLines", 0), settingsGetInt("scrollbackMB", 0));
+    cmdStart(settingsGetString("home", NULL));
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         printf("Failed to initialize GLAD");
@@ -187,13 +260,36 @@ int main() {
         {{0.0f,  0.0f,  0.0f,  1.0f}, {0.0f, 0.0f, 0.0f, 1.0f}, {1.0f, 1.0f, 1.0f, 1.0f}}  // Dark contrast mode
     };
 
+    double nextWake = IDLE_WAKE_SECONDS;
+
     // Main loop
     while(!glfwWindowShouldClose(window)) {
-        mode = atoi(settings[0]);
+        // Sleep until input or a wake-up arrives or a timer (caret blink, directory poll) is
+        // due, unless a redraw is already pending.
+        if (drawIsDirty()) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(nextWake);
+        }
 
-        // Color set
-        glClearColor(modes[mode][0][0], modes[mode][0][1], modes[mode][0][2], modes[mode][0][3]);
-        glClear(GL_COLOR_BUFFER_BIT);
+        cmdPoll();
+        editorPoll();
+        editorApplyInput(g_events, inputDrain(g_events, INPUT_QUEUE_SIZE));
+        explorerPoll();
+        double now = glfwGetTime();
+        nextWake = editorBlinkTick(now);
+        double flashWake = drawDamageFlashTick(now);
+        if (flashWake < nextWake) nextWake = flashWake;
+        if (nextWake > IDLE_WAKE_SECONDS) nextWake = IDLE_WAKE_SECONDS;
+
+        if (!drawTakeDirty()) {
+            drawCountSkippedFrame();
+            continue;
+        }
+
+        // Only the damaged parts of each pane are cleared and drawn; the rest is kept from
+        // earlier frames.
+        drawBeginFrame(modes[mode][0]);
 
         // Main code
         glfwGetCursorPos(window, &mouseX, &mouseY);
@@ -202,35 +298,29 @@ int main() {
 		resetGLState();
 
         if (mode == 0 || mode == 1) {
+            drawBeginPane(DIRTY_HOTBAR);
             drawHotbar(screenWidth, screenHeight, modes[mode][1], modes[mode][2], (int)mouseX, (int)mouseY, mouseClicked, 0.0f);
 			resetGLState();
-            drawExplorer(screenWidth, screenHeight, modes[mode][1], modes[mode][2], settings[1], settings[2], 0.0f, (int)mouseX, (int)mouseY, mouseClicked);
+            drawBeginPane(DIRTY_EXPLORER);
+            drawExplorer(screenWidth, screenHeight, modes[mode][1], modes[mode][2], settingsGetString("lastOpened", NULL), settingsGetString("home", NULL), 0.0f, (int)mouseX, (int)mouseY, mouseClicked);
 			resetGLState();
         } else if (mode == 2 || mode == 3) {
+            drawBeginPane(DIRTY_HOTBAR);
             drawHotbar(screenWidth, screenHeight, modes[mode][1], modes[mode][2], (int)mouseX, (int)mouseY, mouseClicked, 1.0f);
 			resetGLState();
-            drawExplorer(screenWidth, screenHeight, modes[mode][1], modes[mode][2], settings[1], settings[2], 1.0f, (int)mouseX, (int)mouseY, mouseClicked);
+            drawBeginPane(DIRTY_EXPLORER);
+            drawExplorer(screenWidth, screenHeight, modes[mode][1], modes[mode][2], settingsGetString("lastOpened", NULL), settingsGetString("home", NULL), 1.0f, (int)mouseX, (int)mouseY, mouseClicked);
 			resetGLState();
         }
 
-        int editorKey = 0;
-        int cmdKey = 0;
-
-        if (g_keyDown && !g_keyConsumed) {
-            if (g_focus == FOCUS_EDITOR) {
-                editorKey = g_keyDown;
-            } else {
-                cmdKey = g_keyDown;
-            }
-            g_keyConsumed = 1;
-        }
-
-
-        drawEditor(screenWidth, screenHeight, modes[mode][0], (int)mouseX, (int)mouseY, mouseClicked, editorKey);
+        drawBeginPane(DIRTY_EDITOR);
+        drawEditor(screenWidth, screenHeight, modes[mode][0], (int)mouseX, (int)mouseY, mouseClicked);
 		resetGLState();
-        drawCMD(screenWidth, screenHeight, modes[mode][1], modes[mode][2], cmdKey);
+        drawBeginPane(DIRTY_CMD);
+        drawCMD(screenWidth, screenHeight, modes[mode][1], modes[mode][2], 0);
 		resetGLState();
         updateMouseState(mouseClicked);
+        drawEndFrame();
 
         GLenum err;
         while ((err = glGetError()) != GL_NO_ERROR) {
@@ -240,12 +330,21 @@ int main() {
         // Reset stuff ig
         glViewport(0, 0, screenWidth, screenHeight);
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        inputPresented(glfwGetTime());
     }
 
+    drawShutdown();
     glfwTerminate();
 
+    InputLatencyStats latency = inputGetLatencyStats();
+    if (latency.samples > 0) {
+        printf("Input to present: %.1f ms average, %.1f ms worst, %.1f ms last over %d events, %lu dropped\n",
+               latency.average * 1000.0, latency.max * 1000.0, latency.last * 1000.0, latency.samples, latency.dropped);
+    }
+
 	cmdShutdown();
+    fontShutdown();
+    inputStopRecording();
     freeSettings();
     free(fileChosen);
     fileChosen = NULL;
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+int ringInit(ByteRing* r, size_t capacity) {
+    r->data = malloc(capacity);
+    r->mask = capacity - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return r->data != NULL && (capacity & r->mask) == 0;
+}
+
+void ringFree(ByteRing* r) {
+    free(r->data);
+    r->data = NULL;
+}
+
+// Producer side. Copies as much of src as fits and returns the number of bytes written.
+// wasDrained is set if the consumer had already read everything before this write, which is
+// when it may have gone to sleep and needs waking. Checking after publishing head means
+// either this side sees the drain or the consumer's own check sees the new bytes.
+size_t ringWrite(ByteRing* r, const void* src, size_t length, int* wasDrained) {
+    if (wasDrained) *wasDrained = 0;
+
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    size_t space = r->mask + 1 - (head - tail);
+    if (length > space) length = space;
+    if (length == 0) return 0;
+
+    size_t at = head & r->mask;
+    size_t first = r->mask + 1 - at;
+    if (first > length) first = length;
+    memcpy(r->data + at, src, first);
+    memcpy(r->data, (const unsigned char*)src + first, length - first);
+
+    atomic_store_explicit(&r->head, head + length, memory_order_seq_cst);
+    if (wasDrained) *wasDrained = atomic_load_explicit(&r->tail, memory_order_seq_cst) == head;
+    return length;
+}
+
+// Consumer side. Copies up to length bytes into dst and returns the number read.
+size_t ringRead(ByteRing* r, void* dst, size_t length) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    size_t used = head - tail;
+    if (length > used) length = used;
+    if (length == 0) return 0;
+
+    size_t at = tail & r->mask;
+    size_t first = r->mask + 1 - at;
+    if (first > length) first = length;
+    memcpy(dst, r->data + at, first);
+    memcpy((unsigned char*)dst + first, r->data, length - first);
+
+    atomic_store_explicit(&r->tail, tail + length, memory_order_seq_cst);
+    return length;
+}
+
+// Bytes waiting to be read, as of the latest update each side has published.
+size_t ringUsed(ByteRing* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_seq_cst);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_seq_cst);
+    return head - tail;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Lock-free byte ring for exactly one producer thread and one consumer thread. head is only
+// advanced by the producer and tail only by the consumer; both grow without wrapping and
+// are masked on access, so capacity must be a power of two.
+typedef struct {
+    unsigned char* data;
+    size_t mask;
+    atomic_size_t head;
+    atomic_size_t tail;
+} ByteRing;
+
+int ringInit(ByteRing* r, size_t capacity);
+void ringFree(ByteRing* r);
+size_t ringWrite(ByteRing* r, const void* src, size_t length, int* wasDrained);
+size_t ringRead(ByteRing* r, void* dst, size_t length);
+size_t ringUsed(ByteRing* r);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scrollback.h"
+
+int scrollbackInit(Scrollback* sb, int maxLines, size_t maxBytes) {
+    memset(sb, 0, sizeof(*sb));
+    if (maxLines < 1) maxLines = 1;
+    if (maxBytes < 1) maxBytes = 1;
+
+    sb->arena = malloc(maxBytes);
+    sb->lines = malloc(maxLines * sizeof(ScrollbackLine));
+    if (!sb->arena || !sb->lines) {
+        scrollbackFree(sb);
+        return 0;
+    }
+
+    sb->arenaSize = maxBytes;
+    sb->lineCapacity = maxLines;
+    return 1;
+}
+
+void scrollbackFree(Scrollback* sb) {
+    free(sb->arena);
+    free(sb->lines);
+    memset(sb, 0, sizeof(*sb));
+}
+
+void scrollbackClear(Scrollback* sb) {
+    sb->firstSeq += sb->count;
+    sb->firstSlot = 0;
+    sb->count = 0;
+    sb->head = 0;
+}
+
+static void evictOldest(Scrollback* sb) {
+    sb->firstSlot = (sb->firstSlot + 1) % sb->lineCapacity;
+    sb->count--;
+    sb->firstSeq++;
+    if (sb->count == 0) sb->head = 0;
+}
+
+// Appends a line, truncated to the arena size, and returns its sequence number. Each byte
+// is copied once and each evicted line is dropped once, so the cost is O(length) amortized.
+unsigned int scrollbackPush(Scrollback* sb, const char* text, int length) {
+    if (length < 0) length = 0;
+    if ((size_t)length > sb->arenaSize) length = (int)sb->arenaSize;
+
+    if (sb->count == sb->lineCapacity) evictOldest(sb);
+
+    // Lines never straddle the end of the arena; when one does not fit, the tail is skipped.
+    // Everything still stored in the tail is older than anything at the start.
+    size_t pos = sb->head;
+    if (pos + length > sb->arenaSize) {
+        while (sb->count > 0 && sb->lines[sb->firstSlot].offset >= pos) evictOldest(sb);
+        pos = 0;
+    }
+
+    while (sb->count > 0) {
+        const ScrollbackLine* oldest = &sb->lines[sb->firstSlot];
+        if (oldest->offset < pos || oldest->offset >= pos + length) break;
+        evictOldest(sb);
+    }
+
+    memcpy(sb->arena + pos, text, length);
+    sb->head = pos + length;
+
+    ScrollbackLine* line = &sb->lines[(sb->firstSlot + sb->count) % sb->lineCapacity];
+    line->offset = pos;
+    line->length = length;
+    sb->count++;
+    return sb->firstSeq + sb->count - 1;
+}
+
+int scrollbackHas(const Scrollback* sb, unsigned int seq) {
+    return seq - sb->firstSeq < (unsigned int)sb->count;
+}
+
+// Returns the line's text, which is not NUL-terminated, or NULL once it has been evicted.
+const char* scrollbackLine(const Scrollback* sb, unsigned int seq, int* outLength) {
+    *outLength = 0;
+    if (!scrollbackHas(sb, seq)) return NULL;
+
+    const ScrollbackLine* line = &sb->lines[(sb->firstSlot + (seq - sb->firstSeq)) % sb->lineCapacity];
+    *outLength = line->length;
+    return sb->arena + line->offset;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <stddef.h>
+
+typedef struct {
+    size_t offset;
+    int length;
+} ScrollbackLine;
+
+// Terminal history: line text is stored back to back in one circular byte arena, and a ring
+// of offsets locates each line. Pushing evicts the oldest lines when either the line limit
+// or the byte limit is reached, so memory never grows past what was configured.
+// Lines are named by sequence numbers that keep increasing as lines are pushed.
+typedef struct {
+    char* arena;
+    size_t arenaSize;
+    size_t head;
+    ScrollbackLine* lines;
+    int lineCapacity;
+    int firstSlot;
+    int count;
+    unsigned int firstSeq;
+} Scrollback;
+
+int scrollbackInit(Scrollback* sb, int maxLines, size_t maxBytes);
+void scrollbackFree(Scrollback* sb);
+void scrollbackClear(Scrollback* sb);
+unsigned int scrollbackPush(Scrollback* sb, const char* text, int length);
+const char* scrollbackLine(const Scrollback* sb, unsigned int seq, int* outLength);
+int scrollbackHas(const Scrollback* sb, unsigned int seq);
+
+#endif
\ No newline at end of file
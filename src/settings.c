@@ -1,28 +1,324 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "settings.h"
-#include "draw.h"
+#include "thread.h"
 
-char **settings = NULL;
+#define SETTINGS_PATH "src/settings/settings.txt"
+#define SETTINGS_TEMP_PATH SETTINGS_PATH ".tmp"
+#define SETTINGS_MAX 32
+#define SETTINGS_MAX_LISTENERS 8
+#define SETTINGS_DEBOUNCE_MS 250
 
-void loadSettings() {
-    if (settings) {
-        for (int i = 0; settings[i]; i++)
-            free(settings[i]);
-        free(settings);
-        settings = NULL;
+typedef enum {
+    SETTING_INT,
+    SETTING_STRING
+} SettingType;
+
+typedef struct {
+    char* name;
+    SettingType type;
+    char* text;
+    int number;
+} Setting;
+
+typedef struct {
+    SettingsListener fn;
+    void* user;
+} SettingsSubscriber;
+
+// Known settings, in the order older files listed them one per line without names.
+static const struct {
+    const char* name;
+    SettingType type;
+} settingSchema[] = {
+    { "mode", SETTING_INT },
+    { "lastOpened", SETTING_STRING },
+    { "home", SETTING_STRING },
+    { "scrollbackLines", SETTING_INT },
+    { "scrollbackMB", SETTING_INT },
+};
+
+#define SETTINGS_SCHEMA_COUNT ((int)(sizeof(settingSchema) / sizeof(settingSchema[0])))
+
+static Setting store[SETTINGS_MAX];
+static int storeCount = 0;
+
+static SettingsSubscriber subscribers[SETTINGS_MAX_LISTENERS];
+static int subscriberCount = 0;
+
+// The writer thread only ever sees pendingText, a serialized copy made on the main thread.
+static Thread writer;
+static Mutex writerLock;
+static Cond writerWake;
+static int writerRunning = 0;
+static int writerStop = 0;
+static char* pendingText = NULL;
+static unsigned int pendingGeneration = 0;
+
+static Setting* findSetting(const char* name) {
+    for (int i = 0; i < storeCount; i++) {
+        if (strcmp(store[i].name, name) == 0) return &store[i];
+    }
+    return NULL;
+}
+
+static SettingType schemaType(const char* name) {
+    for (int i = 0; i < SETTINGS_SCHEMA_COUNT; i++) {
+        if (strcmp(settingSchema[i].name, name) == 0) return settingSchema[i].type;
+    }
+    return SETTING_STRING;
+}
+
+// Stores a value as text, and as a number too for integer settings. Returns 0 if the value
+// did not change.
+static int storeSetting(const char* name, const char* text) {
+    Setting* s = findSetting(name);
+    if (s && strcmp(s->text, text) == 0) return 0;
+
+    char* copy = strdup(text);
+    if (!copy) return 0;
+
+    if (!s) {
+        char* nameCopy = strdup(name);
+        if (storeCount == SETTINGS_MAX || !nameCopy) {
+            printf("settings: no room for %s\n", name);
+            free(nameCopy);
+            free(copy);
+            return 0;
+        }
+
+        s = &store[storeCount++];
+        s->name = nameCopy;
+        s->type = schemaType(name);
+        s->text = NULL;
+    }
+
+    free(s->text);
+    s->text = copy;
+    s->number = s->type == SETTING_INT ? atoi(copy) : 0;
+    return 1;
+}
+
+// One "name=value" per line. Lines without a name are from the older format, where each
+// setting's position gave its meaning.
+static void parseSettings(const char* text) {
+    int index = 0;
+
+    while (*text) {
+        const char* end = text;
+        while (*end && *end != '\n' && *end != '\r') end++;
+
+        int length = (int)(end - text);
+        char line[1024];
+        if (length >= (int)sizeof(line)) length = sizeof(line) - 1;
+        memcpy(line, text, length);
+        line[length] = 0;
+
+        char* eq = strchr(line, '=');
+        if (eq) {
+            *eq = 0;
+            storeSetting(line, eq + 1);
+        } else if (index < SETTINGS_SCHEMA_COUNT) {
+            storeSetting(settingSchema[index].name, line);
+        }
+        index++;
+
+        text = end;
+        if (*text == '\r') text++;
+        if (*text == '\n') text++;
     }
+}
+
+static char* serializeSettings() {
+    size_t size = 1;
+    for (int i = 0; i < storeCount; i++) size += strlen(store[i].name) + strlen(store[i].text) + 2;
+
+    char* text = malloc(size);
+    if (!text) return NULL;
 
-    const char *text = readFile("src/settings/settings.txt");
+    char* p = text;
+    for (int i = 0; i < storeCount; i++) p += sprintf(p, "%s=%s\n", store[i].name, store[i].text);
+    *p = 0;
+    return text;
+}
+
+// Writes the whole file to a temporary path and renames it over the old one, so a crash
+// mid-write leaves the previous settings intact.
+static void writeSettingsFile(const char* text) {
+    FILE* f = fopen(SETTINGS_TEMP_PATH, "w");
+    if (!f) {
+        printf("settings: could not write %s\n", SETTINGS_TEMP_PATH);
+        return;
+    }
+
+    size_t length = strlen(text);
+    int ok = fwrite(text, 1, length, f) == length && fflush(f) == 0;
+#ifdef _WIN32
+    if (ok) _commit(_fileno(f));
+#else
+    if (ok) fsync(fileno(f));
+#endif
+    fclose(f);
+
+    if (!ok) {
+        printf("settings: could not write %s\n", SETTINGS_TEMP_PATH);
+        remove(SETTINGS_TEMP_PATH);
+        return;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(SETTINGS_TEMP_PATH, SETTINGS_PATH, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+#else
+    if (rename(SETTINGS_TEMP_PATH, SETTINGS_PATH) != 0) {
+#endif
+        printf("settings: could not replace %s\n", SETTINGS_PATH);
+        remove(SETTINGS_TEMP_PATH);
+    }
+}
+
+// Waits for a save to be queued, then until no newer one arrives for SETTINGS_DEBOUNCE_MS,
+// and writes only the latest. A pending save is still written when the thread is stopped.
+static void writerMain(void* arg) {
+    mutexLock(&writerLock);
+
+    for (;;) {
+        if (!pendingText) {
+            if (writerStop) break;
+            condWait(&writerWake, &writerLock);
+            continue;
+        }
+
+        if (!writerStop) {
+            unsigned int generation = pendingGeneration;
+            condWaitTimeout(&writerWake, &writerLock, SETTINGS_DEBOUNCE_MS);
+            if (pendingGeneration != generation) continue;
+        }
+
+        char* text = pendingText;
+        pendingText = NULL;
+
+        mutexUnlock(&writerLock);
+        writeSettingsFile(text);
+        free(text);
+        mutexLock(&writerLock);
+    }
+
+    mutexUnlock(&writerLock);
+}
+
+static void queueSave() {
+    char* text = serializeSettings();
     if (!text) return;
 
-    settings = readText(text);
-    free((void*)text);
+    if (!writerRunning) {
+        writeSettingsFile(text);
+        free(text);
+        return;
+    }
+
+    mutexLock(&writerLock);
+    free(pendingText);
+    pendingText = text;
+    pendingGeneration++;
+    condSignal(&writerWake);
+    mutexUnlock(&writerLock);
+}
+
+static void notifySubscribers(const char* name) {
+    for (int i = 0; i < subscriberCount; i++) subscribers[i].fn(name, subscribers[i].user);
 }
 
+// Reads the file once at startup and starts the writer thread.
+void loadSettings() {
+    freeSettings();
+
+    FILE* f = fopen(SETTINGS_PATH, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        rewind(f);
+
+        char* text = malloc(size > 0 ? (size_t)size + 1 : 1);
+        if (text) {
+            size_t got = fread(text, 1, size > 0 ? (size_t)size : 0, f);
+            text[got] = 0;
+            parseSettings(text);
+            free(text);
+        }
+        fclose(f);
+    }
+
+    mutexInit(&writerLock);
+    condInit(&writerWake);
+    writerStop = 0;
+    writerRunning = threadStart(&writer, writerMain, NULL);
+    if (!writerRunning) {
+        printf("settings: could not start the writer thread; saving synchronously\n");
+        condDestroy(&writerWake);
+        mutexDestroy(&writerLock);
+    }
+}
+
+// Stops the writer thread, which first finishes any pending save, and frees the store.
 void freeSettings() {
-    if (!settings) return;
-    for (int i = 0; settings[i]; i++) free(settings[i]);
-    free(settings);
-    settings = NULL;
+    if (writerRunning) {
+        mutexLock(&writerLock);
+        writerStop = 1;
+        condSignal(&writerWake);
+        mutexUnlock(&writerLock);
+
+        threadJoin(&writer);
+        condDestroy(&writerWake);
+        mutexDestroy(&writerLock);
+        writerRunning = 0;
+    }
+
+    for (int i = 0; i < storeCount; i++) {
+        free(store[i].name);
+        free(store[i].text);
+    }
+    storeCount = 0;
+}
+
+int settingsGetInt(const char* name, int fallback) {
+    const Setting* s = findSetting(name);
+    if (!s || s->type != SETTING_INT || !s->text[0]) return fallback;
+    return s->number;
+}
+
+// The returned string stays valid until the setting is changed.
+const char* settingsGetString(const char* name, const char* fallback) {
+    const Setting* s = findSetting(name);
+    if (!s || !s->text[0]) return fallback;
+    return s->text;
+}
+
+void settingsSetInt(const char* name, int value) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", value);
+    settingsSetString(name, text);
+}
+
+void settingsSetString(const char* name, const char* value) {
+    if (!storeSetting(name, value ? value : "")) return;
+
+    queueSave();
+    notifySubscribers(name);
+}
+
+// Listeners run on the main thread, right after the setting changes.
+int settingsSubscribe(SettingsListener listener, void* user) {
+    if (subscriberCount == SETTINGS_MAX_LISTENERS) return 0;
+
+    subscribers[subscriberCount].fn = listener;
+    subscribers[subscriberCount].user = user;
+    subscriberCount++;
+    return 1;
 }
\ No newline at end of file
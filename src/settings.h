@@ -1,6 +1,16 @@
 #pragma once
 
-extern char **settings;
+// Settings live in memory, keyed by name, and are read without touching the disk. Setting
+// a value notifies listeners and queues a save: a background thread coalesces changes that
+// arrive close together and replaces the file by writing a temporary copy and renaming it.
+typedef void (*SettingsListener)(const char* name, void* user);
 
 void loadSettings();
-void freeSettings();
\ No newline at end of file
+void freeSettings();
+
+int settingsGetInt(const char* name, int fallback);
+const char* settingsGetString(const char* name, const char* fallback);
+void settingsSetInt(const char* name, int value);
+void settingsSetString(const char* name, const char* value);
+
+int settingsSubscribe(SettingsListener listener, void* user);
\ No newline at end of file
@@ -0,0 +1,326 @@
+#ifdef _WIN32
+#define _WIN32_WINNT 0x0A00
+#include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <termios.h>
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "shellpty.h"
+#include "ring.h"
+#include "thread.h"
+
+#define SHELL_RING_BYTES (4 * 1024 * 1024)
+#define SHELL_READ_CHUNK (64 * 1024)
+
+static ByteRing ring;
+static Thread reader;
+static void (*notifyOutput)(void) = NULL;
+static atomic_int stopping;
+static atomic_int running;
+
+// Called on the reader thread. Waits while the ring is full rather than dropping output,
+// except once stopping, when the rest is dropped so the reader keeps draining the pipe.
+static void pushOutput(const char* buf, size_t length) {
+    while (length > 0 && !atomic_load(&stopping)) {
+        int wasDrained;
+        size_t n = ringWrite(&ring, buf, length, &wasDrained);
+        if (wasDrained && notifyOutput) notifyOutput();
+
+        buf += n;
+        length -= n;
+        if (length > 0) {
+#ifdef _WIN32
+            Sleep(1);
+#else
+            usleep(1000);
+#endif
+        }
+    }
+}
+
+#ifdef _WIN32
+
+#define PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE 0x00020016
+typedef HANDLE HPCON;
+typedef HRESULT (WINAPI *CreatePseudoConsole_t)(COORD, HANDLE, HANDLE, DWORD, HPCON*);
+typedef VOID (WINAPI *ClosePseudoConsole_t)(HPCON);
+
+static CreatePseudoConsole_t pCreatePseudoConsole = NULL;
+static ClosePseudoConsole_t  pClosePseudoConsole  = NULL;
+
+static HPCON  hPC = NULL;
+static HANDLE hPtyIn = NULL;
+static HANDLE hPtyOut = NULL;
+static PROCESS_INFORMATION shellProc = {0};
+static STARTUPINFOEXA si = {0};
+
+static void shellReaderMain(void* arg) {
+    char* buf = malloc(SHELL_READ_CHUNK);
+    DWORD r = 0;
+
+    // Reads on while stopping: ClosePseudoConsole can wait for the output pipe to drain, and
+    // the read only fails once it has closed the pipe.
+    while (buf && ReadFile(hPtyOut, buf, SHELL_READ_CHUNK, &r, NULL) && r > 0) {
+        pushOutput(buf, r);
+    }
+
+    free(buf);
+    atomic_store(&running, 0);
+    if (notifyOutput) notifyOutput();
+}
+
+static void freeAttributeList() {
+    if (si.lpAttributeList) {
+        DeleteProcThreadAttributeList(si.lpAttributeList);
+        free(si.lpAttributeList);
+        si.lpAttributeList = NULL;
+    }
+}
+
+int shellStart(const char* cwd, int cols, int rows, void (*notify)(void), const char** error) {
+    HMODULE k32 = GetModuleHandleA("kernel32.dll");
+    pCreatePseudoConsole = (CreatePseudoConsole_t)GetProcAddress(k32, "CreatePseudoConsole");
+    pClosePseudoConsole = (ClosePseudoConsole_t)GetProcAddress(k32, "ClosePseudoConsole");
+
+    if (!pCreatePseudoConsole) {
+        *error = "ConPTY not supported";
+        return 0;
+    }
+
+    if (!ringInit(&ring, SHELL_RING_BYTES)) {
+        ringFree(&ring);
+        *error = "Not enough memory for the terminal";
+        return 0;
+    }
+
+    HANDLE inR, inW, outR, outW;
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+
+    CreatePipe(&inR, &inW, &sa, 0);
+    CreatePipe(&outR, &outW, &sa, 0);
+
+    COORD size = { (SHORT)cols, (SHORT)rows };
+    pCreatePseudoConsole(size, inR, outW, 0, &hPC);
+
+    CloseHandle(inR);
+    CloseHandle(outW);
+
+    hPtyIn  = inW;
+    hPtyOut = outR;
+
+    si.StartupInfo.cb = sizeof(si);
+
+    SIZE_T attrSize = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attrSize);
+    si.lpAttributeList = malloc(attrSize);
+    InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &attrSize);
+
+    UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE, hPC, sizeof(hPC), NULL, NULL);
+
+    char cmdLine[] = "powershell.exe";
+    if (!CreateProcessA(NULL, cmdLine, NULL, NULL, FALSE, EXTENDED_STARTUPINFO_PRESENT, NULL, cwd, &si.StartupInfo, &shellProc)) {
+        freeAttributeList();
+
+        if (pClosePseudoConsole && hPC) {
+            pClosePseudoConsole(hPC);
+            hPC = NULL;
+        }
+
+        CloseHandle(hPtyIn);
+        CloseHandle(hPtyOut);
+        ringFree(&ring);
+
+        *error = "Failed to start cmd.exe";
+        return 0;
+    }
+
+    notifyOutput = notify;
+    atomic_store(&stopping, 0);
+    atomic_store(&running, 1);
+    if (!threadStart(&reader, shellReaderMain, NULL)) {
+        atomic_store(&running, 0);
+        TerminateProcess(shellProc.hProcess, 0);
+        CloseHandle(shellProc.hProcess);
+        CloseHandle(shellProc.hThread);
+        pClosePseudoConsole(hPC);
+        hPC = NULL;
+        CloseHandle(hPtyIn);
+        CloseHandle(hPtyOut);
+        hPtyIn = hPtyOut = NULL;
+        freeAttributeList();
+        ringFree(&ring);
+        *error = "Failed to start the terminal reader";
+        return 0;
+    }
+
+    const char* setup = "Remove-Module PSReadLine\r$env:TERM='ansi'\rfunction prompt { 'PS ' + (Get-Location) + '> ' }\r";
+    shellWrite(setup, strlen(setup));
+    return 1;
+}
+
+void shellWrite(const char* s, size_t length) {
+    if (!hPtyIn) return;
+    DWORD w;
+    WriteFile(hPtyIn, s, (DWORD)length, &w, NULL);
+}
+
+void shellStop() {
+    if (!hPC) return;
+
+    atomic_store(&stopping, 1);
+    TerminateProcess(shellProc.hProcess, 0);
+    CloseHandle(shellProc.hProcess);
+    CloseHandle(shellProc.hThread);
+
+    // Closing the pseudo console breaks the output pipe, which ends the reader's ReadFile.
+    pClosePseudoConsole(hPC);
+    hPC = NULL;
+    CloseHandle(hPtyIn);
+    hPtyIn = NULL;
+
+    threadJoin(&reader);
+    CloseHandle(hPtyOut);
+    hPtyOut = NULL;
+
+    freeAttributeList();
+    ringFree(&ring);
+    atomic_store(&running, 0);
+}
+
+#else
+
+static int masterFd = -1;
+static pid_t shellPid = -1;
+
+static void shellReaderMain(void* arg) {
+    char* buf = malloc(SHELL_READ_CHUNK);
+
+    // poll with a timeout so a stop request is seen even if the shell leaves children
+    // holding the pty open.
+    while (buf && !atomic_load(&stopping)) {
+        struct pollfd p = { masterFd, POLLIN, 0 };
+        int ready = poll(&p, 1, 100);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+
+        ssize_t n = read(masterFd, buf, SHELL_READ_CHUNK);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) break; // EIO once the shell has exited
+
+        pushOutput(buf, (size_t)n);
+    }
+
+    free(buf);
+    atomic_store(&running, 0);
+    if (notifyOutput) notifyOutput();
+}
+
+int shellStart(const char* cwd, int cols, int rows, void (*notify)(void), const char** error) {
+    if (!ringInit(&ring, SHELL_RING_BYTES)) {
+        ringFree(&ring);
+        *error = "Not enough memory for the terminal";
+        return 0;
+    }
+
+    struct winsize size = { 0 };
+    size.ws_col = (unsigned short)cols;
+    size.ws_row = (unsigned short)rows;
+
+    shellPid = forkpty(&masterFd, NULL, NULL, &size);
+    if (shellPid < 0) {
+        ringFree(&ring);
+        *error = "Failed to open a pty";
+        return 0;
+    }
+
+    if (shellPid == 0) {
+        if (cwd) chdir(cwd);
+        setenv("TERM", "ansi", 1);
+
+        const char* shell = getenv("SHELL");
+        if (!shell || !*shell) shell = "/bin/sh";
+        execl(shell, shell, (char*)NULL);
+        _exit(127);
+    }
+
+    notifyOutput = notify;
+    atomic_store(&stopping, 0);
+    atomic_store(&running, 1);
+    if (!threadStart(&reader, shellReaderMain, NULL)) {
+        atomic_store(&running, 0);
+        kill(shellPid, SIGKILL);
+        waitpid(shellPid, NULL, 0);
+        close(masterFd);
+        masterFd = -1;
+        ringFree(&ring);
+        *error = "Failed to start the terminal reader";
+        return 0;
+    }
+    return 1;
+}
+
+void shellWrite(const char* s, size_t length) {
+    if (masterFd < 0) return;
+
+    while (length > 0) {
+        ssize_t n = write(masterFd, s, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        s += n;
+        length -= (size_t)n;
+    }
+}
+
+void shellStop() {
+    if (masterFd < 0) return;
+
+    atomic_store(&stopping, 1);
+    threadJoin(&reader);
+
+    kill(shellPid, SIGHUP);
+    close(masterFd);
+    masterFd = -1;
+    if (waitpid(shellPid, NULL, WNOHANG) == 0) {
+        usleep(50000);
+        if (waitpid(shellPid, NULL, WNOHANG) == 0) {
+            kill(shellPid, SIGKILL);
+            waitpid(shellPid, NULL, 0);
+        }
+    }
+    shellPid = -1;
+
+    ringFree(&ring);
+    atomic_store(&running, 0);
+}
+
+#endif
+
+// Consumer side, main thread only.
+size_t shellRead(char* buf, size_t max) {
+    if (!ring.data) return 0;
+    return ringRead(&ring, buf, max);
+}
+
+// Checked after draining: output that raced with the drain is picked up on the next pass.
+int shellPending() {
+    return ring.data && ringUsed(&ring) > 0;
+}
+
+int shellRunning() {
+    return atomic_load(&running);
+}
\ No newline at end of file
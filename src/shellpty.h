@@ -0,0 +1,17 @@
+#ifndef SHELLPTY_H
+#define SHELLPTY_H
+
+#include <stddef.h>
+
+// The terminal panel's shell process, attached to a pseudo terminal: ConPTY running
+// powershell.exe on Windows, forkpty running $SHELL elsewhere. A reader thread drains the
+// pty into a lock-free ring as fast as the shell writes; notify is called from that thread
+// when output arrives after the ring had been emptied.
+int shellStart(const char* cwd, int cols, int rows, void (*notify)(void), const char** error);
+void shellWrite(const char* s, size_t length);
+size_t shellRead(char* buf, size_t max);
+int shellPending();
+int shellRunning();
+void shellStop();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+#include <GLFW/glfw3.h>
+
+// ARB_buffer_storage is newer than the GL 3.3 loader, so it is looked up by hand.
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Uploads start on this boundary so vertex attributes stay aligned.
+#define STREAM_ALIGN 16
+
+// Regions start on STREAM_ALIGN too; the tail of the buffer past the last region is unused.
+static GLsizeiptr regionSize(GLsizeiptr size) {
+    return (size / STREAM_REGIONS) & ~(GLsizeiptr)(STREAM_ALIGN - 1);
+}
+
+static BufferStorageProc bufferStorage = NULL;
+static int bufferStorageChecked = 0;
+
+// MCODE_STREAM=orphan forces the fallback path, so it can be tried on drivers that have
+// buffer storage.
+static BufferStorageProc findBufferStorage() {
+    if (bufferStorageChecked) return bufferStorage;
+    bufferStorageChecked = 1;
+
+    const char* mode = getenv("MCODE_STREAM");
+    if (mode && strcmp(mode, "orphan") == 0) return NULL;
+
+    if (glfwExtensionSupported("GL_ARB_buffer_storage")) bufferStorage = (BufferStorageProc)glfwGetProcAddress("glBufferStorage");
+    return bufferStorage;
+}
+
+static void deleteFences(StreamBuffer* s) {
+    for (int i = 0; i < STREAM_REGIONS; i++) {
+        if (s->fences[i]) glDeleteSync(s->fences[i]);
+        s->fences[i] = NULL;
+    }
+}
+
+static int createStorage(StreamBuffer* s, GLsizeiptr size) {
+    glGenBuffers(1, &s->buffer);
+    glBindBuffer(s->target, s->buffer);
+    s->size = size;
+    s->head = 0;
+    s->region = 0;
+    s->mapped = NULL;
+
+    BufferStorageProc storage = findBufferStorage();
+    if (storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        storage(s->target, size, NULL, flags);
+        s->mapped = glMapBufferRange(s->target, 0, size, flags);
+        if (s->mapped) {
+            s->persistent = 1;
+            return 1;
+        }
+
+        // Storage made by glBufferStorage is immutable, so the fallback needs a new buffer.
+        printf("streamInit: persistent mapping failed, falling back to orphaning\n");
+        glDeleteBuffers(1, &s->buffer);
+        glGenBuffers(1, &s->buffer);
+        glBindBuffer(s->target, s->buffer);
+    }
+
+    s->persistent = 0;
+    glBufferData(s->target, size, NULL, GL_STREAM_DRAW);
+    return 1;
+}
+
+int streamInit(StreamBuffer* s, GLenum target, GLsizeiptr size) {
+    memset(s, 0, sizeof(*s));
+    s->target = target;
+    return createStorage(s, size);
+}
+
+void streamFree(StreamBuffer* s) {
+    deleteFences(s);
+    if (s->buffer) glDeleteBuffers(1, &s->buffer);
+    memset(s, 0, sizeof(*s));
+}
+
+// Replaces the buffer with one that has room for bytes in each region. Draws already
+// issued keep the old storage alive until they finish.
+static void grow(StreamBuffer* s, GLsizeiptr bytes) {
+    GLsizeiptr size = s->size;
+    while (regionSize(size) < bytes + STREAM_ALIGN) size *= 2;
+
+    deleteFences(s);
+    glDeleteBuffers(1, &s->buffer);
+    createStorage(s, size);
+}
+
+// Blocks until the GPU is done with a region, counting it when it was not already.
+static void waitRegion(StreamBuffer* s, int region) {
+    GLsync fence = s->fences[region];
+    if (!fence) return;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        s->stats.waits++;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+
+    glDeleteSync(fence);
+    s->fences[region] = NULL;
+}
+
+// Copies bytes into the ring and returns their offset in s->buffer, which is left bound to
+// the buffer's target. Draws reading them have to be issued before the next upload can
+// move the ring off their region.
+GLintptr streamUpload(StreamBuffer* s, const void* data, GLsizeiptr bytes) {
+    if (bytes + STREAM_ALIGN > regionSize(s->size)) grow(s, bytes);
+    glBindBuffer(s->target, s->buffer);
+
+    GLsizeiptr offset = (s->head + STREAM_ALIGN - 1) & ~(GLsizeiptr)(STREAM_ALIGN - 1);
+    s->stats.uploads++;
+
+    if (s->persistent) {
+        GLsizeiptr region = regionSize(s->size);
+        if (offset + bytes > (s->region + 1) * region) {
+            s->fences[s->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            s->region = (s->region + 1) % STREAM_REGIONS;
+            offset = s->region * region;
+
+            unsigned long waits = s->stats.waits;
+            waitRegion(s, s->region);
+            if (s->stats.waits == waits) s->stats.stallsAvoided++;
+        } else {
+            s->stats.stallsAvoided++;
+        }
+
+        memcpy(s->mapped + offset, data, (size_t)bytes);
+        s->head = offset + bytes;
+        return offset;
+    }
+
+    if (offset + bytes > s->size) {
+        glBufferData(s->target, s->size, NULL, GL_STREAM_DRAW);
+        s->stats.orphans++;
+        offset = 0;
+    }
+
+    // Nothing drawn since the last orphan reads this range, so the write need not wait.
+    void* dst = glMapBufferRange(s->target, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst) {
+        memcpy(dst, data, (size_t)bytes);
+        glUnmapBuffer(s->target);
+        s->stats.stallsAvoided++;
+    } else {
+        glBufferSubData(s->target, offset, bytes, data);
+    }
+
+    s->head = offset + bytes;
+    return offset;
+}
\ No newline at end of file
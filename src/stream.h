@@ -0,0 +1,39 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <glad/glad.h>
+
+#define STREAM_REGIONS 3
+
+// Upload counters. stallsAvoided counts uploads written while earlier draws from the buffer
+// could still be in flight, without waiting for them; waits counts the times the ring
+// caught up with the GPU and had to block on a fence.
+typedef struct {
+    unsigned long uploads;
+    unsigned long stallsAvoided;
+    unsigned long waits;
+    unsigned long orphans;
+} StreamStats;
+
+// Ring buffer for geometry that is written once and drawn once. With ARB_buffer_storage the
+// buffer is mapped persistently and split into STREAM_REGIONS regions; a fence is placed
+// when writing moves off a region and waited on before the ring comes back to it. Without
+// it, uploads are appended through unsynchronized mappings and the storage is orphaned when
+// the end is reached.
+typedef struct {
+    GLuint buffer;
+    GLenum target;
+    GLsizeiptr size;
+    GLsizeiptr head;
+    unsigned char* mapped;
+    int persistent;
+    int region;
+    GLsync fences[STREAM_REGIONS];
+    StreamStats stats;
+} StreamBuffer;
+
+int streamInit(StreamBuffer* s, GLenum target, GLsizeiptr size);
+void streamFree(StreamBuffer* s);
+GLintptr streamUpload(StreamBuffer* s, const void* data, GLsizeiptr bytes);
+
+#endif
\ No newline at end of file
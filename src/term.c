@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "term.h"
+
+static TermRow* termRowAt(const Terminal* t, int i) {
+    return &t->rows[(t->rowFirst + i) % t->rowCapacity];
+}
+
+// The ASCII glyph drawn for a cell below 128; control characters show as '?'.
+char termGlyph(const VtCell* cell) {
+    return cell->ch >= 32 && cell->ch < 127 ? (char)cell->ch : '?';
+}
+
+// Measures a cell the way the renderer will draw it.
+static float termCellAdvance(const Terminal* t, const VtCell* cell) {
+    if (cell->ch >= 128 && t->wideAdvance) return t->wideAdvance(cell->ch, t->wideAdvanceUser);
+    return t->advance[termGlyph(cell) - 32];
+}
+
+// Splits cells into rows no wider than wrapWidth, keeping a running width instead of
+// re-measuring each prefix. Every row holds at least one cell and a blank line is one row.
+// Writes the start of each row to starts, which must hold max(length, 1) entries, and
+// returns the row count.
+static int termWrap(const Terminal* t, const VtCell* cells, int length, int* starts) {
+    int rows = 0;
+    float w = 0.0f;
+
+    starts[rows++] = 0;
+    for (int i = 0; i < length; i++) {
+        float advance = termCellAdvance(t, &cells[i]);
+
+        if (i > 0 && w + advance > t->wrapWidth) {
+            starts[rows++] = i;
+            w = 0.0f;
+        }
+        w += advance;
+    }
+
+    return rows;
+}
+
+// History lines are stored as the bytes of their cells.
+static const VtCell* termHistoryCells(const Terminal* t, unsigned int raw, int* outLength) {
+    int bytes;
+    const VtCell* cells = (const VtCell*)scrollbackLine(&t->history, raw, &bytes);
+    *outLength = bytes / (int)sizeof(VtCell);
+    return cells;
+}
+
+// Makes room for one more row by growing the ring. Returns 0 once it is at its limit.
+static int termGrowRows(Terminal* t) {
+    if (t->rowCount < t->rowCapacity) return 1;
+
+    size_t limit = t->history.arenaSize / sizeof(VtCell) + t->history.lineCapacity;
+    if ((size_t)t->rowCapacity < limit) {
+        int cap = t->rowCapacity ? t->rowCapacity * 2 : 1024;
+        if ((size_t)cap > limit) cap = (int)limit;
+
+        TermRow* grown = malloc(cap * sizeof(TermRow));
+        if (grown) {
+            for (int i = 0; i < t->rowCount; i++) grown[i] = *termRowAt(t, i);
+            free(t->rows);
+            t->rows = grown;
+            t->rowCapacity = cap;
+            t->rowFirst = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Drops rows whose history line has been evicted. They are at the front.
+static void termDropEvictedRows(Terminal* t) {
+    while (t->rowCount > 0 && !scrollbackHas(&t->history, termRowAt(t, 0)->raw)) {
+        t->rowFirst = (t->rowFirst + 1) % t->rowCapacity;
+        t->rowCount--;
+    }
+}
+
+static void termAppendRows(Terminal* t, unsigned int raw) {
+    int len;
+    const VtCell* cells = termHistoryCells(t, raw, &len);
+    int* starts = t->wrapStarts;
+    int rows = termWrap(t, cells, len, starts);
+
+    for (int r = 0; r < rows; r++) {
+        // A full ring drops its oldest row to make room.
+        if (!termGrowRows(t)) {
+            if (t->rowCapacity == 0) return;
+            t->rowFirst = (t->rowFirst + 1) % t->rowCapacity;
+            t->rowCount--;
+        }
+
+        TermRow* row = termRowAt(t, t->rowCount++);
+        row->raw = raw;
+        row->start = starts[r];
+        row->length = (r + 1 < rows ? starts[r + 1] : len) - starts[r];
+    }
+}
+
+// Returns the number of rows added, or -1 once the ring has no room left for older rows.
+static int termPrependRows(Terminal* t, unsigned int raw) {
+    int len;
+    const VtCell* cells = termHistoryCells(t, raw, &len);
+    int* starts = t->wrapStarts;
+    int rows = termWrap(t, cells, len, starts);
+
+    for (int r = rows - 1; r >= 0; r--) {
+        if (!termGrowRows(t)) return -1;
+
+        t->rowFirst = (t->rowFirst + t->rowCapacity - 1) % t->rowCapacity;
+        t->rowCount++;
+
+        TermRow* row = termRowAt(t, 0);
+        row->raw = raw;
+        row->start = starts[r];
+        row->length = (r + 1 < rows ? starts[r + 1] : len) - starts[r];
+    }
+    return rows;
+}
+
+// Called by the parser with each row that scrolls off the top of the screen.
+static void termScrolledOff(void* user, const VtCell* cells, int count) {
+    Terminal* t = user;
+    if (!t->history.arena) return;
+
+    unsigned int seq = scrollbackPush(&t->history, (const char*)cells, count * (int)sizeof(VtCell));
+    termDropEvictedRows(t);
+
+    // Only the new line is wrapped; until the first layout there is no width to wrap to.
+    if (t->wrapWidth > 0) termAppendRows(t, seq);
+}
+
+// Wraps the rows of the live screen. It is small, so this runs after every write.
+static void termLayoutLive(Terminal* t) {
+    t->liveCount = 0;
+    if (t->wrapWidth <= 0) return;
+
+    int used = vtUsedRows(&t->screen);
+    for (int r = 0; r < used; r++) {
+        int len;
+        const VtCell* cells = vtRow(&t->screen, r, &len);
+        int* starts = t->wrapStarts;
+        int rows = termWrap(t, cells, len, starts);
+
+        for (int i = 0; i < rows; i++) {
+            TermRow* row = &t->liveRows[t->liveCount++];
+            row->raw = r;
+            row->start = starts[i];
+            row->length = (i + 1 < rows ? starts[i + 1] : len) - starts[i];
+        }
+    }
+}
+
+// A history that cannot be allocated is reported and left empty; the screen still works.
+int termInit(Terminal* t, int rows, int cols, int scrollbackLines, size_t scrollbackBytes) {
+    memset(t, 0, sizeof(*t));
+    if (!vtInit(&t->screen, rows, cols)) return 0;
+
+    // No line is wider than the screen, so cols entries hold the row starts of any of them.
+    t->liveRows = malloc(rows * cols * sizeof(TermRow));
+    t->wrapStarts = malloc(cols * sizeof(int));
+    if (!t->liveRows || !t->wrapStarts) {
+        vtFree(&t->screen);
+        free(t->liveRows);
+        free(t->wrapStarts);
+        return 0;
+    }
+
+    t->screen.scrolledOff = termScrolledOff;
+    t->screen.user = t;
+
+    if (!scrollbackInit(&t->history, scrollbackLines, scrollbackBytes)) {
+        printf("term: not enough memory for %zu MB of scrollback\n", scrollbackBytes / (1024 * 1024));
+    }
+    return 1;
+}
+
+void termFree(Terminal* t) {
+    vtFree(&t->screen);
+    scrollbackFree(&t->history);
+    free(t->rows);
+    free(t->liveRows);
+    free(t->wrapStarts);
+    memset(t, 0, sizeof(*t));
+}
+
+void termWrite(Terminal* t, const char* data, size_t length) {
+    vtWrite(&t->screen, data, length);
+    termLayoutLive(t);
+}
+
+// Sets how cells past ASCII are measured; takes effect at the next termSetWidth.
+void termSetWideAdvance(Terminal* t, float (*advance)(unsigned int codepoint, void* user), void* user) {
+    t->wideAdvance = advance;
+    t->wideAdvanceUser = user;
+}
+
+// Starts re-wrapping everything for a new width. The live screen is wrapped right away and
+// the history by termRewrapStep, newest lines first.
+void termSetWidth(Terminal* t, float width, const float advance[96]) {
+    t->wrapWidth = width;
+    memcpy(t->advance, advance, sizeof(t->advance));
+    t->rowFirst = 0;
+    t->rowCount = 0;
+
+    t->rewrapPending = t->history.count > 0;
+    t->rewrapNext = t->history.firstSeq + t->history.count - 1;
+    termLayoutLive(t);
+}
+
+// Wraps up to maxLines more history lines of a pending re-wrap. Returns the number of rows
+// added in front of the existing ones.
+int termRewrapStep(Terminal* t, int maxLines) {
+    int added = 0;
+
+    while (t->rewrapPending && maxLines-- > 0) {
+        int rows = scrollbackHas(&t->history, t->rewrapNext) ? termPrependRows(t, t->rewrapNext) : -1;
+        if (rows < 0) {
+            t->rewrapPending = 0;
+            break;
+        }
+        added += rows;
+
+        if (t->rewrapNext == t->history.firstSeq) t->rewrapPending = 0;
+        else t->rewrapNext--;
+    }
+
+    return added;
+}
+
+// Wrapped history rows followed by the rows of the live screen.
+int termRowCount(const Terminal* t) {
+    return t->rowCount + t->liveCount;
+}
+
+const VtCell* termRow(const Terminal* t, int index, int* outLength) {
+    const TermRow* row;
+    const VtCell* cells;
+    int length;
+
+    if (index < t->rowCount) {
+        row = termRowAt(t, index);
+        cells = termHistoryCells(t, row->raw, &length);
+    } else {
+        row = &t->liveRows[index - t->rowCount];
+        cells = vtRow(&t->screen, row->raw, &length);
+    }
+
+    *outLength = row->length;
+    return cells + row->start;
+}
+
+// What the terminal has allocated: screen cells, history arena and line ring, and rows.
+size_t termMemoryBytes(const Terminal* t) {
+    size_t screenCells = (size_t)t->screen.rows * t->screen.cols;
+    return screenCells * (sizeof(VtCell) + sizeof(TermRow)) + (t->screen.rows + t->screen.cols) * sizeof(int) +
+           t->history.arenaSize + t->history.lineCapacity * sizeof(ScrollbackLine) +
+           t->rowCapacity * sizeof(TermRow);
+}
\ No newline at end of file
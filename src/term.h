@@ -0,0 +1,56 @@
+#ifndef TERM_H
+#define TERM_H
+
+#include <stddef.h>
+
+#include "scrollback.h"
+#include "vt.h"
+
+// One wrapped row: a slice of cells from a history line, named by its sequence number, or
+// from a row of the live screen.
+typedef struct {
+    unsigned int raw;
+    int start;
+    int length;
+} TermRow;
+
+// The terminal panel without any drawing: output is parsed into the cells of screen, rows
+// that scroll off its top are kept as raw cells in history, and both are wrapped into rows
+// for a width in pixels. Wrapped history rows are a ring, oldest first, that grows up to one
+// row per stored cell or line; the live screen is re-wrapped after every write.
+typedef struct {
+    VtTerm screen;
+    Scrollback history;
+
+    TermRow* rows;
+    int rowCapacity;
+    int rowFirst;
+    int rowCount;
+
+    TermRow* liveRows;
+    int liveCount;
+    int* wrapStarts;
+
+    // Width the rows were wrapped for, and the advance of each glyph from ' ' to DEL. Cells
+    // past ASCII are measured by wideAdvance, or as '?' without one. After a resize the
+    // history is re-wrapped newest first, with rewrapNext the next older line.
+    float wrapWidth;
+    float advance[96];
+    float (*wideAdvance)(unsigned int codepoint, void* user);
+    void* wideAdvanceUser;
+    int rewrapPending;
+    unsigned int rewrapNext;
+} Terminal;
+
+int termInit(Terminal* t, int rows, int cols, int scrollbackLines, size_t scrollbackBytes);
+void termFree(Terminal* t);
+void termWrite(Terminal* t, const char* data, size_t length);
+void termSetWidth(Terminal* t, float width, const float advance[96]);
+void termSetWideAdvance(Terminal* t, float (*advance)(unsigned int codepoint, void* user), void* user);
+int termRewrapStep(Terminal* t, int maxLines);
+int termRowCount(const Terminal* t);
+const VtCell* termRow(const Terminal* t, int index, int* outLength);
+char termGlyph(const VtCell* cell);
+size_t termMemoryBytes(const Terminal* t);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "thread.h"
+
+typedef struct {
+    ThreadFunc fn;
+    void* arg;
+} ThreadStart;
+
+#ifdef _WIN32
+
+static DWORD WINAPI threadMain(LPVOID param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+int threadStart(Thread* t, ThreadFunc fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start) return 0;
+    start->fn = fn;
+    start->arg = arg;
+
+    *t = CreateThread(NULL, 0, threadMain, start, 0, NULL);
+    if (!*t) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+void threadJoin(Thread* t) {
+    WaitForSingleObject(*t, INFINITE);
+    CloseHandle(*t);
+}
+
+void mutexInit(Mutex* m) { InitializeCriticalSection(m); }
+void mutexDestroy(Mutex* m) { DeleteCriticalSection(m); }
+void mutexLock(Mutex* m) { EnterCriticalSection(m); }
+void mutexUnlock(Mutex* m) { LeaveCriticalSection(m); }
+
+void condInit(Cond* c) { InitializeConditionVariable(c); }
+void condDestroy(Cond* c) { (void)c; }
+void condWait(Cond* c, Mutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+void condSignal(Cond* c) { WakeConditionVariable(c); }
+
+// Returns 0 if the wait timed out.
+int condWaitTimeout(Cond* c, Mutex* m, int milliseconds) {
+    return SleepConditionVariableCS(c, m, (DWORD)milliseconds) != 0;
+}
+
+#else
+
+static void* threadMain(void* param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int threadStart(Thread* t, ThreadFunc fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start) return 0;
+    start->fn = fn;
+    start->arg = arg;
+
+    if (pthread_create(t, NULL, threadMain, start) != 0) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+void threadJoin(Thread* t) {
+    pthread_join(*t, NULL);
+}
+
+void mutexInit(Mutex* m) { pthread_mutex_init(m, NULL); }
+void mutexDestroy(Mutex* m) { pthread_mutex_destroy(m); }
+void mutexLock(Mutex* m) { pthread_mutex_lock(m); }
+void mutexUnlock(Mutex* m) { pthread_mutex_unlock(m); }
+
+void condInit(Cond* c) { pthread_cond_init(c, NULL); }
+void condDestroy(Cond* c) { pthread_cond_destroy(c); }
+void condWait(Cond* c, Mutex* m) { pthread_cond_wait(c, m); }
+void condSignal(Cond* c) { pthread_cond_signal(c); }
+
+// Returns 0 if the wait timed out.
+int condWaitTimeout(Cond* c, Mutex* m, int milliseconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(c, m, &deadline) == 0;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+// Minimal worker-thread, mutex and condition variable wrappers over Win32 and pthreads.
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#endif
+
+typedef void (*ThreadFunc)(void* arg);
+
+int threadStart(Thread* t, ThreadFunc fn, void* arg);
+void threadJoin(Thread* t);
+
+void mutexInit(Mutex* m);
+void mutexDestroy(Mutex* m);
+void mutexLock(Mutex* m);
+void mutexUnlock(Mutex* m);
+
+void condInit(Cond* c);
+void condDestroy(Cond* c);
+void condWait(Cond* c, Mutex* m);
+int condWaitTimeout(Cond* c, Mutex* m, int milliseconds);
+void condSignal(Cond* c);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,634 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vt.h"
+
+enum {
+    VT_GROUND,
+    VT_ESCAPE,
+    VT_ESCAPE_INTERMEDIATE,
+    VT_CSI_ENTRY,
+    VT_CSI_PARAM,
+    VT_CSI_INTERMEDIATE,
+    VT_CSI_IGNORE,
+    VT_DCS_ENTRY,
+    VT_DCS_PARAM,
+    VT_DCS_INTERMEDIATE,
+    VT_DCS_PASSTHROUGH,
+    VT_DCS_IGNORE,
+    VT_OSC_STRING,
+    VT_SOS_PM_APC_STRING,
+    VT_STATE_COUNT
+};
+
+enum {
+    VT_ACTION_NONE,
+    VT_ACTION_PRINT,
+    VT_ACTION_EXECUTE,
+    VT_ACTION_COLLECT,
+    VT_ACTION_PARAM,
+    VT_ACTION_ESC_DISPATCH,
+    VT_ACTION_CSI_DISPATCH
+};
+
+// xterm's default 16 colors.
+const unsigned char vtPaletteRGB[16][3] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+    {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+    {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+};
+
+// vtTable[state][byte] holds (action << 4) | next state, built once from the DEC ANSI
+// parser state diagram. 8-bit C1 controls are not recognized, since bytes 0x80-0xFF are
+// UTF-8 here; DCS, OSC, SOS, PM and APC payloads are consumed and ignored.
+static unsigned char vtTable[VT_STATE_COUNT][256];
+static int vtTableBuilt = 0;
+
+static void vtSet(int state, int from, int to, int action, int next) {
+    for (int c = from; c <= to; c++) vtTable[state][c] = (unsigned char)((action << 4) | next);
+}
+
+static void vtSetExecuteC0(int state, int action) {
+    vtSet(state, 0x00, 0x17, action, state);
+    vtSet(state, 0x19, 0x19, action, state);
+    vtSet(state, 0x1C, 0x1F, action, state);
+}
+
+static void vtBuildTable() {
+    for (int s = 0; s < VT_STATE_COUNT; s++) {
+        vtSet(s, 0x00, 0xFF, VT_ACTION_NONE, s);
+        vtSetExecuteC0(s, VT_ACTION_EXECUTE);
+    }
+
+    vtSet(VT_GROUND, 0x20, 0x7E, VT_ACTION_PRINT, VT_GROUND);
+    vtSet(VT_GROUND, 0x80, 0xFF, VT_ACTION_PRINT, VT_GROUND);
+
+    vtSet(VT_ESCAPE, 0x20, 0x2F, VT_ACTION_COLLECT, VT_ESCAPE_INTERMEDIATE);
+    vtSet(VT_ESCAPE, 0x30, 0x7E, VT_ACTION_ESC_DISPATCH, VT_GROUND);
+    vtSet(VT_ESCAPE, 0x5B, 0x5B, VT_ACTION_NONE, VT_CSI_ENTRY);
+    vtSet(VT_ESCAPE, 0x5D, 0x5D, VT_ACTION_NONE, VT_OSC_STRING);
+    vtSet(VT_ESCAPE, 0x50, 0x50, VT_ACTION_NONE, VT_DCS_ENTRY);
+    vtSet(VT_ESCAPE, 0x58, 0x58, VT_ACTION_NONE, VT_SOS_PM_APC_STRING);
+    vtSet(VT_ESCAPE, 0x5E, 0x5F, VT_ACTION_NONE, VT_SOS_PM_APC_STRING);
+
+    vtSet(VT_ESCAPE_INTERMEDIATE, 0x20, 0x2F, VT_ACTION_COLLECT, VT_ESCAPE_INTERMEDIATE);
+    vtSet(VT_ESCAPE_INTERMEDIATE, 0x30, 0x7E, VT_ACTION_ESC_DISPATCH, VT_GROUND);
+
+    vtSet(VT_CSI_ENTRY, 0x20, 0x2F, VT_ACTION_COLLECT, VT_CSI_INTERMEDIATE);
+    vtSet(VT_CSI_ENTRY, 0x30, 0x39, VT_ACTION_PARAM, VT_CSI_PARAM);
+    vtSet(VT_CSI_ENTRY, 0x3A, 0x3A, VT_ACTION_NONE, VT_CSI_IGNORE);
+    vtSet(VT_CSI_ENTRY, 0x3B, 0x3B, VT_ACTION_PARAM, VT_CSI_PARAM);
+    vtSet(VT_CSI_ENTRY, 0x3C, 0x3F, VT_ACTION_COLLECT, VT_CSI_PARAM);
+    vtSet(VT_CSI_ENTRY, 0x40, 0x7E, VT_ACTION_CSI_DISPATCH, VT_GROUND);
+
+    vtSet(VT_CSI_PARAM, 0x20, 0x2F, VT_ACTION_COLLECT, VT_CSI_INTERMEDIATE);
+    vtSet(VT_CSI_PARAM, 0x30, 0x39, VT_ACTION_PARAM, VT_CSI_PARAM);
+    vtSet(VT_CSI_PARAM, 0x3A, 0x3A, VT_ACTION_NONE, VT_CSI_IGNORE);
+    vtSet(VT_CSI_PARAM, 0x3B, 0x3B, VT_ACTION_PARAM, VT_CSI_PARAM);
+    vtSet(VT_CSI_PARAM, 0x3C, 0x3F, VT_ACTION_NONE, VT_CSI_IGNORE);
+    vtSet(VT_CSI_PARAM, 0x40, 0x7E, VT_ACTION_CSI_DISPATCH, VT_GROUND);
+
+    vtSet(VT_CSI_INTERMEDIATE, 0x20, 0x2F, VT_ACTION_COLLECT, VT_CSI_INTERMEDIATE);
+    vtSet(VT_CSI_INTERMEDIATE, 0x30, 0x3F, VT_ACTION_NONE, VT_CSI_IGNORE);
+    vtSet(VT_CSI_INTERMEDIATE, 0x40, 0x7E, VT_ACTION_CSI_DISPATCH, VT_GROUND);
+
+    vtSet(VT_CSI_IGNORE, 0x40, 0x7E, VT_ACTION_NONE, VT_GROUND);
+
+    // Device control strings are parsed for their structure only.
+    for (int s = VT_DCS_ENTRY; s <= VT_SOS_PM_APC_STRING; s++) vtSetExecuteC0(s, VT_ACTION_NONE);
+    vtSet(VT_DCS_ENTRY, 0x20, 0x2F, VT_ACTION_NONE, VT_DCS_INTERMEDIATE);
+    vtSet(VT_DCS_ENTRY, 0x30, 0x39, VT_ACTION_NONE, VT_DCS_PARAM);
+    vtSet(VT_DCS_ENTRY, 0x3A, 0x3A, VT_ACTION_NONE, VT_DCS_IGNORE);
+    vtSet(VT_DCS_ENTRY, 0x3B, 0x3F, VT_ACTION_NONE, VT_DCS_PARAM);
+    vtSet(VT_DCS_ENTRY, 0x40, 0x7E, VT_ACTION_NONE, VT_DCS_PASSTHROUGH);
+    vtSet(VT_DCS_PARAM, 0x20, 0x2F, VT_ACTION_NONE, VT_DCS_INTERMEDIATE);
+    vtSet(VT_DCS_PARAM, 0x3A, 0x3A, VT_ACTION_NONE, VT_DCS_IGNORE);
+    vtSet(VT_DCS_PARAM, 0x3C, 0x3F, VT_ACTION_NONE, VT_DCS_IGNORE);
+    vtSet(VT_DCS_PARAM, 0x40, 0x7E, VT_ACTION_NONE, VT_DCS_PASSTHROUGH);
+    vtSet(VT_DCS_INTERMEDIATE, 0x30, 0x3F, VT_ACTION_NONE, VT_DCS_IGNORE);
+    vtSet(VT_DCS_INTERMEDIATE, 0x40, 0x7E, VT_ACTION_NONE, VT_DCS_PASSTHROUGH);
+
+    // xterm also ends an OSC at BEL.
+    vtSet(VT_OSC_STRING, 0x07, 0x07, VT_ACTION_NONE, VT_GROUND);
+
+    // CAN and SUB abort any sequence; ESC starts a new one from anywhere.
+    for (int s = 0; s < VT_STATE_COUNT; s++) {
+        vtSet(s, 0x18, 0x18, VT_ACTION_EXECUTE, VT_GROUND);
+        vtSet(s, 0x1A, 0x1A, VT_ACTION_EXECUTE, VT_GROUND);
+        vtSet(s, 0x1B, 0x1B, VT_ACTION_NONE, VT_ESCAPE);
+    }
+
+    vtTableBuilt = 1;
+}
+
+static VtCell* vtRowCells(const VtTerm* t, int row) {
+    return &t->cells[((t->top + row) % t->rows) * t->cols];
+}
+
+static VtCell vtBlank(const VtTerm* t) {
+    VtCell blank = { ' ', VT_DEFAULT_COLOR, t->bg };
+    return blank;
+}
+
+// Blanks [from, to) of a row with the current background. Cells past rowUsed are already
+// blank, so only a non-default background extends it.
+static void vtEraseCells(VtTerm* t, int row, int from, int to) {
+    int* used = &t->rowUsed[(t->top + row) % t->rows];
+    if (to > t->cols) to = t->cols;
+    if (t->bg == VT_DEFAULT_COLOR && to > *used) to = *used;
+    if (from >= to) return;
+
+    VtCell* cells = vtRowCells(t, row);
+    VtCell blank = vtBlank(t);
+    for (int c = from; c < to; c++) cells[c] = blank;
+
+    if (t->bg != VT_DEFAULT_COLOR) {
+        if (to > *used) *used = to;
+    } else if (to == *used) {
+        *used = from;
+    }
+}
+
+static void vtClearRow(VtTerm* t, int row) {
+    vtEraseCells(t, row, 0, t->cols);
+}
+
+int vtInit(VtTerm* t, int rows, int cols) {
+    if (!vtTableBuilt) vtBuildTable();
+
+    memset(t, 0, sizeof(*t));
+    t->rows = rows;
+    t->cols = cols;
+    t->fg = VT_DEFAULT_COLOR;
+    t->bg = VT_DEFAULT_COLOR;
+    t->cells = malloc(rows * cols * sizeof(VtCell));
+    t->rowUsed = calloc(rows, sizeof(int));
+    if (!t->cells || !t->rowUsed) {
+        vtFree(t);
+        return 0;
+    }
+
+    VtCell blank = vtBlank(t);
+    for (int i = 0; i < rows * cols; i++) t->cells[i] = blank;
+    return 1;
+}
+
+void vtFree(VtTerm* t) {
+    free(t->cells);
+    free(t->rowUsed);
+    t->cells = NULL;
+    t->rowUsed = NULL;
+}
+
+// Moves the top row out to scrolledOff and recycles it as the new bottom row.
+static void vtScrollUp(VtTerm* t) {
+    int slot = t->top;
+    int used = t->rowUsed[slot];
+    if (t->scrolledOff) t->scrolledOff(t->user, &t->cells[slot * t->cols], used);
+
+    VtCell blank = { ' ', VT_DEFAULT_COLOR, VT_DEFAULT_COLOR };
+    for (int c = 0; c < used; c++) t->cells[slot * t->cols + c] = blank;
+    t->rowUsed[slot] = 0;
+    t->top = (t->top + 1) % t->rows;
+}
+
+static void vtLineFeed(VtTerm* t) {
+    t->wrapPending = 0;
+    if (t->cursorRow + 1 < t->rows) t->cursorRow++;
+    else vtScrollUp(t);
+}
+
+// Inserts blank rows at row, pushing the rows below it down and off the bottom.
+static void vtInsertRows(VtTerm* t, int row, int count) {
+    if (count > t->rows - row) count = t->rows - row;
+    for (int r = t->rows - 1; r >= row + count; r--) {
+        memcpy(vtRowCells(t, r), vtRowCells(t, r - count), t->cols * sizeof(VtCell));
+        t->rowUsed[(t->top + r) % t->rows] = t->rowUsed[(t->top + r - count) % t->rows];
+    }
+    for (int r = row; r < row + count; r++) {
+        t->rowUsed[(t->top + r) % t->rows] = t->cols;
+        vtClearRow(t, r);
+    }
+}
+
+// Deletes rows at row, pulling the rows below it up; blank rows fill in at the bottom.
+static void vtDeleteRows(VtTerm* t, int row, int count) {
+    if (count > t->rows - row) count = t->rows - row;
+    for (int r = row; r + count < t->rows; r++) {
+        memcpy(vtRowCells(t, r), vtRowCells(t, r + count), t->cols * sizeof(VtCell));
+        t->rowUsed[(t->top + r) % t->rows] = t->rowUsed[(t->top + r + count) % t->rows];
+    }
+    for (int r = t->rows - count; r < t->rows; r++) {
+        t->rowUsed[(t->top + r) % t->rows] = t->cols;
+        vtClearRow(t, r);
+    }
+}
+
+static void vtPutCell(VtTerm* t, unsigned short ch) {
+    if (t->wrapPending) {
+        t->cursorCol = 0;
+        vtLineFeed(t);
+    }
+
+    unsigned char fg = t->fg;
+    unsigned char bg = t->bg;
+    if (t->bold && fg < 8) fg += 8;
+    if (t->inverse) {
+        unsigned char swap = fg;
+        fg = bg;
+        bg = swap;
+    }
+
+    VtCell* cell = &vtRowCells(t, t->cursorRow)[t->cursorCol];
+    cell->ch = ch;
+    cell->fg = fg;
+    cell->bg = bg;
+
+    int* used = &t->rowUsed[(t->top + t->cursorRow) % t->rows];
+    if (t->cursorCol + 1 > *used) *used = t->cursorCol + 1;
+
+    if (t->cursorCol + 1 < t->cols) t->cursorCol++;
+    else t->wrapPending = 1;
+}
+
+// The plain-text fast path: a run of printable ASCII written row by row without going
+// through the state table.
+static void vtPutAscii(VtTerm* t, const unsigned char* text, size_t length) {
+    unsigned char fg = t->fg;
+    unsigned char bg = t->bg;
+    if (t->bold && fg < 8) fg += 8;
+    if (t->inverse) {
+        unsigned char swap = fg;
+        fg = bg;
+        bg = swap;
+    }
+
+    while (length > 0) {
+        if (t->wrapPending) {
+            t->cursorCol = 0;
+            vtLineFeed(t);
+        }
+
+        int room = t->cols - t->cursorCol;
+        int n = length < (size_t)room ? (int)length : room;
+
+        VtCell* cell = &vtRowCells(t, t->cursorRow)[t->cursorCol];
+        for (int i = 0; i < n; i++) {
+            cell[i].ch = text[i];
+            cell[i].fg = fg;
+            cell[i].bg = bg;
+        }
+
+        int* used = &t->rowUsed[(t->top + t->cursorRow) % t->rows];
+        if (t->cursorCol + n > *used) *used = t->cursorCol + n;
+
+        t->cursorCol += n;
+        if (t->cursorCol >= t->cols) {
+            t->cursorCol = t->cols - 1;
+            t->wrapPending = 1;
+        }
+
+        text += n;
+        length -= n;
+    }
+}
+
+static void vtPrint(VtTerm* t, unsigned char c) {
+    if (c < 0x80) {
+        if (t->utf8Remaining) {
+            t->utf8Remaining = 0;
+            vtPutCell(t, 0xFFFD);
+        }
+        vtPutCell(t, c);
+        return;
+    }
+
+    if ((c & 0xC0) == 0x80) {
+        if (!t->utf8Remaining) {
+            vtPutCell(t, 0xFFFD);
+            return;
+        }
+        t->codepoint = (t->codepoint << 6) | (c & 0x3F);
+        if (--t->utf8Remaining == 0) vtPutCell(t, t->codepoint <= 0xFFFF ? (unsigned short)t->codepoint : 0xFFFD);
+        return;
+    }
+
+    if (t->utf8Remaining) vtPutCell(t, 0xFFFD);
+
+    if ((c & 0xE0) == 0xC0) {
+        t->codepoint = c & 0x1F;
+        t->utf8Remaining = 1;
+    } else if ((c & 0xF0) == 0xE0) {
+        t->codepoint = c & 0x0F;
+        t->utf8Remaining = 2;
+    } else if ((c & 0xF8) == 0xF0) {
+        t->codepoint = c & 0x07;
+        t->utf8Remaining = 3;
+    } else {
+        t->utf8Remaining = 0;
+        vtPutCell(t, 0xFFFD);
+    }
+}
+
+static void vtExecute(VtTerm* t, unsigned char c) {
+    switch (c) {
+        case 0x08: // BS
+            if (t->cursorCol > 0) t->cursorCol--;
+            t->wrapPending = 0;
+            break;
+        case 0x09: // HT
+            t->cursorCol = (t->cursorCol / 8 + 1) * 8;
+            if (t->cursorCol >= t->cols) t->cursorCol = t->cols - 1;
+            break;
+        case 0x0A: // LF
+        case 0x0B: // VT
+        case 0x0C: // FF
+            vtLineFeed(t);
+            break;
+        case 0x0D: // CR
+            t->cursorCol = 0;
+            t->wrapPending = 0;
+            break;
+    }
+}
+
+static int vtParam(const VtTerm* t, int index, int fallback) {
+    if (index >= t->paramCount || t->params[index] == 0) return fallback;
+    return t->params[index];
+}
+
+static void vtMoveTo(VtTerm* t, int row, int col) {
+    if (row < 0) row = 0;
+    if (row >= t->rows) row = t->rows - 1;
+    if (col < 0) col = 0;
+    if (col >= t->cols) col = t->cols - 1;
+    t->cursorRow = row;
+    t->cursorCol = col;
+    t->wrapPending = 0;
+}
+
+// Maps an RGB color to the closest of the 16 palette entries.
+static unsigned char vtNearestColor(int r, int g, int b) {
+    int best = 0;
+    int bestDistance = 0x7fffffff;
+    for (int i = 0; i < 16; i++) {
+        int dr = r - vtPaletteRGB[i][0];
+        int dg = g - vtPaletteRGB[i][1];
+        int db = b - vtPaletteRGB[i][2];
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return (unsigned char)best;
+}
+
+static unsigned char vtColor256(int n) {
+    if (n < 16) return (unsigned char)n;
+    if (n < 232) {
+        static const int levels[6] = { 0, 95, 135, 175, 215, 255 };
+        n -= 16;
+        return vtNearestColor(levels[n / 36], levels[(n / 6) % 6], levels[n % 6]);
+    }
+    int gray = 8 + (n - 232) * 10;
+    return vtNearestColor(gray, gray, gray);
+}
+
+// Parses an extended color (38;5;n or 38;2;r;g;b) starting after the 38/48. Returns the
+// number of parameters consumed.
+static int vtExtendedColor(const VtTerm* t, int i, unsigned char* out) {
+    if (i < t->paramCount && t->params[i] == 5 && i + 1 < t->paramCount) {
+        *out = vtColor256(t->params[i + 1] & 0xFF);
+        return 2;
+    }
+    if (i < t->paramCount && t->params[i] == 2 && i + 3 < t->paramCount) {
+        *out = vtNearestColor(t->params[i + 1], t->params[i + 2], t->params[i + 3]);
+        return 4;
+    }
+    return 0;
+}
+
+static void vtSelectGraphics(VtTerm* t) {
+    if (t->paramCount == 0) t->params[t->paramCount++] = 0;
+
+    for (int i = 0; i < t->paramCount; i++) {
+        int p = t->params[i];
+        if (p == 0) {
+            t->fg = VT_DEFAULT_COLOR;
+            t->bg = VT_DEFAULT_COLOR;
+            t->bold = 0;
+            t->inverse = 0;
+        } else if (p == 1) t->bold = 1;
+        else if (p == 22) t->bold = 0;
+        else if (p == 7) t->inverse = 1;
+        else if (p == 27) t->inverse = 0;
+        else if (p >= 30 && p <= 37) t->fg = (unsigned char)(p - 30);
+        else if (p == 38) i += vtExtendedColor(t, i + 1, &t->fg);
+        else if (p == 39) t->fg = VT_DEFAULT_COLOR;
+        else if (p >= 40 && p <= 47) t->bg = (unsigned char)(p - 40);
+        else if (p == 48) i += vtExtendedColor(t, i + 1, &t->bg);
+        else if (p == 49) t->bg = VT_DEFAULT_COLOR;
+        else if (p >= 90 && p <= 97) t->fg = (unsigned char)(p - 90 + 8);
+        else if (p >= 100 && p <= 107) t->bg = (unsigned char)(p - 100 + 8);
+    }
+}
+
+static void vtCsiDispatch(VtTerm* t, unsigned char final) {
+    // Private modes (cursor visibility, bracketed paste, ...) have no effect on this panel.
+    if (t->marker) {
+        return;
+    }
+
+    int n = vtParam(t, 0, 1);
+    int row = t->cursorRow;
+    int col = t->cursorCol;
+
+    switch (final) {
+        case 'A': vtMoveTo(t, row - n, col); break;
+        case 'B': vtMoveTo(t, row + n, col); break;
+        case 'C': vtMoveTo(t, row, col + n); break;
+        case 'D': vtMoveTo(t, row, col - n); break;
+        case 'E': vtMoveTo(t, row + n, 0); break;
+        case 'F': vtMoveTo(t, row - n, 0); break;
+        case 'G':
+        case '`': vtMoveTo(t, row, n - 1); break;
+        case 'd': vtMoveTo(t, n - 1, col); break;
+        case 'H':
+        case 'f': vtMoveTo(t, vtParam(t, 0, 1) - 1, vtParam(t, 1, 1) - 1); break;
+
+        case 'J': {
+            int mode = vtParam(t, 0, 0);
+            if (mode == 0) {
+                vtEraseCells(t, row, col, t->cols);
+                for (int r = row + 1; r < t->rows; r++) vtClearRow(t, r);
+            } else if (mode == 1) {
+                for (int r = 0; r < row; r++) vtClearRow(t, r);
+                vtEraseCells(t, row, 0, col + 1);
+            } else if (mode == 2) {
+                for (int r = 0; r < t->rows; r++) vtClearRow(t, r);
+            }
+            break;
+        }
+
+        case 'K': {
+            int mode = vtParam(t, 0, 0);
+            if (mode == 0) vtEraseCells(t, row, col, t->cols);
+            else if (mode == 1) vtEraseCells(t, row, 0, col + 1);
+            else if (mode == 2) vtClearRow(t, row);
+            break;
+        }
+
+        case 'X': vtEraseCells(t, row, col, col + n); break;
+
+        case '@':
+        case 'P': {
+            VtCell* cells = vtRowCells(t, row);
+            int* used = &t->rowUsed[(t->top + row) % t->rows];
+            if (n > t->cols - col) n = t->cols - col;
+            if (final == '@') {
+                memmove(cells + col + n, cells + col, (t->cols - col - n) * sizeof(VtCell));
+                *used = *used + n > t->cols ? t->cols : *used + n;
+                VtCell blank = vtBlank(t);
+                for (int c = col; c < col + n; c++) cells[c] = blank;
+            } else {
+                memmove(cells + col, cells + col + n, (t->cols - col - n) * sizeof(VtCell));
+                VtCell blank = vtBlank(t);
+                for (int c = t->cols - n; c < t->cols; c++) cells[c] = blank;
+                if (t->bg != VT_DEFAULT_COLOR) *used = t->cols;
+                else if (*used > col) *used = *used - n > col ? *used - n : col;
+            }
+            break;
+        }
+
+        case 'L': vtInsertRows(t, row, n); break;
+        case 'M': vtDeleteRows(t, row, n); break;
+        case 'S': for (int i = 0; i < n && i < t->rows; i++) vtScrollUp(t); break;
+        case 'T': vtInsertRows(t, 0, n); break;
+
+        case 'm': vtSelectGraphics(t); break;
+
+        case 'n':
+            if (vtParam(t, 0, 0) == 6 && t->reply) {
+                char report[32];
+                int length = snprintf(report, sizeof(report), "\x1b[%d;%dR", row + 1, col + 1);
+                t->reply(t->user, report, length);
+            }
+            break;
+
+        case 's':
+            t->savedRow = row;
+            t->savedCol = col;
+            break;
+        case 'u': vtMoveTo(t, t->savedRow, t->savedCol); break;
+    }
+}
+
+static void vtEscDispatch(VtTerm* t, unsigned char final) {
+    // Character set designations and the like carry an intermediate; none apply here.
+    if (t->intermediate) return;
+
+    switch (final) {
+        case 'D': vtLineFeed(t); break;
+        case 'E':
+            t->cursorCol = 0;
+            vtLineFeed(t);
+            break;
+        case 'M':
+            if (t->cursorRow > 0) t->cursorRow--;
+            else vtInsertRows(t, 0, 1);
+            t->wrapPending = 0;
+            break;
+        case '7':
+            t->savedRow = t->cursorRow;
+            t->savedCol = t->cursorCol;
+            break;
+        case '8': vtMoveTo(t, t->savedRow, t->savedCol); break;
+        case 'c':
+            for (int r = 0; r < t->rows; r++) vtClearRow(t, r);
+            t->fg = VT_DEFAULT_COLOR;
+            t->bg = VT_DEFAULT_COLOR;
+            t->bold = 0;
+            t->inverse = 0;
+            vtMoveTo(t, 0, 0);
+            break;
+    }
+}
+
+void vtWrite(VtTerm* t, const char* data, size_t length) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + length;
+
+    while (p < end) {
+        unsigned char c = *p;
+
+        if (t->state == VT_GROUND && c >= 0x20 && c < 0x7F && !t->utf8Remaining) {
+            const unsigned char* run = p;
+            while (p < end && *p >= 0x20 && *p < 0x7F) p++;
+            vtPutAscii(t, run, p - run);
+            continue;
+        }
+        p++;
+
+        unsigned char entry = vtTable[t->state][c];
+        int action = entry >> 4;
+        int next = entry & 0x0F;
+
+        switch (action) {
+            case VT_ACTION_PRINT:
+                vtPrint(t, c);
+                break;
+            case VT_ACTION_EXECUTE:
+                vtExecute(t, c);
+                break;
+            case VT_ACTION_COLLECT:
+                if (c >= 0x3C && c <= 0x3F) t->marker = (char)c;
+                else t->intermediate = (char)c;
+                break;
+            case VT_ACTION_PARAM:
+                if (t->paramCount == 0) t->paramCount = 1;
+                if (c == ';') {
+                    if (t->paramCount < VT_MAX_PARAMS) t->params[t->paramCount++] = 0;
+                } else {
+                    int* value = &t->params[t->paramCount - 1];
+                    if (*value < 100000) *value = *value * 10 + (c - '0');
+                }
+                break;
+            case VT_ACTION_ESC_DISPATCH:
+                vtEscDispatch(t, c);
+                break;
+            case VT_ACTION_CSI_DISPATCH:
+                vtCsiDispatch(t, c);
+                break;
+        }
+
+        // Every sequence starts at ESC, so entering it clears what the previous one collected.
+        if (next == VT_ESCAPE) {
+            t->paramCount = 0;
+            t->marker = 0;
+            t->intermediate = 0;
+            memset(t->params, 0, sizeof(t->params));
+        }
+        if (next != VT_GROUND && t->utf8Remaining) {
+            t->utf8Remaining = 0;
+        }
+        t->state = next;
+    }
+}
+
+// Returns a screen row and the number of cells in use on it.
+const VtCell* vtRow(const VtTerm* t, int row, int* outLength) {
+    *outLength = t->rowUsed[(t->top + row) % t->rows];
+    return vtRowCells(t, row);
+}
+
+// Rows from the top of the screen through the last one with content or the cursor.
+int vtUsedRows(const VtTerm* t) {
+    int used = t->cursorCol > 0 ? t->cursorRow + 1 : 0;
+    for (int r = t->rows - 1; r >= used; r--) {
+        if (t->rowUsed[(t->top + r) % t->rows] > 0) return r + 1;
+    }
+    return used;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef VT_H
+#define VT_H
+
+#include <stddef.h>
+
+// Colors 0-15 are the ANSI palette; VT_DEFAULT_COLOR means the panel's own fg or bg.
+#define VT_DEFAULT_COLOR 16
+#define VT_MAX_PARAMS 16
+
+typedef struct {
+    unsigned short ch;
+    unsigned char fg;
+    unsigned char bg;
+} VtCell;
+
+// A terminal screen fed by a table-driven VT/ANSI parser (the DEC state machine). Rows that
+// scroll off the top are handed to scrolledOff; replies to queries such as a cursor position
+// report go to reply. Screen rows are kept in a ring, so scrolling moves no cells.
+typedef struct {
+    int rows;
+    int cols;
+    VtCell* cells;
+    int* rowUsed;
+    int top;
+
+    int cursorRow;
+    int cursorCol;
+    int wrapPending;
+    int savedRow;
+    int savedCol;
+
+    unsigned char fg;
+    unsigned char bg;
+    int bold;
+    int inverse;
+
+    int state;
+    int params[VT_MAX_PARAMS];
+    int paramCount;
+    char marker;
+    char intermediate;
+
+    unsigned int codepoint;
+    int utf8Remaining;
+
+    void (*scrolledOff)(void* user, const VtCell* cells, int count);
+    void (*reply)(void* user, const char* text, int length);
+    void* user;
+} VtTerm;
+
+extern const unsigned char vtPaletteRGB[16][3];
+
+int vtInit(VtTerm* t, int rows, int cols);
+void vtFree(VtTerm* t);
+void vtWrite(VtTerm* t, const char* data, size_t length);
+const VtCell* vtRow(const VtTerm* t, int row, int* outLength);
+int vtUsedRows(const VtTerm* t);
+
+#endif
\ No newline at end of file